@@ -0,0 +1,228 @@
+#include "stdafx.h"
+#include "AdaptiveSampling.h"
+#include "Profiler.h"
+
+// Defines the functions declared in its AdaptiveSampling.h
+// All the functions descriptions could be found there
+
+#include <atomic>
+
+namespace Graphics
+{
+	namespace Rendering
+	{
+		// Largest difference of a color channel between two colors clamped to the displayable range
+		inline float colorContrast(const glm_color_t& a, const glm_color_t& b)
+		{
+			const glm_color_t difference = glm::abs(glm::clamp(a, 0.f, 1.f) - glm::clamp(b, 0.f, 1.f));
+			return std::max(difference.r, std::max(difference.g, difference.b));
+		}
+
+		// Extra samples traced in a refined pixel, the center cell of an odd grid being the base sample
+		inline int refinementSamples(int gridSize)
+		{
+			return gridSize * gridSize - gridSize % 2;
+		}
+
+		int AdaptiveSampler::render(FrameBuffer& frame, const SampleTracer& traceSample, utilities::ThreadPool& pool, const std::vector<char>* filledPixelsPtr)
+		{
+			return renderBatches(frame, [&traceSample](const std::vector<SamplePosition>& positions, std::vector<glm_color_t>& colorsOut) {
+				colorsOut.resize(positions.size());
+				for (size_t i = 0; i < positions.size(); ++i)
+				{
+					colorsOut[i] = traceSample(positions[i].x, positions[i].y);
+				}
+			}, pool, filledPixelsPtr);
+		}
+
+		int AdaptiveSampler::renderBatches(FrameBuffer& frame, const SampleBatchTracer& traceSamples, utilities::ThreadPool& pool, const std::vector<char>* filledPixelsPtr)
+		{
+			auto isFilled = [&](int x, int y) {
+				return filledPixelsPtr != nullptr && (*filledPixelsPtr)[y * frame.width + x] != 0;
+			};
+
+			// BASE SAMPLES
+			// the colors are still written at their place in the rows of the frame
+			pixelOrder.update(frame.width, frame.height);
+			const std::vector<int>& pixels = pixelOrder.pixels();
+			std::atomic<int> samplesCount(0);
+			pool.parallelFor(0, pixelOrder.tileCount(), 1, [&](int tileBegin, int tileEnd) {
+				PROFILE_ZONE("Trace tiles");
+				std::vector<int> tracedPixels{};
+				std::vector<SamplePosition> positions{};
+				std::vector<glm_color_t> colors{};
+				int tileSamples = 0;
+				for (int tile = tileBegin; tile < tileEnd; ++tile)
+				{
+					tracedPixels.clear();
+					positions.clear();
+					for (int i = pixelOrder.tileBegin(tile); i < pixelOrder.tileEnd(tile); ++i)
+					{
+						const int x = pixels[i] % frame.width;
+						const int y = pixels[i] / frame.width;
+						if (!isFilled(x, y))
+						{
+							tracedPixels.push_back(pixels[i]);
+							positions.push_back(SamplePosition{ x + 0.5f, y + 0.5f });
+						}
+					}
+					traceSamples(positions, colors);
+					for (size_t i = 0; i < tracedPixels.size(); ++i)
+					{
+						frame.pixels[tracedPixels[i]] = colors[i];
+					}
+					tileSamples += static_cast<int>(tracedPixels.size());
+				}
+				samplesCount += tileSamples;
+			});
+
+			// CONTRAST ESTIMATION
+			struct TileEstimate
+			{
+				int x;
+				int y;
+				float contrast;
+				int gridSize;
+				// pixels of the tile that are traced
+				int pixelCount;
+			};
+			std::vector<TileEstimate> contrastedTiles{};
+			for (int tileY = 0; tileY < frame.height; tileY += settings.tileSize)
+			{
+				for (int tileX = 0; tileX < frame.width; tileX += settings.tileSize)
+				{
+					const float contrast = tileContrast(frame, tileX, tileY);
+					if (contrast <= settings.contrastThreshold)
+					{
+						continue;
+					}
+					int pixelCount = 0;
+					for (int y = tileY; y < std::min(tileY + settings.tileSize, frame.height); ++y)
+					{
+						for (int x = tileX; x < std::min(tileX + settings.tileSize, frame.width); ++x)
+						{
+							pixelCount += isFilled(x, y) ? 0 : 1;
+						}
+					}
+					if (pixelCount > 0)
+					{
+						contrastedTiles.push_back(TileEstimate{ tileX, tileY, contrast, 0, pixelCount });
+					}
+				}
+			}
+			std::sort(contrastedTiles.begin(), contrastedTiles.end(),
+				[](const TileEstimate& a, const TileEstimate& b) {
+					return a.contrast > b.contrast;
+				});
+
+			// BUDGET ALLOCATION
+			// done before tracing so that the refined tiles do not depend on the order the threads run
+			const int pixelCount = frame.width * frame.height;
+			int remainingBudget = filledPixelsPtr == nullptr ? settings.sampleBudget
+				: static_cast<int>(static_cast<int64_t>(settings.sampleBudget) * samplesCount / std::max(pixelCount, 1));
+			for (TileEstimate& tile : contrastedTiles)
+			{
+				// the sub-pixel grid grows with the contrast and shrinks to fit in the remaining budget
+				int gridSize = std::min(static_cast<int>(tile.contrast / settings.contrastThreshold) + 1, settings.maxGridSize);
+				while (gridSize >= 2 && refinementSamples(gridSize) * tile.pixelCount > remainingBudget)
+				{
+					--gridSize;
+				}
+				if (gridSize < 2)
+				{
+					continue;
+				}
+				tile.gridSize = gridSize;
+				remainingBudget -= refinementSamples(gridSize) * tile.pixelCount;
+				samplesCount += refinementSamples(gridSize) * tile.pixelCount;
+			}
+
+			// REFINEMENT
+			pool.parallelFor(0, static_cast<int>(contrastedTiles.size()), 1, [&](int tileBegin, int tileEnd) {
+				std::vector<SamplePosition> positions{};
+				std::vector<glm_color_t> colors{};
+				for (int tileIndex = tileBegin; tileIndex < tileEnd; ++tileIndex)
+				{
+					const TileEstimate& tile = contrastedTiles[tileIndex];
+					const int gridSize = tile.gridSize;
+					if (gridSize == 0)
+					{
+						continue;
+					}
+					PROFILE_ZONE("Refine tile");
+
+					const int tileWidth = std::min(settings.tileSize, frame.width - tile.x);
+					const int tileHeight = std::min(settings.tileSize, frame.height - tile.y);
+
+					// the base sample is kept in the average, in the center cell of an odd grid it would trace again
+					const bool hasCenterCell = gridSize % 2 == 1;
+					positions.clear();
+					for (int y = tile.y; y < tile.y + tileHeight; ++y)
+					{
+						for (int x = tile.x; x < tile.x + tileWidth; ++x)
+						{
+							if (isFilled(x, y))
+							{
+								continue;
+							}
+							for (int j = 0; j < gridSize; ++j)
+							{
+								for (int i = 0; i < gridSize; ++i)
+								{
+									if (!(hasCenterCell && 2 * i + 1 == gridSize && 2 * j + 1 == gridSize))
+									{
+										positions.push_back(SamplePosition{ x + (i + 0.5f) / gridSize, y + (j + 0.5f) / gridSize });
+									}
+								}
+							}
+						}
+					}
+					traceSamples(positions, colors);
+
+					// the samples of a pixel follow each other
+					size_t sample = 0;
+					for (int y = tile.y; y < tile.y + tileHeight; ++y)
+					{
+						for (int x = tile.x; x < tile.x + tileWidth; ++x)
+						{
+							if (isFilled(x, y))
+							{
+								continue;
+							}
+							glm_color_t color = frame.at(x, y);
+							for (int i = 0; i < refinementSamples(gridSize); ++i)
+							{
+								color += colors[sample++];
+							}
+							frame.at(x, y) = color / static_cast<float>(hasCenterCell ? gridSize * gridSize : gridSize * gridSize + 1);
+						}
+					}
+				}
+			});
+			return samplesCount;
+		}
+
+		float AdaptiveSampler::tileContrast(const FrameBuffer& frame, int tileX, int tileY) const
+		{
+			const int endX = std::min(tileX + settings.tileSize, frame.width - 1);
+			const int endY = std::min(tileY + settings.tileSize, frame.height - 1);
+
+			float contrast = 0;
+			for (int y = std::max(tileY - 1, 0); y <= endY; ++y)
+			{
+				for (int x = std::max(tileX - 1, 0); x <= endX; ++x)
+				{
+					if (x < endX)
+					{
+						contrast = std::max(contrast, colorContrast(frame.at(x, y), frame.at(x + 1, y)));
+					}
+					if (y < endY)
+					{
+						contrast = std::max(contrast, colorContrast(frame.at(x, y), frame.at(x, y + 1)));
+					}
+				}
+			}
+			return contrast;
+		}
+	}
+}
@@ -0,0 +1,77 @@
+#ifndef ADAPTIVE_SAMPLING_H
+#define ADAPTIVE_SAMPLING_H
+
+// Anti-aliasing that spends extra samples only on the contrasted parts of the image
+
+#include "stdafx.h"
+#include "GraphicsModel.h"
+#include "FrameBuffer.h"
+#include "ThreadPool.h"
+#include "PixelOrder.h"
+#include <functional>
+
+namespace Graphics
+{
+	// Namespace for the objects producing whole images from the raytracing functions
+	namespace Rendering
+	{
+		// Return the color of a sample at the floating point pixel coordinates (x,y)
+		// It is called from several threads at once
+		typedef std::function<glm_color_t(float x, float y)> SampleTracer;
+
+		// Floating point pixel coordinates of a sample
+		struct SamplePosition
+		{
+			float x;
+			float y;
+		};
+
+		// Fill the colors of the samples at the positions, in the same order
+		// It is called from several threads at once, each time with the samples of a tile
+		typedef std::function<void(const std::vector<SamplePosition>& positions, std::vector<glm_color_t>& colorsOut)> SampleBatchTracer;
+
+		// Parameters of the adaptive sampler
+		struct AdaptiveSamplingSettings
+		{
+			// side of the square tiles, in pixels, on which the contrast is estimated
+			int tileSize;
+			// tiles whose contrast is above this threshold receive extra samples
+			// the contrast is the largest difference of a color channel between neighbouring pixels, in [0,1]
+			float contrastThreshold;
+			// a refined pixel receives at most maxGridSize x maxGridSize extra samples
+			int maxGridSize;
+			// maximal number of extra samples traced in a frame
+			int sampleBudget;
+		};
+
+		// Renders images with one sample per pixel and extra sub-pixel samples on contrasted tiles
+		class AdaptiveSampler
+		{
+		public:
+			AdaptiveSamplingSettings settings;
+			// order of the base samples, the tiles are handed to the threads along it
+			PixelOrder pixelOrder;
+
+			AdaptiveSampler(const AdaptiveSamplingSettings& settings) :
+				settings(settings)
+			{}
+
+			// Fill the frame with the sampled colors, the samples are traced in parallel by the pool
+			// The most contrasted tiles are refined first until the sample budget is spent
+			// The pixels flagged in filledPixelsPtr, row by row, already hold their color and are neither traced nor refined,
+			// the sample budget then shrinks with the share of traced pixels
+			// Return the number of samples traced
+			int render(FrameBuffer& frame, const SampleTracer& traceSample, utilities::ThreadPool& pool, const std::vector<char>* filledPixelsPtr = nullptr);
+
+			// Same as render, the samples being handed to the tracer tile by tile: the base samples of a tile together,
+			// then the extra samples of a refined tile together
+			int renderBatches(FrameBuffer& frame, const SampleBatchTracer& traceSamples, utilities::ThreadPool& pool, const std::vector<char>* filledPixelsPtr = nullptr);
+
+			// Return the contrast of the base samples of the tile whose top-left pixel is (tileX, tileY)
+			// Pixels next to the tile are included so that edges lying on the tile border are detected
+			float tileContrast(const FrameBuffer& frame, int tileX, int tileY) const;
+		};
+	}
+}
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef ALIGNED_ALLOCATOR_H
+#define ALIGNED_ALLOCATOR_H
+
+// Allocator placing the elements of a container on a given alignment, like the start of a cache line
+
+#include "stdafx.h"
+#include <xmmintrin.h>
+
+namespace utilities
+{
+	template<typename T, size_t Alignment>
+	class AlignedAllocator
+	{
+	public:
+		typedef T value_type;
+
+		template<typename U>
+		struct rebind
+		{
+			typedef AlignedAllocator<U, Alignment> other;
+		};
+
+		AlignedAllocator() = default;
+
+		template<typename U>
+		AlignedAllocator(const AlignedAllocator<U, Alignment>&)
+		{}
+
+		T* allocate(size_t count)
+		{
+			void* memoryPtr = _mm_malloc(count * sizeof(T), Alignment);
+			if (memoryPtr == nullptr)
+			{
+				throw std::bad_alloc();
+			}
+			return static_cast<T*>(memoryPtr);
+		}
+
+		void deallocate(T* memoryPtr, size_t)
+		{
+			_mm_free(memoryPtr);
+		}
+
+		template<typename U>
+		bool operator==(const AlignedAllocator<U, Alignment>&) const
+		{
+			return true;
+		}
+
+		template<typename U>
+		bool operator!=(const AlignedAllocator<U, Alignment>&) const
+		{
+			return false;
+		}
+	};
+}
+
+#endif
@@ -0,0 +1,1439 @@
+#include "stdafx.h"
+#include "BVH.h"
+
+// Defines the functions declared in its BVH.h
+// All the functions descriptions could be found there
+
+#include "GeometryStore.h"
+#include "GraphicsFunctions.h"
+#include "Profiler.h"
+#include <atomic>
+#include <cassert>
+#include <cstring>
+#include <mutex>
+#include <emmintrin.h>
+
+namespace Graphics
+{
+	namespace Raytracing
+	{
+		// Bounds of a box once every corner is transformed
+		template<typename PointTransform>
+		BoundingBox transformedBounds(const BoundingBox& box, PointTransform transform)
+		{
+			BoundingBox result{};
+			for (int corner = 0; corner < 8; ++corner)
+			{
+				const vec3 point(
+					(corner & 1) ? box.max.x : box.min.x,
+					(corner & 2) ? box.max.y : box.min.y,
+					(corner & 4) ? box.max.z : box.min.z);
+				result.expand(transform(point));
+			}
+			return result;
+		}
+
+		inline bool overlap(const BoundingBox& a, const BoundingBox& b)
+		{
+			return a.min.x <= b.max.x && b.min.x <= a.max.x
+				&& a.min.y <= b.max.y && b.min.y <= a.max.y
+				&& a.min.z <= b.max.z && b.min.z <= a.max.z;
+		}
+
+		// Float holding 2^exponent
+		inline float exponentScale(int exponent)
+		{
+			const int32_t bits = (exponent + 127) << 23;
+			float scale{};
+			std::memcpy(&scale, &bits, sizeof(scale));
+			return scale;
+		}
+
+		// Positions of the four children of a node along an axis, from their quantized coordinates
+		inline __m128 dequantize(const uint8_t* quantized, __m128 origin, __m128 scale)
+		{
+			int32_t packed{};
+			std::memcpy(&packed, quantized, sizeof(packed));
+			const __m128i zero = _mm_setzero_si128();
+			const __m128i coordinates = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(packed), zero), zero);
+			return _mm_add_ps(origin, _mm_mul_ps(_mm_cvtepi32_ps(coordinates), scale));
+		}
+
+		// Nodes and primitive indices of a hierarchy, held by a BVH or read from the chunk of a stored mesh
+		struct BVHView
+		{
+			const BVHNode* nodes;
+			size_t nodeCount;
+			const WideBVHNode* wideNodes;
+			size_t wideNodeCount;
+			const int* primitiveIndices;
+
+			BVHView(const BVH& bvh) :
+				nodes(bvh.nodes.data()),
+				nodeCount(bvh.nodes.size()),
+				wideNodes(bvh.wideNodes.data()),
+				wideNodeCount(bvh.wideNodes.size()),
+				primitiveIndices(bvh.primitiveIndices.data())
+			{}
+
+			BVHView(const StoredMesh& mesh) :
+				nodes(mesh.nodes),
+				nodeCount(mesh.nodeCount),
+				wideNodes(mesh.wideNodes),
+				wideNodeCount(mesh.wideNodeCount),
+				primitiveIndices(mesh.primitiveIndices)
+			{}
+		};
+
+		// Visit the leaves of the hierarchy whose bounds the ray enters before maxDistance
+		// intersectPrimitive is called with each of their primitives and may shorten maxDistance
+		// The four children of a node are tested at once, and the closest ones along the ray are visited first
+		template<typename PrimitiveIntersection>
+		void traverseBVH(const BVHView& bvh, const vec3& origin, const vec3& direction, float& maxDistance, PrimitiveIntersection intersectPrimitive)
+		{
+			if (bvh.wideNodeCount == 0)
+			{
+				return;
+			}
+
+			const __m128 rayOrigin[3] = { _mm_set1_ps(origin.x), _mm_set1_ps(origin.y), _mm_set1_ps(origin.z) };
+			const __m128 inverseDirection[3] = { _mm_set1_ps(1 / direction.x), _mm_set1_ps(1 / direction.y), _mm_set1_ps(1 / direction.z) };
+
+			// a child to visit, the primitive count of a leaf being positive
+			struct Entry
+			{
+				int index;
+				int primitiveCount;
+				float distance;
+			};
+			// a level of the hierarchy pushes at most four children for the one it pops, and the wide nodes are no deeper than the binary ones
+			Entry stack[3 * BVH_MAX_DEPTH + 1];
+			int stackSize = 0;
+			stack[stackSize++] = Entry{ 0, 0, 0.f };
+			while (stackSize > 0)
+			{
+				const Entry entry = stack[--stackSize];
+				// the ray may have found a closer primitive since the child was pushed
+				if (entry.distance > maxDistance)
+				{
+					continue;
+				}
+
+				if (entry.primitiveCount > 0)
+				{
+					for (int i = entry.index; i < entry.index + entry.primitiveCount; ++i)
+					{
+						intersectPrimitive(bvh.primitiveIndices[i], maxDistance);
+					}
+					continue;
+				}
+
+				// slabs method on the four children, an axis where a slab gives no number is ignored
+				const WideBVHNode& node = bvh.wideNodes[entry.index];
+				const uint8_t* lowers[3] = { node.lowerX, node.lowerY, node.lowerZ };
+				const uint8_t* uppers[3] = { node.upperX, node.upperY, node.upperZ };
+				__m128 entries = _mm_setzero_ps();
+				__m128 exits = _mm_set1_ps(maxDistance);
+				for (int axis = 0; axis < 3; ++axis)
+				{
+					const __m128 nodeOrigin = _mm_set1_ps(node.origin[axis]);
+					const __m128 scale = _mm_set1_ps(exponentScale(node.exponents[axis]));
+					const __m128 t1 = _mm_mul_ps(_mm_sub_ps(dequantize(lowers[axis], nodeOrigin, scale), rayOrigin[axis]), inverseDirection[axis]);
+					const __m128 t2 = _mm_mul_ps(_mm_sub_ps(dequantize(uppers[axis], nodeOrigin, scale), rayOrigin[axis]), inverseDirection[axis]);
+					entries = _mm_max_ps(_mm_min_ps(t1, t2), entries);
+					exits = _mm_min_ps(_mm_max_ps(t1, t2), exits);
+				}
+				int hitMask = _mm_movemask_ps(_mm_cmple_ps(entries, exits)) & ((1 << node.childCount) - 1);
+				if (hitMask == 0)
+				{
+					continue;
+				}
+
+				float distances[4];
+				_mm_storeu_ps(distances, entries);
+				Entry hits[4];
+				int hitCount = 0;
+				for (; hitMask != 0; hitMask &= hitMask - 1)
+				{
+					int child = 0;
+					while (((hitMask >> child) & 1) == 0)
+					{
+						++child;
+					}
+					// sorted from the farthest to the closest, so that the closest is popped first
+					Entry hit{ node.childIndices[child], node.primitiveCounts[child], distances[child] };
+					int position = hitCount++;
+					for (; position > 0 && hits[position - 1].distance < hit.distance; --position)
+					{
+						hits[position] = hits[position - 1];
+					}
+					hits[position] = hit;
+				}
+				assert(stackSize + hitCount <= 3 * BVH_MAX_DEPTH + 1);
+				for (int i = 0; i < hitCount; ++i)
+				{
+					stack[stackSize++] = hits[i];
+				}
+			}
+		}
+
+		// Visit the primitives of the leaves whose bounds pass the test, until the visitor returns false
+		template<typename BoundsTest, typename PrimitiveVisitor>
+		void traverseBVHNodes(const BVHView& bvh, BoundsTest isBoundsVisited, PrimitiveVisitor visitPrimitive)
+		{
+			if (bvh.nodeCount == 0)
+			{
+				return;
+			}
+
+			// a level of the hierarchy pushes two children for the one it pops
+			int stack[BVH_MAX_DEPTH + 1];
+			int stackSize = 0;
+			stack[stackSize++] = 0;
+			while (stackSize > 0)
+			{
+				const BVHNode& node = bvh.nodes[stack[--stackSize]];
+				if (!isBoundsVisited(node.bounds))
+				{
+					continue;
+				}
+
+				if (node.isLeaf())
+				{
+					for (int i = node.firstIndex; i < node.firstIndex + node.primitiveCount; ++i)
+					{
+						if (!visitPrimitive(bvh.primitiveIndices[i]))
+						{
+							return;
+						}
+					}
+				}
+				else
+				{
+					assert(stackSize + 2 <= BVH_MAX_DEPTH + 1);
+					stack[stackSize++] = node.firstIndex;
+					stack[stackSize++] = node.firstIndex + 1;
+				}
+			}
+		}
+
+		// Visit the primitives of the leaves whose bounds overlap the box
+		template<typename PrimitiveVisitor>
+		void traverseBVH(const BVHView& bvh, const BoundingBox& box, PrimitiveVisitor visitPrimitive)
+		{
+			traverseBVHNodes(bvh, [&box](const BoundingBox& bounds) { return overlap(bounds, box); },
+				[&visitPrimitive](int primitiveIndex)
+			{
+				visitPrimitive(primitiveIndex);
+				return true;
+			});
+		}
+
+		namespace
+		{
+			// Bounds and number of the primitives whose centroids fall in a bin
+			struct SAHBin
+			{
+				BoundingBox bounds;
+				BoundingBox centroidBounds;
+				int count = 0;
+
+				void add(const SAHBin& other)
+				{
+					bounds.expand(other.bounds);
+					centroidBounds.expand(other.centroidBounds);
+					count += other.count;
+				}
+			};
+
+			// Bins along the three axes
+			struct SAHBinning
+			{
+				SAHBin bins[3][BVH_SAH_BIN_COUNT];
+
+				void add(const SAHBinning& other)
+				{
+					for (int axis = 0; axis < 3; ++axis)
+					{
+						for (int bin = 0; bin < BVH_SAH_BIN_COUNT; ++bin)
+						{
+							bins[axis][bin].add(other.bins[axis][bin]);
+						}
+					}
+				}
+			};
+
+			// Where the primitives of a node are split
+			struct SAHSplit
+			{
+				int axis = -1;
+				int bin = 0;
+				float cost = std::numeric_limits<float>::max();
+				SAHBin left;
+				SAHBin right;
+			};
+
+			// Contiguous block of nodes from which a thread allocates the children of the nodes it splits
+			struct NodeArena
+			{
+				int next = 0;
+				int end = 0;
+			};
+
+			// Builds hierarchies with the binned surface area heuristic
+			// The nodes with many primitives are binned and partitioned by all the threads of the pool,
+			// and the subtrees of their children are built as separate tasks
+			// Each thread allocates nodes from its own arena, and the nodes are gathered in depth first order at the end
+			class BinnedSAHBuilder
+			{
+			public:
+				BinnedSAHBuilder(const std::vector<BoundingBox>& primitiveBounds, std::vector<int>& primitiveIndices, utilities::ThreadPool* poolPtr) :
+					primitiveBounds(primitiveBounds),
+					primitiveIndices(primitiveIndices),
+					poolPtr(poolPtr),
+					arenas(poolPtr != nullptr ? poolPtr->threadCount() : 1),
+					allocatedNodes(0)
+				{}
+
+				// Build the subtree over a range of primitive indices and store it at a node of the hierarchy, which lies at a depth
+				// The nodes below it are appended to the hierarchy
+				void build(int firstIndex, int primitiveCount, BVH& bvh, int nodeIndex, int depth)
+				{
+					// an inner node allocates two nodes, and each arena may have a block partly used at the end
+					const int capacity = 1 + 2 * primitiveCount + static_cast<int>(arenas.size()) * ARENA_SIZE;
+					nodes.resize(capacity);
+					if (poolPtr != nullptr && primitiveCount >= BVH_PARALLEL_BINNING_SIZE)
+					{
+						scratch.resize(primitiveCount);
+					}
+					scratchOffset = firstIndex;
+
+					SAHBin range{};
+					binRange(firstIndex, primitiveCount, [](SAHBin& range, const BoundingBox& bounds, const vec3& centroid)
+					{
+						range.bounds.expand(bounds);
+						range.centroidBounds.expand(centroid);
+						++range.count;
+					}, range, [](SAHBin& total, const SAHBin& part) { total.add(part); });
+
+					allocatedNodes = 1;
+					buildNode(0, firstIndex, range, depth);
+					gather(0, bvh, nodeIndex);
+				}
+
+			private:
+				// Number of nodes an arena takes from the shared ones at once
+				static constexpr int ARENA_SIZE = 256;
+
+				const std::vector<BoundingBox>& primitiveBounds;
+				std::vector<int>& primitiveIndices;
+				utilities::ThreadPool* poolPtr;
+				std::vector<NodeArena> arenas;
+				std::vector<BVHNode> nodes;
+				std::atomic<int> allocatedNodes;
+				// room to partition the primitive indices, starting at the first one of the built range
+				std::vector<int> scratch;
+				int scratchOffset;
+
+				bool isParallel(int primitiveCount) const
+				{
+					return poolPtr != nullptr && primitiveCount >= BVH_PARALLEL_BINNING_SIZE;
+				}
+
+				// Return the index of two consecutive nodes from the arena of the current thread
+				int allocateChildren()
+				{
+					NodeArena& arena = arenas[poolPtr != nullptr ? poolPtr->threadIndex() : 0];
+					if (arena.next == arena.end)
+					{
+						arena.next = allocatedNodes.fetch_add(ARENA_SIZE);
+						arena.end = arena.next + ARENA_SIZE;
+					}
+					const int index = arena.next;
+					arena.next += 2;
+					return index;
+				}
+
+				// Call visit(result, bounds, centroid) on the primitives of a range
+				// When several threads share the work, each one fills its own copy of the initial result and they are merged
+				template<typename Result, typename Visitor, typename Merge>
+				void binRange(int firstIndex, int primitiveCount, Visitor visit, Result& result, Merge merge)
+				{
+					if (!isParallel(primitiveCount))
+					{
+						for (int i = firstIndex; i < firstIndex + primitiveCount; ++i)
+						{
+							const BoundingBox& bounds = primitiveBounds[primitiveIndices[i]];
+							visit(result, bounds, bounds.centroid());
+						}
+						return;
+					}
+
+					std::mutex mergeMutex;
+					const Result empty = result;
+					poolPtr->parallelFor(firstIndex, firstIndex + primitiveCount, BVH_PARALLEL_BINNING_SIZE / 4, [&](int chunkBegin, int chunkEnd)
+					{
+						Result part = empty;
+						for (int i = chunkBegin; i < chunkEnd; ++i)
+						{
+							const BoundingBox& bounds = primitiveBounds[primitiveIndices[i]];
+							visit(part, bounds, bounds.centroid());
+						}
+						std::lock_guard<std::mutex> lock(mergeMutex);
+						merge(result, part);
+					});
+				}
+
+				static int binIndex(const BoundingBox& centroidBounds, int axis, const vec3& centroid)
+				{
+					const float extent = centroidBounds.max[axis] - centroidBounds.min[axis];
+					const int bin = static_cast<int>(BVH_SAH_BIN_COUNT * (centroid[axis] - centroidBounds.min[axis]) / extent);
+					return std::min(std::max(bin, 0), BVH_SAH_BIN_COUNT - 1);
+				}
+
+				// Return the cheapest split between two bins along any axis
+				SAHSplit findSplit(int firstIndex, const SAHBin& range)
+				{
+					SAHBinning binning{};
+					const BoundingBox& centroidBounds = range.centroidBounds;
+					binRange(firstIndex, range.count, [&centroidBounds](SAHBinning& binning, const BoundingBox& bounds, const vec3& centroid)
+					{
+						for (int axis = 0; axis < 3; ++axis)
+						{
+							if (centroidBounds.max[axis] > centroidBounds.min[axis])
+							{
+								SAHBin& bin = binning.bins[axis][binIndex(centroidBounds, axis, centroid)];
+								bin.bounds.expand(bounds);
+								bin.centroidBounds.expand(centroid);
+								++bin.count;
+							}
+						}
+					}, binning, [](SAHBinning& total, const SAHBinning& part) { total.add(part); });
+
+					SAHSplit best{};
+					for (int axis = 0; axis < 3; ++axis)
+					{
+						const SAHBin* bins = binning.bins[axis];
+
+						// sweep from the right to know what is on the right of each split
+						SAHBin rightSides[BVH_SAH_BIN_COUNT];
+						for (int bin = BVH_SAH_BIN_COUNT - 1; bin > 0; --bin)
+						{
+							rightSides[bin - 1] = (bin < BVH_SAH_BIN_COUNT - 1) ? rightSides[bin] : SAHBin{};
+							rightSides[bin - 1].add(bins[bin]);
+						}
+
+						SAHBin leftSide{};
+						for (int bin = 0; bin < BVH_SAH_BIN_COUNT - 1; ++bin)
+						{
+							leftSide.add(bins[bin]);
+							const SAHBin& rightSide = rightSides[bin];
+							if (leftSide.count == 0 || rightSide.count == 0)
+							{
+								continue;
+							}
+							const float cost = BVH_TRAVERSAL_COST * range.bounds.surfaceArea()
+								+ BVH_INTERSECTION_COST * (leftSide.bounds.surfaceArea() * leftSide.count + rightSide.bounds.surfaceArea() * rightSide.count);
+							if (cost < best.cost)
+							{
+								best.axis = axis;
+								best.bin = bin;
+								best.cost = cost;
+								best.left = leftSide;
+								best.right = rightSide;
+							}
+						}
+					}
+					return best;
+				}
+
+				// Put the primitives on the left of the split first in the range
+				void partition(int firstIndex, const SAHBin& range, const SAHSplit& split)
+				{
+					const BoundingBox& centroidBounds = range.centroidBounds;
+					auto isLeft = [this, &centroidBounds, &split](int primitiveIndex)
+					{
+						return binIndex(centroidBounds, split.axis, primitiveBounds[primitiveIndex].centroid()) <= split.bin;
+					};
+
+					if (!isParallel(range.count))
+					{
+						std::partition(primitiveIndices.begin() + firstIndex, primitiveIndices.begin() + firstIndex + range.count, isLeft);
+						return;
+					}
+
+					// each chunk counts its primitives on the left, then writes them at their final place in the scratch buffer
+					const int grain = BVH_PARALLEL_BINNING_SIZE / 4;
+					const int chunkCount = (range.count + grain - 1) / grain;
+					std::vector<int> leftCounts(chunkCount);
+					poolPtr->parallelFor(0, chunkCount, 1, [&](int chunkBegin, int chunkEnd)
+					{
+						for (int chunk = chunkBegin; chunk < chunkEnd; ++chunk)
+						{
+							const int begin = firstIndex + chunk * grain;
+							const int end = std::min(begin + grain, firstIndex + range.count);
+							leftCounts[chunk] = static_cast<int>(std::count_if(primitiveIndices.begin() + begin, primitiveIndices.begin() + end, isLeft));
+						}
+					});
+
+					std::vector<int> leftOffsets(chunkCount);
+					std::vector<int> rightOffsets(chunkCount);
+					int leftOffset = 0;
+					int rightOffset = split.left.count;
+					for (int chunk = 0; chunk < chunkCount; ++chunk)
+					{
+						const int chunkSize = std::min(grain, range.count - chunk * grain);
+						leftOffsets[chunk] = leftOffset;
+						rightOffsets[chunk] = rightOffset;
+						leftOffset += leftCounts[chunk];
+						rightOffset += chunkSize - leftCounts[chunk];
+					}
+
+					int* const scratchRange = scratch.data() + (firstIndex - scratchOffset);
+					poolPtr->parallelFor(0, chunkCount, 1, [&](int chunkBegin, int chunkEnd)
+					{
+						for (int chunk = chunkBegin; chunk < chunkEnd; ++chunk)
+						{
+							const int begin = firstIndex + chunk * grain;
+							const int end = std::min(begin + grain, firstIndex + range.count);
+							int left = leftOffsets[chunk];
+							int right = rightOffsets[chunk];
+							for (int i = begin; i < end; ++i)
+							{
+								const int primitiveIndex = primitiveIndices[i];
+								scratchRange[isLeft(primitiveIndex) ? left++ : right++] = primitiveIndex;
+							}
+						}
+					});
+					poolPtr->parallelFor(0, range.count, grain, [&](int begin, int end)
+					{
+						std::copy(scratchRange + begin, scratchRange + end, primitiveIndices.begin() + firstIndex + begin);
+					});
+				}
+
+				// Split the range at the median of the centroids along their largest extent
+				// Used when the binning cannot separate the primitives, or when the hierarchy is too deep
+				void medianSplit(int firstIndex, const SAHBin& range, SAHBin& left, SAHBin& right)
+				{
+					const vec3 extent = range.centroidBounds.max - range.centroidBounds.min;
+					const int axis = (extent.x > extent.y && extent.x > extent.z) ? 0 : (extent.y > extent.z ? 1 : 2);
+					const auto first = primitiveIndices.begin() + firstIndex;
+					const auto middle = first + range.count / 2;
+					std::nth_element(first, middle, first + range.count, [this, axis](int a, int b) {
+						return primitiveBounds[a].centroid()[axis] < primitiveBounds[b].centroid()[axis];
+					});
+
+					left = SAHBin{};
+					right = SAHBin{};
+					for (int i = 0; i < range.count; ++i)
+					{
+						const BoundingBox& bounds = primitiveBounds[primitiveIndices[firstIndex + i]];
+						SAHBin& side = (i < range.count / 2) ? left : right;
+						side.bounds.expand(bounds);
+						side.centroidBounds.expand(bounds.centroid());
+						++side.count;
+					}
+				}
+
+				void buildNode(int nodeIndex, int firstIndex, const SAHBin& range, int depth)
+				{
+					BVHNode& node = nodes[nodeIndex];
+					node.bounds = range.bounds;
+					node.firstIndex = firstIndex;
+					node.primitiveCount = range.count;
+					if (range.count == 1 || depth >= BVH_MAX_DEPTH)
+					{
+						return;
+					}
+
+					SAHSplit split{};
+					if (depth < BVH_SAH_MAX_DEPTH)
+					{
+						split = findSplit(firstIndex, range);
+					}
+					const float leafCost = BVH_INTERSECTION_COST * range.bounds.surfaceArea() * range.count;
+					if (range.count <= BVH_LEAF_SIZE && (split.axis < 0 || leafCost <= split.cost))
+					{
+						return;
+					}
+
+					if (split.axis >= 0)
+					{
+						partition(firstIndex, range, split);
+					}
+					else
+					{
+						medianSplit(firstIndex, range, split.left, split.right);
+					}
+
+					const int childIndex = allocateChildren();
+					node.firstIndex = childIndex;
+					node.primitiveCount = 0;
+
+					const int rightFirstIndex = firstIndex + split.left.count;
+					if (poolPtr != nullptr && range.count >= BVH_PARALLEL_BUILD_SIZE)
+					{
+						utilities::ThreadPool::TaskGroup group(*poolPtr);
+						const SAHBin left = split.left;
+						group.run([this, childIndex, firstIndex, left, depth]() { buildNode(childIndex, firstIndex, left, depth + 1); });
+						buildNode(childIndex + 1, rightFirstIndex, split.right, depth + 1);
+						group.wait();
+					}
+					else
+					{
+						buildNode(childIndex, firstIndex, split.left, depth + 1);
+						buildNode(childIndex + 1, rightFirstIndex, split.right, depth + 1);
+					}
+				}
+
+				// Copy a built subtree to the hierarchy, the children of a node being appended in depth first order
+				void gather(int builtIndex, BVH& bvh, int nodeIndex)
+				{
+					const BVHNode& built = nodes[builtIndex];
+					bvh.nodes[nodeIndex] = built;
+					if (built.isLeaf())
+					{
+						return;
+					}
+
+					const int childIndex = static_cast<int>(bvh.nodes.size());
+					bvh.nodes[nodeIndex].firstIndex = childIndex;
+					bvh.nodes.resize(bvh.nodes.size() + 2);
+					gather(built.firstIndex, bvh, childIndex);
+					gather(built.firstIndex + 1, bvh, childIndex + 1);
+				}
+			};
+		}
+
+		// Build again the subtree of a node over the primitives it covers, the node lying at a depth of the hierarchy
+		void buildBVHSubtree(const std::vector<BoundingBox>& primitiveBounds, BVH& bvh, int nodeIndex, int depth, utilities::ThreadPool* poolPtr)
+		{
+			BinnedSAHBuilder builder(primitiveBounds, bvh.primitiveIndices, poolPtr);
+			builder.build(bvh.nodes[nodeIndex].firstIndex, bvh.nodes[nodeIndex].primitiveCount, bvh, nodeIndex, depth);
+		}
+
+
+		// Compute the surface area heuristic cost of the subtree of a node, and of the subtrees below it
+		float computeSubtreeCosts(const BVH& bvh, int nodeIndex, std::vector<float>& costs)
+		{
+			const BVHNode& node = bvh.nodes[nodeIndex];
+			float cost = node.bounds.surfaceArea();
+			if (node.isLeaf())
+			{
+				cost *= BVH_INTERSECTION_COST * node.primitiveCount;
+			}
+			else
+			{
+				cost = BVH_TRAVERSAL_COST * cost
+					+ computeSubtreeCosts(bvh, node.firstIndex, costs)
+					+ computeSubtreeCosts(bvh, node.firstIndex + 1, costs);
+			}
+			costs[nodeIndex] = cost;
+			return cost;
+		}
+
+		// Update the bounds of the subtree of a node from the bounds of its primitives
+		void refitBVHNode(const std::vector<BoundingBox>& primitiveBounds, BVH& bvh, int nodeIndex)
+		{
+			BVHNode& node = bvh.nodes[nodeIndex];
+			node.bounds = BoundingBox{};
+			if (node.isLeaf())
+			{
+				for (int i = node.firstIndex; i < node.firstIndex + node.primitiveCount; ++i)
+				{
+					node.bounds.expand(primitiveBounds[bvh.primitiveIndices[i]]);
+				}
+				return;
+			}
+
+			refitBVHNode(primitiveBounds, bvh, node.firstIndex);
+			refitBVHNode(primitiveBounds, bvh, node.firstIndex + 1);
+			node.bounds.expand(bvh.nodes[node.firstIndex].bounds);
+			node.bounds.expand(bvh.nodes[node.firstIndex + 1].bounds);
+		}
+
+		// Count the nodes of the subtree of a node, and find the range of primitive indices it covers
+		int subtreeSize(const BVH& bvh, int nodeIndex, int& firstIndexOut, int& primitiveCountOut)
+		{
+			const BVHNode& node = bvh.nodes[nodeIndex];
+			if (node.isLeaf())
+			{
+				firstIndexOut = node.firstIndex;
+				primitiveCountOut = node.primitiveCount;
+				return 1;
+			}
+
+			int leftFirst{}, leftCount{}, rightFirst{}, rightCount{};
+			const int size = 1 + subtreeSize(bvh, node.firstIndex, leftFirst, leftCount) + subtreeSize(bvh, node.firstIndex + 1, rightFirst, rightCount);
+			firstIndexOut = std::min(leftFirst, rightFirst);
+			primitiveCountOut = leftCount + rightCount;
+			return size;
+		}
+
+		// Build again the subtrees degraded by the refit, the costs hold the current ones
+		// The node keeps its place and its depth, the new nodes below it are appended to the hierarchy
+		int rebuildDegradedSubtrees(const std::vector<BoundingBox>& primitiveBounds, BVH& bvh, int nodeIndex, int depth, const std::vector<float>& costs, float rebuildThreshold)
+		{
+			// a leaf cannot be improved
+			if (bvh.nodes[nodeIndex].isLeaf())
+			{
+				return 0;
+			}
+			if (costs[nodeIndex] <= rebuildThreshold * bvh.builtCosts[nodeIndex])
+			{
+				const int leftIndex = bvh.nodes[nodeIndex].firstIndex;
+				return rebuildDegradedSubtrees(primitiveBounds, bvh, leftIndex, depth + 1, costs, rebuildThreshold)
+					+ rebuildDegradedSubtrees(primitiveBounds, bvh, leftIndex + 1, depth + 1, costs, rebuildThreshold);
+			}
+
+			int firstIndex{}, primitiveCount{};
+			bvh.unusedNodeCount += subtreeSize(bvh, nodeIndex, firstIndex, primitiveCount) - 1;
+			bvh.nodes[nodeIndex].firstIndex = firstIndex;
+			bvh.nodes[nodeIndex].primitiveCount = primitiveCount;
+			buildBVHSubtree(primitiveBounds, bvh, nodeIndex, depth, nullptr);
+
+			bvh.builtCosts.resize(bvh.nodes.size());
+			computeSubtreeCosts(bvh, nodeIndex, bvh.builtCosts);
+			return primitiveCount;
+		}
+
+
+		BoundingBox triangleBounds(const Triangle& triangle)
+		{
+			BoundingBox bounds{};
+			bounds.expand(triangle.v0);
+			bounds.expand(triangle.v1);
+			bounds.expand(triangle.v2);
+			return bounds;
+		}
+
+
+		BoundingBox shapeBounds(const Shape& shape)
+		{
+			BoundingBox bounds{};
+			if (!shape.balls.empty())
+			{
+				bounds.min = vec3(-std::numeric_limits<float>::max());
+				bounds.max = vec3(std::numeric_limits<float>::max());
+				for (const Shape::Ball& ball : shape.balls)
+				{
+					bounds.min = glm::max(bounds.min, ball.center - vec3(ball.radius));
+					bounds.max = glm::min(bounds.max, ball.center + vec3(ball.radius));
+				}
+				return bounds;
+			}
+
+			// the vertices of a polyhedron lie on three of its planes, and inside all the others
+			const std::vector<Shape::HalfSpace>& planes = shape.halfSpaces;
+			for (size_t i = 0; i < planes.size(); ++i)
+			{
+				for (size_t j = i + 1; j < planes.size(); ++j)
+				{
+					for (size_t k = j + 1; k < planes.size(); ++k)
+					{
+						const glm::mat3 normals = glm::transpose(glm::mat3(planes[i].normal, planes[j].normal, planes[k].normal));
+						if (std::abs(glm::determinant(normals)) < EPSILON)
+						{
+							continue;
+						}
+						const vec3 vertex = glm::inverse(normals) * vec3(planes[i].offset, planes[j].offset, planes[k].offset);
+						const bool isInside = std::all_of(planes.begin(), planes.end(),
+							[&vertex](const Shape::HalfSpace& plane) { return glm::dot(plane.normal, vertex) <= plane.offset + EPSILON; });
+						if (isInside)
+						{
+							bounds.expand(vertex);
+						}
+					}
+				}
+			}
+			return bounds;
+		}
+
+
+		// Quantize the extent of a child along an axis of the grid of its parent, rounding outwards
+		void quantizeExtent(float lower, float upper, float origin, float scale, uint8_t& lowerOut, uint8_t& upperOut)
+		{
+			int quantizedLower = std::min(std::max(static_cast<int>(std::floor((lower - origin) / scale)), 0), 255);
+			while (quantizedLower > 0 && origin + quantizedLower * scale > lower)
+			{
+				--quantizedLower;
+			}
+			int quantizedUpper = std::min(std::max(static_cast<int>(std::ceil((upper - origin) / scale)), 0), 255);
+			while (quantizedUpper < 255 && origin + quantizedUpper * scale < upper)
+			{
+				++quantizedUpper;
+			}
+			lowerOut = static_cast<uint8_t>(quantizedLower);
+			upperOut = static_cast<uint8_t>(quantizedUpper);
+		}
+
+		// Append the node of four children covering the subtree of a binary node, then the nodes below it
+		// The children are found by opening the largest inner child until there are four of them
+		// Return the index of the node
+		int collapseBVHNode(BVH& bvh, int nodeIndex)
+		{
+			int children[4] = { nodeIndex };
+			int childCount = 1;
+			if (!bvh.nodes[nodeIndex].isLeaf())
+			{
+				children[0] = bvh.nodes[nodeIndex].firstIndex;
+				children[1] = bvh.nodes[nodeIndex].firstIndex + 1;
+				childCount = 2;
+			}
+			while (childCount < 4)
+			{
+				int largest = -1;
+				float largestArea = -1;
+				for (int i = 0; i < childCount; ++i)
+				{
+					const BVHNode& child = bvh.nodes[children[i]];
+					if (!child.isLeaf() && child.bounds.surfaceArea() > largestArea)
+					{
+						largest = i;
+						largestArea = child.bounds.surfaceArea();
+					}
+				}
+				if (largest < 0)
+				{
+					break;
+				}
+				const int firstIndex = bvh.nodes[children[largest]].firstIndex;
+				children[largest] = firstIndex;
+				children[childCount++] = firstIndex + 1;
+			}
+
+			// the children with empty bounds contain nothing to hit
+			int keptCount = 0;
+			for (int i = 0; i < childCount; ++i)
+			{
+				const BoundingBox& bounds = bvh.nodes[children[i]].bounds;
+				if (bounds.min.x <= bounds.max.x && bounds.min.y <= bounds.max.y && bounds.min.z <= bounds.max.z)
+				{
+					children[keptCount++] = children[i];
+				}
+			}
+			childCount = keptCount;
+
+			BoundingBox bounds{};
+			for (int i = 0; i < childCount; ++i)
+			{
+				bounds.expand(bvh.nodes[children[i]].bounds);
+			}
+
+			WideBVHNode node{};
+			node.childCount = static_cast<uint8_t>(childCount);
+			uint8_t* lowers[3] = { node.lowerX, node.lowerY, node.lowerZ };
+			uint8_t* uppers[3] = { node.upperX, node.upperY, node.upperZ };
+			for (int axis = 0; axis < 3 && childCount > 0; ++axis)
+			{
+				// the smallest power of two that lets 255 steps cover the node
+				int exponent{};
+				std::frexp((bounds.max[axis] - bounds.min[axis]) / 255, &exponent);
+				exponent = std::min(std::max(exponent, -126), 127);
+				while (exponent < 127 && bounds.min[axis] + 255 * exponentScale(exponent) < bounds.max[axis])
+				{
+					++exponent;
+				}
+				node.origin[axis] = bounds.min[axis];
+				node.exponents[axis] = static_cast<int8_t>(exponent);
+				for (int i = 0; i < childCount; ++i)
+				{
+					const BoundingBox& childBounds = bvh.nodes[children[i]].bounds;
+					quantizeExtent(childBounds.min[axis], childBounds.max[axis], node.origin[axis], exponentScale(exponent), lowers[axis][i], uppers[axis][i]);
+				}
+			}
+
+			const int wideIndex = static_cast<int>(bvh.wideNodes.size());
+			bvh.wideNodes.push_back(node);
+			for (int i = 0; i < childCount; ++i)
+			{
+				const BVHNode& child = bvh.nodes[children[i]];
+				const int childIndex = child.isLeaf() ? child.firstIndex : collapseBVHNode(bvh, children[i]);
+				bvh.wideNodes[wideIndex].childIndices[i] = childIndex;
+				bvh.wideNodes[wideIndex].primitiveCounts[i] = static_cast<uint8_t>(child.isLeaf() ? child.primitiveCount : 0);
+			}
+			return wideIndex;
+		}
+
+		// Collapse the binary nodes of a hierarchy into the nodes traversed by the rays
+		void collapseBVH(BVH& bvh)
+		{
+			bvh.wideNodes.clear();
+			if (!bvh.nodes.empty())
+			{
+				bvh.wideNodes.reserve(bvh.nodes.size() / 2 + 1);
+				collapseBVHNode(bvh, 0);
+			}
+		}
+
+
+		// Build a hierarchy, with the threads of the pool if any
+		void buildBVH(const std::vector<BoundingBox>& primitiveBounds, BVH& bvh, utilities::ThreadPool* poolPtr)
+		{
+			bvh.nodes.clear();
+			bvh.primitiveIndices.resize(primitiveBounds.size());
+			bvh.unusedNodeCount = 0;
+			if (primitiveBounds.empty())
+			{
+				bvh.builtCosts.clear();
+				bvh.wideNodes.clear();
+				return;
+			}
+
+			for (size_t i = 0; i < primitiveBounds.size(); ++i)
+			{
+				bvh.primitiveIndices[i] = static_cast<int>(i);
+			}
+
+			bvh.nodes.reserve(2 * primitiveBounds.size() - 1);
+			bvh.nodes.push_back(BVHNode{ BoundingBox{}, 0, static_cast<int>(primitiveBounds.size()) });
+			buildBVHSubtree(primitiveBounds, bvh, 0, 0, poolPtr);
+
+			bvh.builtCosts.resize(bvh.nodes.size());
+			computeSubtreeCosts(bvh, 0, bvh.builtCosts);
+			collapseBVH(bvh);
+		}
+
+
+		void buildBVH(const std::vector<BoundingBox>& primitiveBounds, BVH& bvh)
+		{
+			buildBVH(primitiveBounds, bvh, nullptr);
+		}
+
+
+		void buildBVH(const std::vector<BoundingBox>& primitiveBounds, BVH& bvh, utilities::ThreadPool& pool)
+		{
+			buildBVH(primitiveBounds, bvh, &pool);
+		}
+
+
+		int refitBVH(const std::vector<BoundingBox>& primitiveBounds, BVH& bvh, float rebuildThreshold)
+		{
+			if (bvh.nodes.empty() || bvh.primitiveIndices.size() != primitiveBounds.size())
+			{
+				buildBVH(primitiveBounds, bvh);
+				return static_cast<int>(primitiveBounds.size());
+			}
+
+			refitBVHNode(primitiveBounds, bvh, 0);
+			std::vector<float> costs(bvh.nodes.size());
+			computeSubtreeCosts(bvh, 0, costs);
+			if (costs[0] > rebuildThreshold * bvh.builtCosts[0])
+			{
+				buildBVH(primitiveBounds, bvh);
+				return static_cast<int>(primitiveBounds.size());
+			}
+			const int rebuiltCount = rebuildDegradedSubtrees(primitiveBounds, bvh, 0, 0, costs, rebuildThreshold);
+
+			// a full build drops the unused nodes once they are as many as the used ones
+			if (2 * bvh.unusedNodeCount > static_cast<int>(bvh.nodes.size()))
+			{
+				buildBVH(primitiveBounds, bvh);
+			}
+			else
+			{
+				collapseBVH(bvh);
+			}
+			return rebuiltCount;
+		}
+
+
+		// Return the bounds of the triangles
+		std::vector<BoundingBox> trianglesBounds(const std::vector<Triangle>& triangles, utilities::ThreadPool* poolPtr = nullptr)
+		{
+			std::vector<BoundingBox> bounds(triangles.size());
+			auto computeBounds = [&triangles, &bounds](int begin, int end)
+			{
+				for (int i = begin; i < end; ++i)
+				{
+					bounds[i] = triangleBounds(triangles[i]);
+				}
+			};
+			if (poolPtr != nullptr && static_cast<int>(triangles.size()) >= BVH_PARALLEL_BINNING_SIZE)
+			{
+				poolPtr->parallelFor(0, static_cast<int>(triangles.size()), BVH_PARALLEL_BINNING_SIZE / 4, computeBounds);
+			}
+			else
+			{
+				computeBounds(0, static_cast<int>(triangles.size()));
+			}
+			return bounds;
+		}
+
+
+		void refitPolygonsBVH(Scene& scene)
+		{
+			refitBVH(trianglesBounds(scene.polygons), scene.polygonsBVH);
+		}
+
+
+		void refitMeshBVH(Mesh& mesh)
+		{
+			refitBVH(trianglesBounds(mesh.triangles), mesh.bvh);
+		}
+
+
+		void buildMeshBVH(Mesh& mesh)
+		{
+			buildBVH(trianglesBounds(mesh.triangles), mesh.bvh);
+		}
+
+
+		// Compute the bounds of the shapes of the scene, and return them
+		std::vector<BoundingBox> updateShapesBounds(Scene& scene)
+		{
+			std::vector<BoundingBox> bounds{};
+			bounds.reserve(scene.shapes.size());
+			for (Shape& shape : scene.shapes)
+			{
+				shape.bounds = shapeBounds(shape);
+				bounds.push_back(shape.bounds);
+			}
+			return bounds;
+		}
+
+
+		// Build the hierarchies of the scene, with the threads of the pool if any
+		void buildSceneBVH(Scene& scene, utilities::ThreadPool* poolPtr)
+		{
+			PROFILE_ZONE("Build BVH");
+			// the stored meshes keep the hierarchy they were stored with
+			for (Mesh& mesh : scene.meshes)
+			{
+				if (mesh.storedChunk < 0)
+				{
+					buildBVH(trianglesBounds(mesh.triangles, poolPtr), mesh.bvh, poolPtr);
+				}
+			}
+			buildBVH(trianglesBounds(scene.polygons, poolPtr), scene.polygonsBVH, poolPtr);
+			buildBVH(updateShapesBounds(scene), scene.shapesBVH, poolPtr);
+
+			// the top level hierarchy is built again rather than refitted
+			scene.instancesBVH = BVH{};
+			updateInstancesBVH(scene);
+		}
+
+
+		void buildSceneBVH(Scene& scene)
+		{
+			buildSceneBVH(scene, nullptr);
+		}
+
+
+		void buildSceneBVH(Scene& scene, utilities::ThreadPool& pool)
+		{
+			buildSceneBVH(scene, &pool);
+		}
+
+
+		void updateInstancesBVH(Scene& scene)
+		{
+			std::vector<BoundingBox> bounds{};
+			bounds.reserve(scene.instances.size());
+			for (Instance& instance : scene.instances)
+			{
+				const Mesh& mesh = scene.meshes[instance.meshIndex];
+				const BoundingBox meshBounds = mesh.storedChunk >= 0 ? scene.geometryStorePtr->bounds(mesh.storedChunk)
+					: mesh.bvh.nodes.empty() ? BoundingBox{} : mesh.bvh.nodes[0].bounds;
+				// an empty mesh has empty bounds
+				instance.worldBounds = meshBounds.min.x > meshBounds.max.x ? BoundingBox{} : transformedBounds(meshBounds,
+					[&instance](const vec3& point) { return instance.toWorldPoint(point); });
+				bounds.push_back(instance.worldBounds);
+			}
+			refitBVH(bounds, scene.instancesBVH);
+		}
+
+
+		// Closest primitive hit by a ray so far, a triangle or a shape
+		// What is read from the triangle is copied when it is hit, as the chunk of a stored mesh may be unmapped once it is released
+		struct ClosestHit
+		{
+			float distance = MAX_DISTANCE;
+			// index of the triangle in its mesh or in the polygons, -1 for none
+			int triangleIndex = -1;
+			const Instance* instancePtr = nullptr;
+			const Shape* shapePtr = nullptr;
+			// normal where the primitive is hit, in the space of the mesh for the triangles of an instance
+			vec3 normal = vec3(0, 0, 0);
+			const Material* materialPtr = nullptr;
+		};
+
+		// Intersect the ray with the triangles of the mesh of an instance, keeping the hit if it is closer than maxDistance
+		void intersectMesh(const BVHView& bvh, const Triangle* triangles, const Instance& instance, const Ray& ray, float& maxDistance, ClosestHit& closest)
+		{
+			// the mesh is traversed with the ray expressed in its space
+			const vec3 localStart = instance.toLocalPoint(ray.start);
+			const vec3 localDirection = instance.toLocalDirection(ray.direction);
+			traverseBVH(bvh, localStart, localDirection, maxDistance,
+				[&](int triangleIndex, float& meshMaxDistance)
+			{
+				const Triangle& triangle = triangles[triangleIndex];
+				float distance{};
+				if (intersectTriangle(localStart, localDirection, triangle, distance) && distance < meshMaxDistance)
+				{
+					meshMaxDistance = distance;
+					closest.triangleIndex = triangleIndex;
+					closest.instancePtr = &instance;
+					closest.shapePtr = nullptr;
+					closest.normal = triangle.normal;
+					closest.materialPtr = triangle.material;
+				}
+			});
+		}
+
+		// Intersect the ray with the mesh of an instance, mapping it first if it is stored
+		inline void intersectInstance(const Scene& scene, const Instance& instance, const Ray& ray, float& maxDistance, ClosestHit& closest)
+		{
+			const Mesh& mesh = scene.meshes[instance.meshIndex];
+			if (mesh.storedChunk < 0)
+			{
+				intersectMesh(mesh.bvh, mesh.triangles.data(), instance, ray, maxDistance, closest);
+				return;
+			}
+			const StoredMeshPin storedPin = scene.geometryStorePtr->acquire(mesh.storedChunk);
+			intersectMesh(*storedPin, storedPin->triangles, instance, ray, maxDistance, closest);
+		}
+
+		// Intersect the ray with a shape of the scene, keeping the hit if it is closer than maxDistance
+		inline void intersectSceneShape(const Shape& shape, const Ray& ray, float& maxDistance, ClosestHit& closest)
+		{
+			float distance{};
+			vec3 normal{};
+			if (intersectShape(ray.start, ray.direction, shape, distance, normal) && distance < maxDistance)
+			{
+				maxDistance = distance;
+				closest.distance = distance;
+				closest.triangleIndex = -1;
+				closest.instancePtr = nullptr;
+				closest.shapePtr = &shape;
+				closest.normal = normal;
+				closest.materialPtr = shape.material;
+			}
+		}
+
+		// Intersect the ray with a polygon of the scene, keeping the hit if it is closer than maxDistance
+		inline void intersectPolygon(const Scene& scene, int triangleIndex, const Ray& ray, float& maxDistance, ClosestHit& closest)
+		{
+			const Triangle& triangle = scene.polygons[triangleIndex];
+			float distance{};
+			if (intersectTriangle(ray.start, ray.direction, triangle, distance) && distance < maxDistance)
+			{
+				maxDistance = distance;
+				closest.distance = distance;
+				closest.triangleIndex = triangleIndex;
+				closest.instancePtr = nullptr;
+				closest.shapePtr = nullptr;
+				closest.normal = triangle.normal;
+				closest.materialPtr = triangle.material;
+			}
+		}
+
+		// Describe the closest hit of the ray, if any
+		bool fillClosestIntersection(const Ray& ray, const ClosestHit& closest, Intersection& closestOut)
+		{
+			if (closest.triangleIndex < 0 && closest.shapePtr == nullptr)
+			{
+				return false;
+			}
+
+			closestOut.position = ray.pointOnRay(closest.distance);
+			closestOut.distance = closest.distance;
+			closestOut.triangleIndex = closest.triangleIndex;
+			closestOut.rayPtr = &ray;
+			closestOut.instancePtr = closest.instancePtr;
+			closestOut.shapePtr = closest.shapePtr;
+			closestOut.normal = closest.normal;
+			closestOut.materialPtr = closest.materialPtr;
+			if (closest.instancePtr != nullptr)
+			{
+				closestOut.normal = closest.instancePtr->toWorldNormal(closest.normal);
+				if (closest.instancePtr->materialOverride != nullptr)
+				{
+					closestOut.materialPtr = closest.instancePtr->materialOverride;
+				}
+			}
+			return true;
+		}
+
+
+		bool FindClosestIntersection(const Scene& scene, const Ray& ray, Intersection& closestOut)
+		{
+			ClosestHit closest{};
+
+			traverseBVH(scene.instancesBVH, ray.start, ray.direction, closest.distance,
+				[&](int instanceIndex, float& maxDistance)
+			{
+				intersectInstance(scene, scene.instances[instanceIndex], ray, maxDistance, closest);
+			});
+
+			traverseBVH(scene.shapesBVH, ray.start, ray.direction, closest.distance,
+				[&](int shapeIndex, float& maxDistance)
+			{
+				intersectSceneShape(scene.shapes[shapeIndex], ray, maxDistance, closest);
+			});
+
+			// the polygons win the ties with the instances and the shapes, otherwise the faces of a prism standing on the floor would fight with it
+			float polygonsMaxDistance = closest.distance + static_cast<float>(EPSILON);
+			traverseBVH(scene.polygonsBVH, ray.start, ray.direction, polygonsMaxDistance,
+				[&](int triangleIndex, float& maxDistance)
+			{
+				intersectPolygon(scene, triangleIndex, ray, maxDistance, closest);
+			});
+
+			return fillClosestIntersection(ray, closest, closestOut);
+		}
+
+
+		bool FindClosestIntersection(const Scene& scene, const CandidatePrimitives& candidates, const Ray& ray, Intersection& closestOut)
+		{
+			ClosestHit closest{};
+
+			const vec3 inverseDirection(1 / ray.direction.x, 1 / ray.direction.y, 1 / ray.direction.z);
+			for (int instanceIndex : candidates.instanceIndices)
+			{
+				const Instance& instance = scene.instances[instanceIndex];
+				if (intersectBox(instance.worldBounds, ray.start, inverseDirection, closest.distance))
+				{
+					intersectInstance(scene, instance, ray, closest.distance, closest);
+				}
+			}
+			for (int shapeIndex : candidates.shapeIndices)
+			{
+				const Shape& shape = scene.shapes[shapeIndex];
+				if (intersectBox(shape.bounds, ray.start, inverseDirection, closest.distance))
+				{
+					intersectSceneShape(shape, ray, closest.distance, closest);
+				}
+			}
+
+			// same ties as when the whole scene is searched
+			float polygonsMaxDistance = closest.distance + static_cast<float>(EPSILON);
+			for (int triangleIndex : candidates.polygonIndices)
+			{
+				intersectPolygon(scene, triangleIndex, ray, polygonsMaxDistance, closest);
+			}
+
+			return fillClosestIntersection(ray, closest, closestOut);
+		}
+
+
+		bool FindPrimitivesInFrustum(const Scene& scene, const Frustum& frustum, CandidatePrimitives& candidates, size_t maxCount)
+		{
+			candidates.clear();
+			bool isComplete = true;
+			traverseBVHNodes(scene.polygonsBVH, [&frustum](const BoundingBox& bounds) { return frustum.mayContain(bounds); },
+				[&](int triangleIndex)
+			{
+				const Triangle& triangle = scene.polygons[triangleIndex];
+				const vec3 vertices[3] = { triangle.v0, triangle.v1, triangle.v2 };
+				if (frustum.mayContain(vertices, 3))
+				{
+					candidates.polygonIndices.push_back(triangleIndex);
+					isComplete = candidates.size() <= maxCount;
+				}
+				return isComplete;
+			});
+
+			if (!isComplete)
+			{
+				return false;
+			}
+
+			traverseBVHNodes(scene.instancesBVH, [&frustum](const BoundingBox& bounds) { return frustum.mayContain(bounds); },
+				[&](int instanceIndex)
+			{
+				candidates.instanceIndices.push_back(instanceIndex);
+				isComplete = candidates.size() <= maxCount;
+				return isComplete;
+			});
+
+			if (!isComplete)
+			{
+				return false;
+			}
+
+			traverseBVHNodes(scene.shapesBVH, [&frustum](const BoundingBox& bounds) { return frustum.mayContain(bounds); },
+				[&](int shapeIndex)
+			{
+				candidates.shapeIndices.push_back(shapeIndex);
+				isComplete = candidates.size() <= maxCount;
+				return isComplete;
+			});
+			return isComplete;
+		}
+
+
+		void FindTrianglesInBox(const Scene& scene, const BoundingBox& box, utilities::ArenaVector<SceneTriangle>& result)
+		{
+			traverseBVH(scene.polygonsBVH, box, [&](int triangleIndex)
+			{
+				const Triangle& triangle = scene.polygons[triangleIndex];
+				if (overlap(triangleBounds(triangle), box))
+				{
+					result.push_back(SceneTriangle{ triangle, triangleIndex, nullptr });
+				}
+			});
+
+			traverseBVH(scene.instancesBVH, box, [&](int instanceIndex)
+			{
+				const Instance& instance = scene.instances[instanceIndex];
+				const Mesh& mesh = scene.meshes[instance.meshIndex];
+				StoredMeshPin storedPin{};
+				if (mesh.storedChunk >= 0)
+				{
+					storedPin = scene.geometryStorePtr->acquire(mesh.storedChunk);
+				}
+				const BVHView meshBVH = storedPin ? BVHView(*storedPin) : BVHView(mesh.bvh);
+				const Triangle* triangles = storedPin ? storedPin->triangles : mesh.triangles.data();
+				const BoundingBox localBox = transformedBounds(box, [&instance](const vec3& point) { return instance.toLocalPoint(point); });
+				traverseBVH(meshBVH, localBox, [&](int triangleIndex)
+				{
+					const Triangle& triangle = triangles[triangleIndex];
+					const Triangle placedTriangle(instance.toWorldPoint(triangle.v0), instance.toWorldPoint(triangle.v1), instance.toWorldPoint(triangle.v2), triangle.material);
+					if (overlap(triangleBounds(placedTriangle), box))
+					{
+						result.push_back(SceneTriangle{ placedTriangle, triangleIndex, &instance });
+					}
+				});
+			});
+		}
+
+
+		bool anyShapeInBox(const Scene& scene, const BoundingBox& box)
+		{
+			bool isFound = false;
+			traverseBVHNodes(scene.shapesBVH, [&box](const BoundingBox& bounds) { return overlap(bounds, box); },
+				[&](int shapeIndex)
+			{
+				isFound = overlap(scene.shapes[shapeIndex].bounds, box);
+				return !isFound;
+			});
+			return isFound;
+		}
+
+
+		bool intersectBox(const BoundingBox& box, const vec3& origin, const vec3& inverseDirection, float maxDistance)
+		{
+			// slabs method
+			const vec3 t1 = (box.min - origin) * inverseDirection;
+			const vec3 t2 = (box.max - origin) * inverseDirection;
+			const vec3 tNear = glm::min(t1, t2);
+			const vec3 tFar = glm::max(t1, t2);
+			const float entry = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.f));
+			const float exit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, maxDistance));
+			return entry <= exit;
+		}
+
+
+		bool intersectTriangle(const vec3& origin, const vec3& direction, const Triangle& triangle, float& distanceOut)
+		{
+			const vec3 e1 = triangle.v1 - triangle.v0;
+			const vec3 e2 = triangle.v2 - triangle.v0;
+			const vec3 p = glm::cross(direction, e2);
+			const float determinant = glm::dot(e1, p);
+			// the ray is parallel to the triangle
+			if (determinant == 0)
+			{
+				return false;
+			}
+
+			const float inverseDeterminant = 1 / determinant;
+			const vec3 s = origin - triangle.v0;
+			const float u = glm::dot(s, p) * inverseDeterminant;
+			if (u < 0 || u > 1)
+			{
+				return false;
+			}
+			const vec3 q = glm::cross(s, e1);
+			const float v = glm::dot(direction, q) * inverseDeterminant;
+			if (v < 0 || u + v > 1)
+			{
+				return false;
+			}
+
+			distanceOut = glm::dot(e2, q) * inverseDeterminant;
+			return distanceOut > EPSILON;
+		}
+
+
+		bool intersectShape(const vec3& origin, const vec3& direction, const Shape& shape, float& distanceOut, vec3& normalOut)
+		{
+			float entry = -MAX_DISTANCE;
+			float exit = MAX_DISTANCE;
+			vec3 entryNormal{};
+			vec3 exitNormal{};
+			for (const Shape::HalfSpace& halfSpace : shape.halfSpaces)
+			{
+				const float speed = glm::dot(halfSpace.normal, direction);
+				const float gap = halfSpace.offset - glm::dot(halfSpace.normal, origin);
+				if (speed == 0)
+				{
+					// the ray is parallel to the plane, and stays on the side it starts
+					if (gap < 0)
+					{
+						return false;
+					}
+					continue;
+				}
+
+				const float distance = gap / speed;
+				if (speed < 0 && distance > entry)
+				{
+					entry = distance;
+					entryNormal = halfSpace.normal;
+				}
+				else if (speed > 0 && distance < exit)
+				{
+					exit = distance;
+					exitNormal = halfSpace.normal;
+				}
+			}
+
+			for (const Shape::Ball& ball : shape.balls)
+			{
+				const vec3 offset = origin - ball.center;
+				const float a = glm::dot(direction, direction);
+				const float b = glm::dot(offset, direction);
+				const float c = glm::dot(offset, offset) - ball.radius * ball.radius;
+				const float discriminant = b * b - a * c;
+				if (discriminant <= 0)
+				{
+					return false;
+				}
+
+				// the smallest root is not computed as a difference of close numbers, so that it stays accurate for a ray starting on the sphere
+				const float q = b > 0 ? -b - std::sqrt(discriminant) : -b + std::sqrt(discriminant);
+				const float near = std::min(q / a, c / q);
+				const float far = std::max(q / a, c / q);
+				if (near > entry)
+				{
+					entry = near;
+					entryNormal = (offset + near * direction) / ball.radius;
+				}
+				if (far < exit)
+				{
+					exit = far;
+					exitNormal = (offset + far * direction) / ball.radius;
+				}
+			}
+
+			if (entry > exit)
+			{
+				return false;
+			}
+			if (entry > EPSILON)
+			{
+				distanceOut = entry;
+				normalOut = entryNormal;
+				return true;
+			}
+			if (exit > EPSILON)
+			{
+				distanceOut = exit;
+				normalOut = exitNormal;
+				return true;
+			}
+			return false;
+		}
+	}
+}
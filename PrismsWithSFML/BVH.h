@@ -0,0 +1,125 @@
+#ifndef BVH_H
+#define BVH_H
+
+// Defines the bounding volume hierarchies used to find what the rays hit in the scene
+// The polygons of the scene and every mesh have their own hierarchy over their triangles,
+// a top level hierarchy is built over the instances of the meshes and another one over the analytic shapes
+
+#include "stdafx.h"
+#include "GraphicsModel.h"
+#include "ThreadPool.h"
+
+namespace Graphics
+{
+	namespace Raytracing
+	{
+		// Maximum number of primitives in a leaf
+		constexpr int BVH_LEAF_SIZE = 4;
+
+		// Number of bins per axis where the surface area heuristic is evaluated
+		constexpr int BVH_SAH_BIN_COUNT = 16;
+
+		// Hard limit on the depth of the hierarchies, the root being at depth 0, which sizes the stacks of the traversals
+		constexpr int BVH_MAX_DEPTH = 64;
+
+		// Below that depth the surface area heuristic chooses the splits, then the primitives are split in halves,
+		// which leaves at most 2^31 primitives in leaves before the hard limit
+		constexpr int BVH_SAH_MAX_DEPTH = BVH_MAX_DEPTH - 32;
+
+		// Nodes with at least that many primitives have their children built as separate tasks
+		constexpr int BVH_PARALLEL_BUILD_SIZE = 4096;
+
+		// Nodes with at least that many primitives are binned and partitioned by several threads
+		constexpr int BVH_PARALLEL_BINNING_SIZE = 65536;
+
+		// Costs of the surface area heuristic, relative to each other
+		constexpr float BVH_TRAVERSAL_COST = 1;
+		constexpr float BVH_INTERSECTION_COST = 1;
+
+		// A subtree is built again once refitting has made its cost grow by this factor
+		constexpr float BVH_REBUILD_THRESHOLD = 1.5f;
+
+		// A triangle placed in the scene, with the triangle and the instance it comes from
+		struct SceneTriangle
+		{
+			Triangle triangle;
+			// index of the source triangle in its mesh, or in the polygons of the scene without an instance
+			int sourceIndex;
+			const Instance* instancePtr;
+		};
+
+		// Return the bounds of a triangle
+		BoundingBox triangleBounds(const Triangle& triangle);
+
+		// Return the bounds of a shape
+		// A shape with balls is bounded by their boxes only, so its half-spaces must not stick out of them
+		BoundingBox shapeBounds(const Shape& shape);
+
+		// Build a hierarchy over primitives described by their bounds
+		// The splits are chosen with the binned surface area heuristic
+		void buildBVH(const std::vector<BoundingBox>& primitiveBounds, BVH& bvh);
+
+		// Build a hierarchy with the threads of the pool
+		// Large nodes are binned and partitioned in parallel, and the subtrees are built as separate tasks
+		// Only the order of the primitives inside the leaves may differ from the hierarchy built by a single thread
+		void buildBVH(const std::vector<BoundingBox>& primitiveBounds, BVH& bvh, utilities::ThreadPool& pool);
+
+		// Build the hierarchies of the meshes in memory, of the polygons and of the shapes, then the top level one
+		void buildSceneBVH(Scene& scene);
+		void buildSceneBVH(Scene& scene, utilities::ThreadPool& pool);
+
+		// Update the bounds of a hierarchy after its primitives moved or deformed, keeping its structure
+		// The subtrees whose cost grew beyond the threshold are built again
+		// Return the number of primitives of the subtrees built again
+		int refitBVH(const std::vector<BoundingBox>& primitiveBounds, BVH& bvh, float rebuildThreshold = BVH_REBUILD_THRESHOLD);
+
+		// Refit the hierarchy of the polygons of the scene after they moved or deformed
+		// Their normals are expected to be computed again beforehand
+		void refitPolygonsBVH(Scene& scene);
+
+		// Build the hierarchy of a single mesh in memory, its instances must then be updated
+		void buildMeshBVH(Mesh& mesh);
+
+		// Refit the hierarchy of a mesh in memory after its triangles moved or deformed, its instances must then be updated
+		// Their normals are expected to be computed again beforehand
+		void refitMeshBVH(Mesh& mesh);
+
+		// Update the top level hierarchy after instances have been added or moved
+		// It is refitted while the instances are the same ones, and built again otherwise
+		// The meshes and the polygons are left untouched
+		void updateInstancesBVH(Scene& scene);
+
+		// Find the closest triangle or shape hit by the ray, farther than EPSILON from its start
+		// Return false if the ray hits nothing
+		bool FindClosestIntersection(const Scene& scene, const Ray& ray, Intersection& closestOut);
+
+		// Find the closest triangle or shape hit by the ray among the candidates only
+		// The result is the same as searching the whole scene when the candidates hold every primitive the ray may hit
+		bool FindClosestIntersection(const Scene& scene, const CandidatePrimitives& candidates, const Ray& ray, Intersection& closestOut);
+
+		// Fill the candidates with the polygons, the instances and the shapes of the scene that the rays of the frustum may hit
+		// Return false if there are more than maxCount of them, the candidates are then incomplete
+		bool FindPrimitivesInFrustum(const Scene& scene, const Frustum& frustum, CandidatePrimitives& candidates, size_t maxCount);
+
+		// Append to the result the triangles of the scene whose bounds overlap the box
+		void FindTrianglesInBox(const Scene& scene, const BoundingBox& box, utilities::ArenaVector<SceneTriangle>& result);
+
+		// Return true if the bounds of a shape of the scene overlap the box
+		bool anyShapeInBox(const Scene& scene, const BoundingBox& box);
+
+		// Return true if the ray enters the box before maxDistance
+		// inverseDirection holds the inverse of each coordinate of the ray direction
+		bool intersectBox(const BoundingBox& box, const vec3& origin, const vec3& inverseDirection, float maxDistance);
+
+		// Moller-Trumbore intersection of a ray with a triangle
+		// the direction does not need to be normalized, the distance is then measured in its units
+		bool intersectTriangle(const vec3& origin, const vec3& direction, const Triangle& triangle, float& distanceOut);
+
+		// Intersection of a ray with a shape, the ray lies inside it between its last entry into a surface and its first exit
+		// A ray starting inside the shape, or on its surface, hits it where it leaves
+		// Fills out the distance, measured in the units of the direction, and the outward normal of the surface that is hit
+		bool intersectShape(const vec3& origin, const vec3& direction, const Shape& shape, float& distanceOut, vec3& normalOut);
+	}
+}
+
+#endif
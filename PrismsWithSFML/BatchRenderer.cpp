@@ -0,0 +1,218 @@
+#include "stdafx.h"
+#include "BatchRenderer.h"
+#include "Renderer.h"
+#include "Profiler.h"
+
+// Defines the functions declared in its BatchRenderer.h
+// All the functions descriptions could be found there
+
+#include <atomic>
+#include <fstream>
+
+namespace Graphics
+{
+	namespace Rendering
+	{
+		bool writePPM(const FrameBuffer& frame, const std::string& path)
+		{
+			std::ofstream file(path, std::ios::binary);
+			if (!file)
+			{
+				return false;
+			}
+			file << "P6\n" << frame.width << " " << frame.height << "\n255\n";
+
+			std::vector<unsigned char> bytes(frame.pixels.size() * 3);
+			for (size_t i = 0; i < frame.pixels.size(); ++i)
+			{
+				for (int channel = 0; channel < 3; ++channel)
+				{
+					const float value = frame.pixels[i][channel];
+					bytes[3 * i + channel] = (value >= 1) ? 255u : static_cast<unsigned char>(std::max(value, 0.f) * 255);
+				}
+			}
+			file.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+			return static_cast<bool>(file);
+		}
+
+		AsyncImageWriter::AsyncImageWriter(size_t maxPendingImages) :
+			maxPendingImages(std::max(maxPendingImages, static_cast<size_t>(1))),
+			isWriting(false),
+			failedImages(0),
+			isStopping(false)
+		{
+			writer = std::thread([this]() { writerLoop(); });
+		}
+
+		AsyncImageWriter::~AsyncImageWriter()
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				isStopping = true;
+			}
+			queueChanged.notify_all();
+			writer.join();
+		}
+
+		void AsyncImageWriter::write(FrameBuffer frame, const std::string& path)
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			queueChanged.wait(lock, [this]() { return pendingImages.size() < maxPendingImages; });
+			pendingImages.push_back(PendingImage{ std::move(frame), path });
+			queueChanged.notify_all();
+		}
+
+		void AsyncImageWriter::flush()
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			queueChanged.wait(lock, [this]() { return pendingImages.empty() && !isWriting; });
+		}
+
+		int AsyncImageWriter::failedCount() const
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			return failedImages;
+		}
+
+		void AsyncImageWriter::writerLoop()
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			while (true)
+			{
+				queueChanged.wait(lock, [this]() { return isStopping || !pendingImages.empty(); });
+				if (pendingImages.empty())
+				{
+					return;
+				}
+
+				PendingImage image = std::move(pendingImages.front());
+				pendingImages.pop_front();
+				isWriting = true;
+				queueChanged.notify_all();
+
+				// the renderers keep queuing images while this one is written
+				lock.unlock();
+				bool isWritten = false;
+				{
+					PROFILE_ZONE("Image writing");
+					isWritten = writePPM(image.frame, image.path);
+				}
+				lock.lock();
+
+				isWriting = false;
+				if (!isWritten)
+				{
+					++failedImages;
+				}
+				queueChanged.notify_all();
+			}
+		}
+
+
+		// Return true if both jobs need the scene in the same state
+		bool hasSameSceneSettings(const BatchJob& job, const BatchJob& other)
+		{
+			if (job.lightPosition != other.lightPosition
+				|| job.lightColor != other.lightColor
+				|| job.materialOverrides.size() != other.materialOverrides.size())
+			{
+				return false;
+			}
+			for (size_t i = 0; i < job.materialOverrides.size(); ++i)
+			{
+				const MaterialOverride& materialOverride = job.materialOverrides[i];
+				const MaterialOverride& otherMaterialOverride = other.materialOverrides[i];
+				if (materialOverride.materialPtr != otherMaterialOverride.materialPtr
+					|| materialOverride.cauchyCoeff_A != otherMaterialOverride.cauchyCoeff_A
+					|| materialOverride.cauchyCoeff_B != otherMaterialOverride.cauchyCoeff_B)
+				{
+					return false;
+				}
+			}
+			return true;
+		}
+
+		int BatchRenderer::run(Scene& scene, const std::vector<BatchJob>& jobs)
+		{
+			// the state of the scene is saved to be given back at the end
+			const vec3 lightPosition = scene.lightSource.pos;
+			const glm_color_t lightColor = scene.lightSource.color;
+			std::vector<MaterialOverride> savedMaterials{};
+			for (const BatchJob& job : jobs)
+			{
+				for (const MaterialOverride& materialOverride : job.materialOverrides)
+				{
+					const bool isSaved = std::any_of(savedMaterials.begin(), savedMaterials.end(),
+						[&](const MaterialOverride& saved) { return saved.materialPtr == materialOverride.materialPtr; });
+					if (!isSaved)
+					{
+						savedMaterials.push_back(MaterialOverride{ materialOverride.materialPtr, materialOverride.materialPtr->cauchyCoeff_A, materialOverride.materialPtr->cauchyCoeff_B });
+					}
+				}
+			}
+
+			const int previousFailures = writer.failedCount();
+			size_t groupBegin = 0;
+			while (groupBegin < jobs.size())
+			{
+				// the jobs of a group share the scene, which must not change while they are rendered
+				size_t groupEnd = groupBegin + 1;
+				while (groupEnd < jobs.size() && hasSameSceneSettings(jobs[groupBegin], jobs[groupEnd]))
+				{
+					++groupEnd;
+				}
+
+				const BatchJob& firstJob = jobs[groupBegin];
+				scene.lightSource.pos = firstJob.lightPosition;
+				scene.lightSource.color = firstJob.lightColor;
+				for (const MaterialOverride& saved : savedMaterials)
+				{
+					saved.materialPtr->setCauchyCoefficients(saved.cauchyCoeff_A, saved.cauchyCoeff_B);
+				}
+				for (const MaterialOverride& materialOverride : firstJob.materialOverrides)
+				{
+					materialOverride.materialPtr->setCauchyCoefficients(materialOverride.cauchyCoeff_A, materialOverride.cauchyCoeff_B);
+				}
+
+				// one task per thread takes the jobs in turn, a thread waiting inside a job may start the task of another one
+				// so that the number of jobs nested on a thread stays bounded
+				std::atomic<size_t> nextJob(groupBegin);
+				const size_t taskCount = std::min(static_cast<size_t>(pool.threadCount()), groupEnd - groupBegin);
+				utilities::ThreadPool::TaskGroup group(pool);
+				for (size_t task = 0; task < taskCount; ++task)
+				{
+					group.run([this, &scene, &jobs, &nextJob, groupEnd]() {
+						for (size_t i = nextJob++; i < groupEnd; i = nextJob++)
+						{
+							renderJob(scene, jobs[i]);
+						}
+					});
+				}
+				group.wait();
+				groupBegin = groupEnd;
+			}
+
+			scene.lightSource.pos = lightPosition;
+			scene.lightSource.color = lightColor;
+			for (const MaterialOverride& saved : savedMaterials)
+			{
+				saved.materialPtr->setCauchyCoefficients(saved.cauchyCoeff_A, saved.cauchyCoeff_B);
+			}
+
+			writer.flush();
+			return static_cast<int>(jobs.size()) - (writer.failedCount() - previousFailures);
+		}
+
+		void BatchRenderer::renderJob(const Scene& scene, const BatchJob& job)
+		{
+			PROFILE_ZONE("Batch job");
+			Renderer renderer(pool, context, antiAliasing, caustics, true, job.frames);
+			FrameBuffer frame(job.camera.screen.width, job.camera.screen.height);
+			for (int i = 0; i < std::max(job.frames, 1); ++i)
+			{
+				renderer.render(scene, job.camera, frame);
+			}
+			writer.write(std::move(frame), job.outputPath);
+		}
+	}
+}
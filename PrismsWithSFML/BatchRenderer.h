@@ -0,0 +1,125 @@
+#ifndef BATCH_RENDERER_H
+#define BATCH_RENDERER_H
+
+// Renders lists of images of one scene without the interactive loop, such as camera paths or sweeps of glasses
+
+#include "stdafx.h"
+#include "GraphicsModel.h"
+#include "FrameBuffer.h"
+#include "AdaptiveSampling.h"
+#include "PhotonMap.h"
+#include "ThreadPool.h"
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace Graphics
+{
+	namespace Rendering
+	{
+		// Cauchy coefficients given to a material of the scene for the time of a job
+		struct MaterialOverride
+		{
+			Material* materialPtr;
+			float cauchyCoeff_A;
+			float cauchyCoeff_B;
+		};
+
+		// Image to render by the batch renderer
+		struct BatchJob
+		{
+			// the image has the size of the camera screen
+			Camera camera;
+			vec3 lightPosition;
+			glm_color_t lightColor;
+			std::vector<MaterialOverride> materialOverrides;
+			// number of progressive frames averaged in the image
+			int frames;
+			// the image is written there as a binary PPM
+			std::string outputPath;
+		};
+
+		// Write the frame as a binary PPM, with the colors clamped like on the screen
+		// Return false if the file could not be written
+		bool writePPM(const FrameBuffer& frame, const std::string& path);
+
+		// Writes the images on its own thread so that the disk accesses overlap the rendering
+		class AsyncImageWriter
+		{
+		public:
+			// Queuing an image waits while maxPendingImages are already waiting to be written
+			explicit AsyncImageWriter(size_t maxPendingImages = 8);
+
+			// The queued images are written before the writer stops
+			~AsyncImageWriter();
+
+			AsyncImageWriter(const AsyncImageWriter&) = delete;
+			AsyncImageWriter& operator=(const AsyncImageWriter&) = delete;
+
+			// Queue the frame to be written at the path
+			void write(FrameBuffer frame, const std::string& path);
+
+			// Return once all the queued images are written
+			void flush();
+
+			// Number of images that could not be written
+			int failedCount() const;
+
+		private:
+			struct PendingImage
+			{
+				FrameBuffer frame;
+				std::string path;
+			};
+
+			const size_t maxPendingImages;
+			std::deque<PendingImage> pendingImages;
+			// an image is still being written after it left the queue
+			bool isWriting;
+			int failedImages;
+			bool isStopping;
+			mutable std::mutex mutex;
+			std::condition_variable queueChanged;
+			std::thread writer;
+
+			void writerLoop();
+		};
+
+		// Renders jobs sharing the scene and its hierarchies, built once beforehand
+		class BatchRenderer
+		{
+		public:
+			// settings of the renderer of every job
+			Raytracing::TraceContext context;
+			AdaptiveSamplingSettings antiAliasing;
+			Raytracing::PhotonMapSettings caustics;
+
+			BatchRenderer(utilities::ThreadPool& pool, const Raytracing::TraceContext& context, const AdaptiveSamplingSettings& antiAliasing,
+				const Raytracing::PhotonMapSettings& caustics, size_t maxPendingImages = 8) :
+				context(context),
+				antiAliasing(antiAliasing),
+				caustics(caustics),
+				pool(pool),
+				writer(maxPendingImages)
+			{}
+
+			// Render the jobs and write their images
+			// Consecutive jobs with the same light and materials are rendered at the same time, each one as a task of the pool
+			// whose frames are also traced in parallel, so that small images still keep all the threads busy
+			// The light and the materials of the scene are given back their values at the end
+			// Return the number of images written
+			int run(Scene& scene, const std::vector<BatchJob>& jobs);
+
+		private:
+			utilities::ThreadPool& pool;
+			AsyncImageWriter writer;
+
+			// Render the image of a job, then queue it to the writer
+			void renderJob(const Scene& scene, const BatchJob& job);
+		};
+	}
+}
+
+#endif
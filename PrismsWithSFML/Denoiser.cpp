@@ -0,0 +1,231 @@
+#include "stdafx.h"
+#include "Denoiser.h"
+#include "Profiler.h"
+
+// Defines the functions declared in its Denoiser.h
+// All the functions descriptions could be found there
+
+#include <cmath>
+#include <cstddef>
+#include <emmintrin.h>
+
+namespace Graphics
+{
+	namespace Raytracing
+	{
+		constexpr uint32_t SurfaceGuide::UNKNOWN;
+		constexpr uint32_t SurfaceGuide::BACKGROUND;
+	}
+
+	namespace Rendering
+	{
+		// Weights of the B3 spline along an axis of the 5x5 taps
+		constexpr float KERNEL_WEIGHTS[5] = { 1.f / 16, 1.f / 4, 3.f / 8, 1.f / 4, 1.f / 16 };
+
+		// e^x for x <= 0, to about 1e-6 relative, and 0 below -87
+		// 2^(x log2(e)) is split into a power of two built in the exponent bits and a polynomial on the fractional part
+		inline __m128 negativeExp(__m128 x)
+		{
+			const __m128 t = _mm_mul_ps(_mm_max_ps(x, _mm_set1_ps(-87.f)), _mm_set1_ps(1.44269504f));
+			const __m128 truncated = _mm_cvtepi32_ps(_mm_cvttps_epi32(t));
+			const __m128 floor = _mm_sub_ps(truncated, _mm_and_ps(_mm_cmplt_ps(t, truncated), _mm_set1_ps(1.f)));
+			const __m128 fraction = _mm_sub_ps(t, floor);
+			__m128 power = _mm_set1_ps(1.8775767e-3f);
+			power = _mm_add_ps(_mm_mul_ps(power, fraction), _mm_set1_ps(8.9893397e-3f));
+			power = _mm_add_ps(_mm_mul_ps(power, fraction), _mm_set1_ps(5.5826318e-2f));
+			power = _mm_add_ps(_mm_mul_ps(power, fraction), _mm_set1_ps(2.4015361e-1f));
+			power = _mm_add_ps(_mm_mul_ps(power, fraction), _mm_set1_ps(6.9315308e-1f));
+			power = _mm_add_ps(_mm_mul_ps(power, fraction), _mm_set1_ps(9.9999994e-1f));
+			const __m128i exponent = _mm_slli_epi32(_mm_add_epi32(_mm_cvttps_epi32(floor), _mm_set1_epi32(127)), 23);
+			return _mm_mul_ps(power, _mm_castsi128_ps(exponent));
+		}
+
+		inline __m128 absolute(__m128 x)
+		{
+			return _mm_andnot_ps(_mm_set1_ps(-0.f), x);
+		}
+
+		void Denoiser::beginFrame(int width, int height)
+		{
+			this->width = width;
+			this->height = height;
+			guides.assign(width * height, Raytracing::SurfaceGuide{ vec3(0, 0, 0), 0, Raytracing::SurfaceGuide::UNKNOWN, 0 });
+		}
+
+		void Denoiser::filter(FrameBuffer& frame, utilities::ThreadPool& pool, int frameCount)
+		{
+			if (frame.width != width || frame.height != height || settings.iterations <= 0)
+			{
+				return;
+			}
+			PROFILE_ZONE("Denoise");
+
+			// PLANES
+			// the widest pass reaches 2 * 2^(iterations - 1) pixels away, and the last group of a row may end 3 pixels past it
+			padding = (1 << settings.iterations) + 4;
+			paddedWidth = width + 2 * padding;
+			const size_t planeSize = static_cast<size_t>(paddedWidth) * (height + 2 * padding);
+			for (int buffer = 0; buffer < 2; ++buffer)
+			{
+				for (int channel = 0; channel < 3; ++channel)
+				{
+					colors[buffer][channel].assign(planeSize, 0.f);
+				}
+				variances[buffer].assign(planeSize, 0.f);
+			}
+			depths.assign(planeSize, 0.f);
+			for (std::vector<float>& plane : normals)
+			{
+				plane.assign(planeSize, 0.f);
+			}
+			surfaceIds.assign(planeSize, Raytracing::SurfaceGuide::UNKNOWN);
+			for (int y = 0; y < height; ++y)
+			{
+				for (int x = 0; x < width; ++x)
+				{
+					const size_t index = static_cast<size_t>(y + padding) * paddedWidth + x + padding;
+					const glm_color_t& color = frame.at(x, y);
+					// a color that is not finite would spread to the whole neighbourhood, it is left out of the filter
+					if (!std::isfinite(color.r + color.g + color.b))
+					{
+						continue;
+					}
+					const Raytracing::SurfaceGuide& surface = guides[y * width + x];
+					for (int channel = 0; channel < 3; ++channel)
+					{
+						colors[0][channel][index] = color[channel];
+						normals[channel][index] = surface.normal[channel];
+					}
+					depths[index] = surface.depth;
+					surfaceIds[index] = surface.surfaceId;
+					variances[1][index] = surface.variance / frameCount;
+				}
+			}
+
+			// VARIANCE
+			// the variance of a single sample is noisy itself, it is averaged over the 3x3 neighbours on the same surface
+			pool.parallelFor(0, height, 16, [&](int rowBegin, int rowEnd) {
+				for (int y = rowBegin; y < rowEnd; ++y)
+				{
+					for (int x = 0; x < width; ++x)
+					{
+						const size_t index = static_cast<size_t>(y + padding) * paddedWidth + x + padding;
+						float sum = 0;
+						int count = 0;
+						for (int dy = -1; dy <= 1; ++dy)
+						{
+							for (int dx = -1; dx <= 1; ++dx)
+							{
+								const size_t neighbour = index + dy * paddedWidth + dx;
+								if (surfaceIds[neighbour] == surfaceIds[index])
+								{
+									sum += variances[1][neighbour];
+									++count;
+								}
+							}
+						}
+						variances[0][index] = sum / count;
+					}
+				}
+			});
+
+			// PASSES
+			int source = 0;
+			for (int iteration = 0; iteration < settings.iterations; ++iteration)
+			{
+				PROFILE_ZONE("Denoise pass");
+				const int step = 1 << iteration;
+				const int target = 1 - source;
+				pool.parallelFor(0, height, 8, [&](int rowBegin, int rowEnd) {
+					const float* sourceColors[3] = { colors[source][0].data(), colors[source][1].data(), colors[source][2].data() };
+					const float* sourceVariances = variances[source].data();
+					const __m128 colorSigma = _mm_set1_ps(settings.colorSigma);
+					const __m128 depthSigma = _mm_set1_ps(settings.depthSigma * step);
+					const __m128 normalSharpness = _mm_set1_ps(settings.normalSharpness);
+					const __m128 epsilon = _mm_set1_ps(1e-4f);
+					const __m128 one = _mm_set1_ps(1.f);
+					const __m128i lastReservedId = _mm_set1_epi32(static_cast<int>(Raytracing::SurfaceGuide::BACKGROUND));
+
+					for (int y = rowBegin; y < rowEnd; ++y)
+					{
+						for (int x = 0; x < width; x += 4)
+						{
+							const size_t index = static_cast<size_t>(y + padding) * paddedWidth + x + padding;
+							const __m128 centerColor[3] = { _mm_loadu_ps(sourceColors[0] + index), _mm_loadu_ps(sourceColors[1] + index), _mm_loadu_ps(sourceColors[2] + index) };
+							const __m128 centerNormal[3] = { _mm_loadu_ps(normals[0].data() + index), _mm_loadu_ps(normals[1].data() + index), _mm_loadu_ps(normals[2].data() + index) };
+							const __m128 centerDepth = _mm_loadu_ps(depths.data() + index);
+							const __m128i centerId = _mm_loadu_si128(reinterpret_cast<const __m128i*>(surfaceIds.data() + index));
+							const __m128 colorScale = _mm_div_ps(one, _mm_add_ps(_mm_mul_ps(colorSigma, _mm_sqrt_ps(_mm_loadu_ps(sourceVariances + index))), epsilon));
+							const __m128 depthScale = _mm_div_ps(one, _mm_add_ps(_mm_mul_ps(depthSigma, centerDepth), epsilon));
+
+							__m128 weightSum = _mm_setzero_ps();
+							__m128 colorSum[3] = { _mm_setzero_ps(), _mm_setzero_ps(), _mm_setzero_ps() };
+							__m128 varianceSum = _mm_setzero_ps();
+							for (int dy = -2; dy <= 2; ++dy)
+							{
+								for (int dx = -2; dx <= 2; ++dx)
+								{
+									const size_t tap = static_cast<size_t>(static_cast<ptrdiff_t>(index) + (static_cast<ptrdiff_t>(dy) * paddedWidth + dx) * step);
+									__m128 color[3];
+									__m128 colorDistance = _mm_setzero_ps();
+									__m128 cosine = _mm_setzero_ps();
+									for (int channel = 0; channel < 3; ++channel)
+									{
+										color[channel] = _mm_loadu_ps(sourceColors[channel] + tap);
+										const __m128 difference = _mm_sub_ps(color[channel], centerColor[channel]);
+										colorDistance = _mm_add_ps(colorDistance, _mm_mul_ps(difference, difference));
+										cosine = _mm_add_ps(cosine, _mm_mul_ps(_mm_loadu_ps(normals[channel].data() + tap), centerNormal[channel]));
+									}
+									const __m128 depthDistance = absolute(_mm_sub_ps(_mm_loadu_ps(depths.data() + tap), centerDepth));
+
+									const __m128 exponent = _mm_add_ps(_mm_add_ps(
+										_mm_mul_ps(_mm_sqrt_ps(colorDistance), colorScale),
+										_mm_mul_ps(depthDistance, depthScale)),
+										_mm_mul_ps(_mm_sub_ps(one, cosine), normalSharpness));
+									const __m128 isSameSurface = _mm_castsi128_ps(_mm_cmpeq_epi32(
+										_mm_loadu_si128(reinterpret_cast<const __m128i*>(surfaceIds.data() + tap)), centerId));
+									const __m128 weight = _mm_and_ps(isSameSurface,
+										_mm_mul_ps(_mm_set1_ps(KERNEL_WEIGHTS[dy + 2] * KERNEL_WEIGHTS[dx + 2]), negativeExp(_mm_sub_ps(_mm_setzero_ps(), exponent))));
+
+									weightSum = _mm_add_ps(weightSum, weight);
+									for (int channel = 0; channel < 3; ++channel)
+									{
+										colorSum[channel] = _mm_add_ps(colorSum[channel], _mm_mul_ps(weight, color[channel]));
+									}
+									varianceSum = _mm_add_ps(varianceSum, _mm_mul_ps(_mm_mul_ps(weight, weight), _mm_loadu_ps(sourceVariances + tap)));
+								}
+							}
+
+							// the center weighs at least its kernel weight, the pixels without a surface keep their values
+							// the ids are compared as signed numbers, which is right for the two reserved ones only
+							const __m128 isSurface = _mm_castsi128_ps(_mm_or_si128(_mm_cmpgt_epi32(centerId, lastReservedId), _mm_cmplt_epi32(centerId, _mm_setzero_si128())));
+							const __m128 inverseWeight = _mm_div_ps(one, _mm_max_ps(weightSum, epsilon));
+							for (int channel = 0; channel < 3; ++channel)
+							{
+								const __m128 filtered = _mm_mul_ps(colorSum[channel], inverseWeight);
+								_mm_storeu_ps(colors[target][channel].data() + index,
+									_mm_or_ps(_mm_and_ps(isSurface, filtered), _mm_andnot_ps(isSurface, centerColor[channel])));
+							}
+							const __m128 filteredVariance = _mm_mul_ps(varianceSum, _mm_mul_ps(inverseWeight, inverseWeight));
+							_mm_storeu_ps(variances[target].data() + index,
+								_mm_or_ps(_mm_and_ps(isSurface, filteredVariance), _mm_andnot_ps(isSurface, _mm_loadu_ps(sourceVariances + index))));
+						}
+					}
+				});
+				source = target;
+			}
+
+			for (int y = 0; y < height; ++y)
+			{
+				for (int x = 0; x < width; ++x)
+				{
+					const size_t index = static_cast<size_t>(y + padding) * paddedWidth + x + padding;
+					if (surfaceIds[index] > Raytracing::SurfaceGuide::BACKGROUND)
+					{
+						frame.at(x, y) = glm_color_t(colors[source][0][index], colors[source][1][index], colors[source][2][index]);
+					}
+				}
+			}
+		}
+	}
+}
@@ -0,0 +1,99 @@
+#ifndef DENOISER_H
+#define DENOISER_H
+
+// Edge-aware filtering of the noise left by the few wavelengths traced per sample
+
+#include "stdafx.h"
+#include "GraphicsModel.h"
+#include "FrameBuffer.h"
+#include "ThreadPool.h"
+#include <cstdint>
+#include <vector>
+
+namespace Graphics
+{
+	namespace Raytracing
+	{
+		// Surface seen through the center of a pixel, written by the primary ray traced there
+		struct SurfaceGuide
+		{
+			// the pixel was not traced, as the ones reused from the last view
+			static constexpr uint32_t UNKNOWN = 0;
+			// the primary ray hit nothing
+			static constexpr uint32_t BACKGROUND = 1;
+
+			vec3 normal;
+			// distance from the camera to the surface
+			float depth;
+			// identifies the material of the object that is hit, the instance or the shape, and is above BACKGROUND
+			uint32_t surfaceId;
+			// variance of the color of the pixel, summed over the channels, due to the wavelengths of the first spectral split
+			// of its path, 0 when the path does not split
+			float variance;
+		};
+	}
+
+	namespace Rendering
+	{
+		// Parameters of the denoiser
+		struct DenoiserSettings
+		{
+			// number of passes of the filter, the pass i spacing its 5x5 taps by 2^i pixels
+			int iterations;
+			// colors differing from the center by that many standard deviations of its noise weigh e^-1 as much
+			// the pixels without noise keep their colors
+			float colorSigma;
+			// depths differing from the center by that fraction of its depth, at the spacing of the pass, weigh e^-1 as much
+			float depthSigma;
+			// normals weigh e^-(sharpness * (1 - cos)) as much, so that 64 halves the weight at 8 degrees
+			float normalSharpness;
+		};
+
+		// A-trous wavelet filter guided by the normal, the depth and the surface of every pixel, as in SVGF
+		// Two pixels are only blended when they see the same surface, and the color weights follow the noise
+		// estimated around each pixel, so the edges of the geometry, of the shadows and of the dispersed colors are kept
+		// Four pixels of a row are filtered at once with SSE, the rows are spread over the threads of the pool
+		class Denoiser
+		{
+		public:
+			DenoiserSettings settings;
+
+			Denoiser(const DenoiserSettings& settings = { 2, 1.f, 0.05f, 64.f }) :
+				settings(settings),
+				width(0),
+				height(0)
+			{}
+
+			// Forget the guides and size them for the frame about to be traced
+			void beginFrame(int width, int height);
+
+			// Guide of a pixel, row by row, written by the sample traced through its center
+			Raytracing::SurfaceGuide& guide(int pixel)
+			{
+				return guides[pixel];
+			}
+
+			// Filter the frame traced since the last call to beginFrame, or shaded again from its samples,
+			// whose pixels average frameCount frames traced as that one, which divides their variance
+			// The pixels without a guided surface are left as they are
+			void filter(FrameBuffer& frame, utilities::ThreadPool& pool, int frameCount = 1);
+
+		private:
+			int width;
+			int height;
+			std::vector<Raytracing::SurfaceGuide> guides;
+
+			// the planes hold the pixels row by row with a border wide enough for the widest pass,
+			// whose pixels are unknown so that they get no weight
+			int padding;
+			int paddedWidth;
+			std::vector<float> colors[2][3];
+			std::vector<float> variances[2];
+			std::vector<float> depths;
+			std::vector<float> normals[3];
+			std::vector<uint32_t> surfaceIds;
+		};
+	}
+}
+
+#endif
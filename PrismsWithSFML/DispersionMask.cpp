@@ -0,0 +1,76 @@
+#include "stdafx.h"
+#include "DispersionMask.h"
+#include "GraphicsFunctions.h"
+#include "Profiler.h"
+
+// Defines the functions declared in its DispersionMask.h
+// All the functions descriptions could be found there
+
+namespace Graphics
+{
+	namespace Rendering
+	{
+		bool DispersionMask::update(const Scene& scene, const Camera& camera, const Raytracing::TraceContext& context, utilities::ThreadPool& pool)
+		{
+			if (isValid && camera.hasSameView(lastCamera))
+			{
+				return false;
+			}
+			PROFILE_ZONE("Dispersion mask");
+
+			tilesX = (camera.screen.width + tileSize - 1) / tileSize;
+			tilesY = (camera.screen.height + tileSize - 1) / tileSize;
+			std::vector<char> probedTiles(tilesX * tilesY, false);
+
+			// PROBING
+			// a task handles a whole row of tiles so that no tile is written by two threads
+			pool.parallelFor(0, tilesY, 1, [&](int tileRowBegin, int tileRowEnd) {
+				const int rowEnd = std::min(tileRowEnd * tileSize, camera.screen.height);
+				for (int y = tileRowBegin * tileSize; y < rowEnd; y += probeStride)
+				{
+					for (int x = 0; x < camera.screen.width; x += probeStride)
+					{
+						char& tile = probedTiles[(y / tileSize) * tilesX + x / tileSize];
+						if (!tile)
+						{
+							const Raytracing::Ray ray = Raytracing::primaryRay(camera, x + 0.5f, y + 0.5f);
+							tile = Raytracing::Dispersion::reachesDispersiveMaterial(scene, ray, context, 0);
+						}
+					}
+				}
+			});
+
+			// DILATION
+			// the neighbouring tiles are added to catch the edges missed between the probes
+			dispersiveTiles.assign(tilesX * tilesY, false);
+			for (int tileY = 0; tileY < tilesY; ++tileY)
+			{
+				for (int tileX = 0; tileX < tilesX; ++tileX)
+				{
+					if (!probedTiles[tileY * tilesX + tileX])
+					{
+						continue;
+					}
+					for (int neighbourY = std::max(tileY - 1, 0); neighbourY <= std::min(tileY + 1, tilesY - 1); ++neighbourY)
+					{
+						for (int neighbourX = std::max(tileX - 1, 0); neighbourX <= std::min(tileX + 1, tilesX - 1); ++neighbourX)
+						{
+							dispersiveTiles[neighbourY * tilesX + neighbourX] = true;
+						}
+					}
+				}
+			}
+
+			lastCamera = camera;
+			isValid = true;
+			return true;
+		}
+
+		bool DispersionMask::isDispersive(float x, float y) const
+		{
+			const int tileX = std::min(std::max(static_cast<int>(x) / tileSize, 0), tilesX - 1);
+			const int tileY = std::min(std::max(static_cast<int>(y) / tileSize, 0), tilesY - 1);
+			return dispersiveTiles[tileY * tilesX + tileX] != 0;
+		}
+	}
+}
@@ -0,0 +1,58 @@
+#ifndef DISPERSION_MASK_H
+#define DISPERSION_MASK_H
+
+// Screen-space classification of the tiles that need the dispersive raytracing
+
+#include "stdafx.h"
+#include "GraphicsModel.h"
+#include "ThreadPool.h"
+
+namespace Graphics
+{
+	namespace Rendering
+	{
+		// Marks the screen tiles whose paths reach a dispersive material
+		// Outside of the mask, the dispersive and the non-dispersive raytracing give the same colors
+		// The classification is kept as long as the camera does not move
+		class DispersionMask
+		{
+		public:
+			// side of the square tiles, in pixels
+			const int tileSize;
+			// one probe ray every probeStride pixels in both directions
+			const int probeStride;
+
+			DispersionMask(int tileSize, int probeStride = 2) :
+				tileSize(tileSize),
+				probeStride(probeStride),
+				tilesX(0),
+				tilesY(0),
+				isValid(false),
+				lastCamera(vec3(0, 0, 0), 0, Screen{ 0, 0 })
+			{}
+
+			// Classify the tiles again if the camera moved since the last update or if the mask was invalidated
+			// The rows of tiles are probed in parallel by the pool
+			// Return true if the classification was computed again
+			bool update(const Scene& scene, const Camera& camera, const Raytracing::TraceContext& context, utilities::ThreadPool& pool);
+
+			// Force the classification at the next update, to be called when the scene geometry or materials change
+			void invalidate()
+			{
+				isValid = false;
+			}
+
+			// Return true if the floating point pixel coordinates (x,y) lie in a dispersive tile
+			bool isDispersive(float x, float y) const;
+
+		private:
+			int tilesX;
+			int tilesY;
+			std::vector<char> dispersiveTiles;
+			bool isValid;
+			Camera lastCamera;
+		};
+	}
+}
+
+#endif
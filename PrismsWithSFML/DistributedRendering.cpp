@@ -0,0 +1,364 @@
+#include "stdafx.h"
+#include "DistributedRendering.h"
+#include "GraphicsFunctions.h"
+#include "Socket.h"
+#include "Profiler.h"
+
+// Defines the functions declared in its DistributedRendering.h
+// All the functions descriptions could be found there
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+namespace Graphics
+{
+	namespace Rendering
+	{
+		namespace
+		{
+			// PROTOCOL
+			// every message is a header followed by its payload, the values are sent in the byte order of the hosts,
+			// which are expected to share it
+			enum class MessageType : uint32_t
+			{
+				// coordinator to worker: the view and the settings of the image, sent once at the connection
+				JOB = 1,
+				// coordinator to worker: a tile to trace
+				TILE = 2,
+				// worker to coordinator: the tile followed by its colors, row by row
+				RESULT = 3,
+				// coordinator to worker: no tile is left
+				DONE = 4
+			};
+
+			struct MessageHeader
+			{
+				uint32_t type;
+				uint32_t size;
+			};
+
+			struct JobMessage
+			{
+				float position[3];
+				float rotation[9];
+				float focal;
+				int32_t width;
+				int32_t height;
+				int32_t depthMax;
+				float minThroughput;
+				int32_t russianRoulette;
+				int32_t rouletteDepth;
+				int32_t stochasticInterfaces;
+				int32_t spectralSamples;
+				int32_t dispersionCones;
+				int32_t passes;
+			};
+
+			struct TileMessage
+			{
+				int32_t tileIndex;
+				int32_t xBegin;
+				int32_t yBegin;
+				int32_t xEnd;
+				int32_t yEnd;
+			};
+
+			bool sendMessage(utilities::Socket& socket, MessageType type, const void* payload, size_t size)
+			{
+				const MessageHeader header{ static_cast<uint32_t>(type), static_cast<uint32_t>(size) };
+				return socket.sendAll(&header, sizeof(header)) && (size == 0 || socket.sendAll(payload, size));
+			}
+
+			JobMessage makeJob(const Camera& camera, const Raytracing::TraceContext& context, int passes)
+			{
+				JobMessage job{};
+				for (int i = 0; i < 3; ++i)
+				{
+					job.position[i] = camera.position[i];
+					for (int j = 0; j < 3; ++j)
+					{
+						job.rotation[3 * i + j] = camera.rotationMatrix[i][j];
+					}
+				}
+				job.focal = camera.focal;
+				job.width = camera.screen.width;
+				job.height = camera.screen.height;
+				job.depthMax = context.depthMax;
+				job.minThroughput = context.minThroughput;
+				job.russianRoulette = context.russianRoulette;
+				job.rouletteDepth = context.rouletteDepth;
+				job.stochasticInterfaces = context.stochasticInterfaces;
+				job.spectralSamples = context.spectralSamples;
+				job.dispersionCones = context.dispersionCones;
+				job.passes = passes;
+				return job;
+			}
+
+			Camera jobCamera(const JobMessage& job)
+			{
+				Camera camera(vec3(job.position[0], job.position[1], job.position[2]), job.focal, Screen{ job.width, job.height });
+				for (int i = 0; i < 3; ++i)
+				{
+					for (int j = 0; j < 3; ++j)
+					{
+						camera.rotationMatrix[i][j] = job.rotation[3 * i + j];
+					}
+				}
+				return camera;
+			}
+
+			Raytracing::TraceContext jobContext(const JobMessage& job)
+			{
+				Raytracing::TraceContext context(job.depthMax, job.minThroughput, job.russianRoulette != 0, job.rouletteDepth, job.stochasticInterfaces != 0);
+				context.spectralSamples = job.spectralSamples;
+				context.dispersionCones = job.dispersionCones != 0;
+				return context;
+			}
+
+			// Tiles of the image shared by the connections of the coordinator
+			class TileQueue
+			{
+			public:
+				TileQueue(int tileCount) :
+					remainingTiles(tileCount),
+					isAborted(false)
+				{
+					for (int i = 0; i < tileCount; ++i)
+					{
+						pendingTiles.push_back(i);
+					}
+				}
+
+				// Return the next tile to trace, waiting while the traced ones may still be given back
+				// Return -1 once every tile is done or the rendering is aborted
+				int take()
+				{
+					std::unique_lock<std::mutex> lock(mutex);
+					tilesChanged.wait(lock, [this]() { return !pendingTiles.empty() || remainingTiles == 0 || isAborted; });
+					if (pendingTiles.empty() || isAborted)
+					{
+						return -1;
+					}
+					const int tile = pendingTiles.front();
+					pendingTiles.pop_front();
+					return tile;
+				}
+
+				// Give back the tile of a lost worker, it is handed out before the others
+				void giveBack(int tile)
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					pendingTiles.push_front(tile);
+					tilesChanged.notify_all();
+				}
+
+				void complete()
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					--remainingTiles;
+					tilesChanged.notify_all();
+				}
+
+				void abort()
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					isAborted = true;
+					tilesChanged.notify_all();
+				}
+
+				bool isFinished()
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					return remainingTiles == 0;
+				}
+
+			private:
+				std::deque<int> pendingTiles;
+				int remainingTiles;
+				bool isAborted;
+				std::mutex mutex;
+				std::condition_variable tilesChanged;
+			};
+
+			// Hand tiles to a connected worker until none is left or the worker is lost
+			void serveWorker(utilities::Socket socket, const JobMessage& job, const std::vector<TileMessage>& tiles, int tileTimeoutMs,
+				TileQueue& queue, FrameBuffer& frame)
+			{
+				socket.setReceiveTimeout(tileTimeoutMs);
+				if (!sendMessage(socket, MessageType::JOB, &job, sizeof(job)))
+				{
+					return;
+				}
+
+				std::vector<float> colors{};
+				for (int tileIndex = queue.take(); tileIndex >= 0; tileIndex = queue.take())
+				{
+					const TileMessage& tile = tiles[tileIndex];
+					const size_t colorsSize = 3 * sizeof(float) * (tile.xEnd - tile.xBegin) * (tile.yEnd - tile.yBegin);
+					colors.resize(colorsSize / sizeof(float));
+
+					// the tile is given back if anything but its expected result comes
+					MessageHeader header{};
+					TileMessage result{};
+					const bool isReceived = sendMessage(socket, MessageType::TILE, &tile, sizeof(tile))
+						&& socket.receiveAll(&header, sizeof(header))
+						&& header.type == static_cast<uint32_t>(MessageType::RESULT)
+						&& header.size == sizeof(result) + colorsSize
+						&& socket.receiveAll(&result, sizeof(result))
+						&& result.tileIndex == tile.tileIndex
+						&& socket.receiveAll(colors.data(), colorsSize);
+					if (!isReceived)
+					{
+						queue.giveBack(tileIndex);
+						return;
+					}
+
+					// the tiles do not overlap, so the threads write different pixels
+					const float* color = colors.data();
+					for (int y = tile.yBegin; y < tile.yEnd; ++y)
+					{
+						for (int x = tile.xBegin; x < tile.xEnd; ++x, color += 3)
+						{
+							frame.at(x, y) = glm_color_t(color[0], color[1], color[2]);
+						}
+					}
+					queue.complete();
+				}
+				sendMessage(socket, MessageType::DONE, nullptr, 0);
+			}
+		}
+
+		void renderDistributed(const Camera& camera, const Raytracing::TraceContext& context, const DistributedSettings& settings, FrameBuffer& frame)
+		{
+			utilities::Socket listener = utilities::Socket::listen(settings.port);
+
+			std::vector<TileMessage> tiles{};
+			for (int y = 0; y < camera.screen.height; y += settings.tileSize)
+			{
+				for (int x = 0; x < camera.screen.width; x += settings.tileSize)
+				{
+					const int tileIndex = static_cast<int>(tiles.size());
+					tiles.push_back(TileMessage{ tileIndex, x, y,
+						std::min(x + settings.tileSize, camera.screen.width), std::min(y + settings.tileSize, camera.screen.height) });
+				}
+			}
+
+			const JobMessage job = makeJob(camera, context, settings.passes);
+			TileQueue queue(static_cast<int>(tiles.size()));
+			std::atomic<int> connectedWorkers(0);
+			std::vector<std::thread> connections{};
+			auto lastWorkerTime = std::chrono::steady_clock::now();
+			bool isAborted = false;
+
+			// every worker is served by its own thread while this one accepts the new ones
+			while (!queue.isFinished())
+			{
+				utilities::Socket socket = listener.accept(100);
+				if (socket.isValid())
+				{
+					++connectedWorkers;
+					connections.emplace_back([&, socket = std::move(socket)]() mutable {
+						serveWorker(std::move(socket), job, tiles, settings.tileTimeoutMs, queue, frame);
+						--connectedWorkers;
+					});
+				}
+
+				const auto now = std::chrono::steady_clock::now();
+				if (connectedWorkers > 0)
+				{
+					lastWorkerTime = now;
+				}
+				else if (std::chrono::duration_cast<std::chrono::milliseconds>(now - lastWorkerTime).count() > settings.workerWaitTimeoutMs)
+				{
+					isAborted = true;
+					queue.abort();
+					break;
+				}
+			}
+
+			for (std::thread& connection : connections)
+			{
+				connection.join();
+			}
+			if (isAborted)
+			{
+				throw std::runtime_error("No worker connected on port " + std::to_string(settings.port) + " to trace the remaining tiles");
+			}
+		}
+
+		int runTileWorker(const Scene& scene, const std::string& host, uint16_t port, utilities::ThreadPool& pool)
+		{
+			utilities::Socket socket = utilities::Socket::connect(host, port);
+
+			MessageHeader header{};
+			JobMessage job{};
+			if (!socket.receiveAll(&header, sizeof(header))
+				|| header.type != static_cast<uint32_t>(MessageType::JOB)
+				|| header.size != sizeof(job)
+				|| !socket.receiveAll(&job, sizeof(job)))
+			{
+				throw std::runtime_error("The coordinator did not send the image to render");
+			}
+			const Camera camera = jobCamera(job);
+			std::vector<Raytracing::TraceContext> threadContexts(pool.threadCount(), jobContext(job));
+
+			int tileCount = 0;
+			std::vector<float> colors{};
+			TileMessage tile{};
+			// a lost coordinator ends the work like the end of the tiles
+			while (socket.receiveAll(&header, sizeof(header))
+				&& header.type == static_cast<uint32_t>(MessageType::TILE)
+				&& header.size == sizeof(tile)
+				&& socket.receiveAll(&tile, sizeof(tile)))
+			{
+				const int tileWidth = tile.xEnd - tile.xBegin;
+				colors.resize(3 * tileWidth * (tile.yEnd - tile.yBegin));
+				pool.parallelFor(tile.yBegin, tile.yEnd, 1, [&](int rowBegin, int rowEnd) {
+					PROFILE_ZONE("Trace tile rows");
+					Raytracing::TraceContext& context = threadContexts[pool.threadIndex()];
+					for (int y = rowBegin; y < rowEnd; ++y)
+					{
+						for (int x = tile.xBegin; x < tile.xEnd; ++x)
+						{
+							// the same passes as the progressive frames of the renderer, so that a pixel does not depend on the worker
+							const float sampleX = x + 0.5f;
+							const float sampleY = y + 0.5f;
+							const uint32_t seed = Sampling::sampleSeed(sampleX, sampleY);
+							glm_color_t color = COLOR_BLACK;
+							for (int pass = 0; pass < job.passes; ++pass)
+							{
+								context.seed(seed, static_cast<uint32_t>(pass));
+								const float offset = Sampling::radicalInverse(static_cast<uint32_t>(pass)) + Sampling::hash(seed) * (1.f / 4294967296.f);
+								context.spectralOffset = offset - std::floor(offset);
+								color += Raytracing::Dispersion::raytraceRecursiveWithDispersion(camera, scene, sampleX, sampleY, context);
+							}
+							color /= static_cast<float>(std::max(job.passes, 1));
+
+							float* pixel = &colors[3 * ((y - tile.yBegin) * tileWidth + x - tile.xBegin)];
+							pixel[0] = color.r;
+							pixel[1] = color.g;
+							pixel[2] = color.b;
+						}
+					}
+				});
+
+				const size_t colorsSize = colors.size() * sizeof(float);
+				const MessageHeader resultHeader{ static_cast<uint32_t>(MessageType::RESULT), static_cast<uint32_t>(sizeof(tile) + colorsSize) };
+				if (!socket.sendAll(&resultHeader, sizeof(resultHeader))
+					|| !socket.sendAll(&tile, sizeof(tile))
+					|| !socket.sendAll(colors.data(), colorsSize))
+				{
+					break;
+				}
+				++tileCount;
+			}
+			return tileCount;
+		}
+	}
+}
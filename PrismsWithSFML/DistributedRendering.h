@@ -0,0 +1,48 @@
+#ifndef DISTRIBUTED_RENDERING_H
+#define DISTRIBUTED_RENDERING_H
+
+// Spreads the tracing of a still image over worker processes, on the same host or on others
+// A coordinator cuts the frame into tiles and hands them to the workers connected to it over TCP,
+// every worker traces its tiles with the dispersive raytracing and sends their pixels back
+// The workers load the same scene as the coordinator, only the view and the settings are sent to them
+
+#include "stdafx.h"
+#include "GraphicsModel.h"
+#include "FrameBuffer.h"
+#include "ThreadPool.h"
+#include <cstdint>
+#include <string>
+
+namespace Graphics
+{
+	namespace Rendering
+	{
+		// Parameters of a distributed image
+		struct DistributedSettings
+		{
+			// port the coordinator listens on
+			uint16_t port;
+			// side of the square tiles, in pixels
+			int tileSize;
+			// number of passes with jittered wavelengths averaged in every pixel
+			int passes;
+			// a worker that has not sent its tile back after that long is considered lost, and its tile is given to another one
+			int tileTimeoutMs;
+			// the rendering fails once no worker has been connected for that long while tiles remain
+			int workerWaitTimeoutMs;
+		};
+
+		// Render the scene seen by the camera in the frame with the workers connecting to the port
+		// The tiles of a lost worker are handed again to the remaining ones and to the workers connecting later
+		// A pixel gets the same color whatever worker traces it, so the image does not depend on how the tiles were spread
+		// Throw std::runtime_error if the port cannot be listened on or if no worker is left for too long
+		void renderDistributed(const Camera& camera, const Raytracing::TraceContext& context, const DistributedSettings& settings, FrameBuffer& frame);
+
+		// Trace the tiles sent by the coordinator at host:port until it has no more of them
+		// The tiles are traced in parallel by the pool
+		// Return the number of tiles traced, throw std::runtime_error if the coordinator cannot be reached
+		int runTileWorker(const Scene& scene, const std::string& host, uint16_t port, utilities::ThreadPool& pool);
+	}
+}
+
+#endif
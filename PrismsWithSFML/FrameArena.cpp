@@ -0,0 +1,48 @@
+#include "stdafx.h"
+#include "FrameArena.h"
+
+// Defines the functions declared in its FrameArena.h
+// All the functions descriptions could be found there
+
+namespace utilities
+{
+	void* FrameArena::allocate(size_t size, size_t alignment)
+	{
+		while (currentBlock < blocks.size())
+		{
+			Block& block = blocks[currentBlock];
+			const uintptr_t start = reinterpret_cast<uintptr_t>(block.memory.get()) + offset;
+			const size_t padding = (alignment - start % alignment) % alignment;
+			if (offset + padding + size <= block.size)
+			{
+				offset += padding + size;
+				return reinterpret_cast<void*>(start + padding);
+			}
+
+			// the blocks after the current one hold nothing, one too small for the request is replaced
+			++currentBlock;
+			offset = 0;
+			if (currentBlock < blocks.size() && blocks[currentBlock].size < size + alignment)
+			{
+				const size_t newSize = std::max(blockSize, size + alignment);
+				blocks[currentBlock] = Block{ std::unique_ptr<char[]>(new char[newSize]), newSize };
+			}
+		}
+
+		const size_t newSize = std::max(blockSize, size + alignment);
+		blocks.push_back(Block{ std::unique_ptr<char[]>(new char[newSize]), newSize });
+		currentBlock = blocks.size() - 1;
+		offset = 0;
+		return allocate(size, alignment);
+	}
+
+	size_t FrameArena::capacity() const
+	{
+		size_t bytes = 0;
+		for (const Block& block : blocks)
+		{
+			bytes += block.size;
+		}
+		return bytes;
+	}
+}
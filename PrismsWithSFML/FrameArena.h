@@ -0,0 +1,162 @@
+#ifndef FRAME_ARENA_H
+#define FRAME_ARENA_H
+
+// Bump allocator for the scratch data of the tracing, owned by one thread
+// Allocating only moves an offset and the memory is given back all at once, so no lock nor heap call is needed once the blocks are there
+
+#include "stdafx.h"
+#include <cstddef>
+
+namespace utilities
+{
+	// Memory handed out from blocks that are kept from a frame to the next one
+	// Everything allocated after a marker is given back at once by rewinding to it
+	class FrameArena
+	{
+	public:
+		// position in the arena to rewind to
+		struct Marker
+		{
+			size_t blockIndex;
+			size_t offset;
+		};
+
+		explicit FrameArena(size_t blockSize = 64 * 1024) :
+			blockSize(blockSize),
+			currentBlock(0),
+			offset(0)
+		{}
+
+		// The blocks belong to a single arena: a copy starts empty and an assignment keeps the blocks of the assigned arena
+		FrameArena(const FrameArena& other) :
+			blockSize(other.blockSize),
+			currentBlock(0),
+			offset(0)
+		{}
+
+		FrameArena& operator=(const FrameArena& other)
+		{
+			blockSize = other.blockSize;
+			return *this;
+		}
+
+		// Return uninitialized memory, a new block is only allocated when the existing ones are full
+		void* allocate(size_t size, size_t alignment);
+
+		template<typename T>
+		T* allocate(size_t count)
+		{
+			return static_cast<T*>(allocate(count * sizeof(T), alignof(T)));
+		}
+
+		Marker mark() const
+		{
+			return Marker{ currentBlock, offset };
+		}
+
+		// Give back everything allocated since the marker
+		void rewind(const Marker& marker)
+		{
+			currentBlock = marker.blockIndex;
+			offset = marker.offset;
+		}
+
+		// Give back everything, the blocks are kept for the next frame
+		void reset()
+		{
+			rewind(Marker{ 0, 0 });
+		}
+
+		// Number of bytes held by the blocks
+		size_t capacity() const;
+
+	private:
+		struct Block
+		{
+			std::unique_ptr<char[]> memory;
+			size_t size;
+		};
+
+		size_t blockSize;
+		std::vector<Block> blocks;
+		size_t currentBlock;
+		size_t offset;
+	};
+
+	// Gives back, when it goes out of scope, what was allocated in the arena during its lifetime
+	class ArenaScope
+	{
+	public:
+		explicit ArenaScope(FrameArena& arena) :
+			arena(arena),
+			marker(arena.mark())
+		{}
+
+		~ArenaScope()
+		{
+			arena.rewind(marker);
+		}
+
+		ArenaScope(const ArenaScope&) = delete;
+		ArenaScope& operator=(const ArenaScope&) = delete;
+
+	private:
+		FrameArena& arena;
+		FrameArena::Marker marker;
+	};
+
+	// Allocator of the containers filled during the tracing
+	// Freeing does nothing, the memory comes back when the arena is rewound
+	template<typename T>
+	class ArenaAllocator
+	{
+	public:
+		typedef T value_type;
+
+		template<typename U>
+		struct rebind
+		{
+			typedef ArenaAllocator<U> other;
+		};
+
+		explicit ArenaAllocator(FrameArena& arena) :
+			arenaPtr(&arena)
+		{}
+
+		template<typename U>
+		ArenaAllocator(const ArenaAllocator<U>& other) :
+			arenaPtr(other.arenaPtr)
+		{}
+
+		T* allocate(size_t count)
+		{
+			return arenaPtr->allocate<T>(count);
+		}
+
+		void deallocate(T*, size_t)
+		{}
+
+		template<typename U>
+		bool operator==(const ArenaAllocator<U>& other) const
+		{
+			return arenaPtr == other.arenaPtr;
+		}
+
+		template<typename U>
+		bool operator!=(const ArenaAllocator<U>& other) const
+		{
+			return arenaPtr != other.arenaPtr;
+		}
+
+	private:
+		template<typename U>
+		friend class ArenaAllocator;
+
+		FrameArena* arenaPtr;
+	};
+
+	template<typename T>
+	using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+}
+
+#endif
@@ -0,0 +1,128 @@
+#include "stdafx.h"
+#include "FrameBudget.h"
+#include "Utilities.h"
+
+// Defines the functions declared in its FrameBudget.h
+// All the functions descriptions could be found there
+
+#include <cmath>
+
+namespace Graphics
+{
+	namespace Rendering
+	{
+		// The quality moves by steps of that size, so that it does not flicker with the noise of the measures
+		constexpr float QUALITY_STEP = 0.05f;
+
+		// Weight of the last frame in the smoothed time
+		constexpr float FRAME_TIME_SMOOTHING = 0.3f;
+
+		float FrameBudgetController::resolutionScale(float quality) const
+		{
+			return settings.minResolutionScale + quality * (1 - settings.minResolutionScale);
+		}
+
+		int FrameBudgetController::spectralSamples(float quality) const
+		{
+			return static_cast<int>(std::round(settings.minSpectralSamples + quality * (fullSpectralSamples - settings.minSpectralSamples)));
+		}
+
+		int FrameBudgetController::depth(float quality) const
+		{
+			return static_cast<int>(std::round(settings.minDepth + quality * (fullDepth - settings.minDepth)));
+		}
+
+		float FrameBudgetController::relativeCost(float quality) const
+		{
+			// the pixels count twice, the spectral splits are most of the cost of a dispersive pixel
+			const float scale = resolutionScale(quality);
+			return scale * scale
+				* static_cast<float>(spectralSamples(quality)) / fullSpectralSamples
+				* static_cast<float>(depth(quality)) / fullDepth;
+		}
+
+		void FrameBudgetController::render(Renderer& renderer, const Scene& scene, const Camera& camera, FrameBuffer& frame, bool isInteracting)
+		{
+			// QUALITY
+			// the highest quality whose expected time fits in the target
+			float nextQuality = 1;
+			if (isInteracting && msPerCost > 0)
+			{
+				while (nextQuality > 0 && relativeCost(nextQuality) * msPerCost > settings.targetMs)
+				{
+					nextQuality = std::max(nextQuality - QUALITY_STEP, 0.f);
+				}
+			}
+			if (nextQuality != quality)
+			{
+				// frames of different qualities are not averaged together
+				quality = nextQuality;
+				renderer.resetAccumulation();
+			}
+			// the photons keep their number per pixel, gathered on disks of the same size in pixels
+			const float scale = resolutionScale(quality);
+			renderer.context.spectralSamples = spectralSamples(quality);
+			renderer.context.depthMax = depth(quality);
+			renderer.sampler.settings.sampleBudget = static_cast<int>(fullSampleBudget * scale * scale);
+			renderer.caustics.photonCount = static_cast<int>(fullCaustics.photonCount * scale * scale);
+			renderer.caustics.gatherRadius = fullCaustics.gatherRadius / scale;
+
+			// RENDERING
+			// the scaled camera keeps the field of view of the screen
+			utilities::Stopwatch stopwatch;
+			if (scale < 1)
+			{
+				const Screen screen{
+					std::max(static_cast<int>(std::round(camera.screen.width * scale)), 1),
+					std::max(static_cast<int>(std::round(camera.screen.height * scale)), 1)
+				};
+				Camera scaledCamera(camera.position, camera.focal * screen.height / camera.screen.height, screen);
+				scaledCamera.rotationMatrix = camera.rotationMatrix;
+				if (lowResolutionFrame.width != screen.width || lowResolutionFrame.height != screen.height)
+				{
+					lowResolutionFrame = FrameBuffer(screen.width, screen.height);
+				}
+				renderer.render(scene, scaledCamera, lowResolutionFrame);
+				upscaleBilinear(lowResolutionFrame, frame);
+			}
+			else
+			{
+				renderer.render(scene, camera, frame);
+			}
+			const float frameMs = static_cast<float>(stopwatch.lap());
+
+			// MEASURE
+			// only the interactive frames are measured, the accumulated ones stop once converged
+			if (isInteracting)
+			{
+				const float measuredMsPerCost = frameMs / relativeCost(quality);
+				msPerCost = (msPerCost > 0) ? (1 - FRAME_TIME_SMOOTHING) * msPerCost + FRAME_TIME_SMOOTHING * measuredMsPerCost : measuredMsPerCost;
+			}
+		}
+
+		void upscaleBilinear(const FrameBuffer& source, FrameBuffer& target)
+		{
+			const float scaleX = static_cast<float>(source.width) / target.width;
+			const float scaleY = static_cast<float>(source.height) / target.height;
+			for (int y = 0; y < target.height; ++y)
+			{
+				// position of the target pixel center among the source pixel centers
+				const float sourceY = glm::clamp((y + 0.5f) * scaleY - 0.5f, 0.f, static_cast<float>(source.height - 1));
+				const int y0 = static_cast<int>(sourceY);
+				const int y1 = std::min(y0 + 1, source.height - 1);
+				const float weightY = sourceY - y0;
+				for (int x = 0; x < target.width; ++x)
+				{
+					const float sourceX = glm::clamp((x + 0.5f) * scaleX - 0.5f, 0.f, static_cast<float>(source.width - 1));
+					const int x0 = static_cast<int>(sourceX);
+					const int x1 = std::min(x0 + 1, source.width - 1);
+					const float weightX = sourceX - x0;
+
+					const glm_color_t top = (1 - weightX) * source.at(x0, y0) + weightX * source.at(x1, y0);
+					const glm_color_t bottom = (1 - weightX) * source.at(x0, y1) + weightX * source.at(x1, y1);
+					target.at(x, y) = (1 - weightY) * top + weightY * bottom;
+				}
+			}
+		}
+	}
+}
@@ -0,0 +1,80 @@
+#ifndef FRAME_BUDGET_H
+#define FRAME_BUDGET_H
+
+// Lowers the resolution, the spectral samples and the depth of the interactive frames so that they keep a target time
+
+#include "stdafx.h"
+#include "GraphicsModel.h"
+#include "FrameBuffer.h"
+#include "Renderer.h"
+
+namespace Graphics
+{
+	namespace Rendering
+	{
+		// Parameters of the frame budget
+		struct FrameBudgetSettings
+		{
+			// time a frame should take while the user interacts, in milliseconds
+			float targetMs;
+			// lowest quality: fraction of the screen resolution, number of wavelengths of a spectral split and recursion depth
+			float minResolutionScale;
+			int minSpectralSamples;
+			int minDepth;
+		};
+
+		// Chooses the quality of the frames from the time the previous ones took
+		// The quality goes from 0, the lowest settings, to 1, the full settings of the renderer
+		// The extra samples of the anti-aliasing and the photons of the caustics follow the number of pixels
+		class FrameBudgetController
+		{
+		public:
+			FrameBudgetSettings settings;
+
+			// The full quality is the one the renderer is set up with
+			FrameBudgetController(const FrameBudgetSettings& settings, const Renderer& fullQuality) :
+				settings(settings),
+				fullSpectralSamples(fullQuality.context.spectralSamples),
+				fullDepth(fullQuality.context.depthMax),
+				fullSampleBudget(fullQuality.sampler.settings.sampleBudget),
+				fullCaustics(fullQuality.caustics),
+				quality(1),
+				msPerCost(0),
+				lowResolutionFrame(0, 0)
+			{}
+
+			// Render the frame with the renderer
+			// While the user interacts, the quality is the highest one expected to fit in the target time,
+			// frames rendered below the screen resolution are upscaled to the frame
+			// Otherwise the full quality is restored so that the renderer accumulates the final image
+			void render(Renderer& renderer, const Scene& scene, const Camera& camera, FrameBuffer& frame, bool isInteracting);
+
+			float currentQuality() const
+			{
+				return quality;
+			}
+
+		private:
+			int fullSpectralSamples;
+			int fullDepth;
+			int fullSampleBudget;
+			Raytracing::PhotonMapSettings fullCaustics;
+			float quality;
+			// smoothed time of a frame of relative cost 1, 0 before the first measure
+			float msPerCost;
+			FrameBuffer lowResolutionFrame;
+
+			float resolutionScale(float quality) const;
+			int spectralSamples(float quality) const;
+			int depth(float quality) const;
+
+			// Cost of a frame relative to the full quality one
+			float relativeCost(float quality) const;
+		};
+
+		// Resize the source into the target with a bilinear filter
+		void upscaleBilinear(const FrameBuffer& source, FrameBuffer& target);
+	}
+}
+
+#endif
@@ -0,0 +1,78 @@
+#ifndef FRAME_BUFFER_H
+#define FRAME_BUFFER_H
+
+// Defines the image in which the renderer writes its floating point colors
+
+#include "stdafx.h"
+#include "GraphicsModel.h"
+
+namespace Graphics
+{
+	// Image of floating point colors stored row by row
+	class FrameBuffer
+	{
+	public:
+		int width;
+		int height;
+		std::vector<glm_color_t> pixels;
+
+		FrameBuffer(int width, int height) :
+			width(width),
+			height(height),
+			pixels(width * height, COLOR_BLACK)
+		{}
+
+		glm_color_t& at(int x, int y)
+		{
+			return pixels[y * width + x];
+		}
+
+		const glm_color_t& at(int x, int y) const
+		{
+			return pixels[y * width + x];
+		}
+	};
+
+	// Sums the frames rendered from the same point of view so that their average converges over time
+	class AccumulationBuffer
+	{
+	public:
+		FrameBuffer sum;
+		int frameCount;
+
+		AccumulationBuffer(int width, int height) :
+			sum(width, height),
+			frameCount(0)
+		{}
+
+		// forget the accumulated frames, and change the size of the buffer if needed
+		void reset(int width, int height)
+		{
+			sum.width = width;
+			sum.height = height;
+			sum.pixels.assign(width * height, COLOR_BLACK);
+			frameCount = 0;
+		}
+
+		void accumulate(const FrameBuffer& frame)
+		{
+			for (size_t i = 0; i < sum.pixels.size(); ++i)
+			{
+				sum.pixels[i] += frame.pixels[i];
+			}
+			++frameCount;
+		}
+
+		// write the average of the accumulated frames
+		void resolve(FrameBuffer& average) const
+		{
+			const float weight = 1.f / std::max(frameCount, 1);
+			for (size_t i = 0; i < sum.pixels.size(); ++i)
+			{
+				average.pixels[i] = weight * sum.pixels[i];
+			}
+		}
+	};
+}
+
+#endif
@@ -0,0 +1,431 @@
+#include "stdafx.h"
+#include "GeometryStore.h"
+
+// Defines the functions declared in its GeometryStore.h
+// All the functions descriptions could be found there
+
+#include "BVH.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#ifdef _WIN32
+// keeps windows.h from defining the min and max macros
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace Graphics
+{
+	namespace
+	{
+		// The sections of a chunk start on cache lines
+		constexpr size_t SECTION_ALIGNMENT = 64;
+
+		inline size_t alignUp(size_t size, size_t alignment)
+		{
+			return (size + alignment - 1) / alignment * alignment;
+		}
+
+		// Offsets of the sections of a chunk from its start, in the order wide nodes, nodes, primitive indices and triangles
+		// Return the size of the sections
+		size_t sectionOffsets(const StoredMesh& layout, size_t offsets[4])
+		{
+			const size_t sizes[4] = {
+				layout.wideNodeCount * sizeof(WideBVHNode),
+				layout.nodeCount * sizeof(BVHNode),
+				layout.primitiveIndexCount * sizeof(int),
+				layout.triangleCount * sizeof(Triangle) };
+			size_t offset = 0;
+			for (int i = 0; i < 4; ++i)
+			{
+				offsets[i] = offset;
+				offset = alignUp(offset + sizes[i], SECTION_ALIGNMENT);
+			}
+			return offset;
+		}
+
+		// Point the layout to its sections in the chunk starting at the base
+		void placeSections(const char* base, StoredMesh& layout)
+		{
+			size_t offsets[4];
+			sectionOffsets(layout, offsets);
+			layout.wideNodes = reinterpret_cast<const WideBVHNode*>(base + offsets[0]);
+			layout.nodes = reinterpret_cast<const BVHNode*>(base + offsets[1]);
+			layout.primitiveIndices = reinterpret_cast<const int*>(base + offsets[2]);
+			layout.triangles = reinterpret_cast<const Triangle*>(base + offsets[3]);
+		}
+
+#ifdef _WIN32
+		const intptr_t INVALID_FILE = reinterpret_cast<intptr_t>(INVALID_HANDLE_VALUE);
+
+		intptr_t openScratchFile(const std::string& path)
+		{
+			// the file is removed by the system once its handle is closed, even if the process dies
+			const HANDLE file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+				FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, nullptr);
+			return reinterpret_cast<intptr_t>(file);
+		}
+
+		void closeFile(intptr_t file)
+		{
+			CloseHandle(reinterpret_cast<HANDLE>(file));
+		}
+
+		bool writeAt(intptr_t file, uint64_t offset, const char* data, size_t size)
+		{
+			LARGE_INTEGER position{};
+			position.QuadPart = static_cast<LONGLONG>(offset);
+			if (!SetFilePointerEx(reinterpret_cast<HANDLE>(file), position, nullptr, FILE_BEGIN))
+			{
+				return false;
+			}
+			while (size > 0)
+			{
+				DWORD written = 0;
+				if (!WriteFile(reinterpret_cast<HANDLE>(file), data, static_cast<DWORD>(std::min(size, static_cast<size_t>(1 << 30))), &written, nullptr) || written == 0)
+				{
+					return false;
+				}
+				data += written;
+				size -= written;
+			}
+			return true;
+		}
+
+		void* mapView(intptr_t file, intptr_t& fileMapping, uint64_t offset, size_t size)
+		{
+			if (fileMapping == 0)
+			{
+				fileMapping = reinterpret_cast<intptr_t>(CreateFileMappingA(reinterpret_cast<HANDLE>(file), nullptr, PAGE_READONLY, 0, 0, nullptr));
+				if (fileMapping == 0)
+				{
+					return nullptr;
+				}
+			}
+			return MapViewOfFile(reinterpret_cast<HANDLE>(fileMapping), FILE_MAP_READ,
+				static_cast<DWORD>(offset >> 32), static_cast<DWORD>(offset & 0xffffffffu), size);
+		}
+
+		void unmapView(void* address, size_t)
+		{
+			UnmapViewOfFile(address);
+		}
+
+		// the views stay valid once the mapping they come from is closed
+		void closeFileMapping(intptr_t& fileMapping)
+		{
+			if (fileMapping != 0)
+			{
+				CloseHandle(reinterpret_cast<HANDLE>(fileMapping));
+				fileMapping = 0;
+			}
+		}
+
+		void adviseWillNeed(void* address, size_t size)
+		{
+#if _WIN32_WINNT >= 0x0602
+			WIN32_MEMORY_RANGE_ENTRY range{ address, size };
+			PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+#else
+			(void)address;
+			(void)size;
+#endif
+		}
+#else
+		const intptr_t INVALID_FILE = -1;
+
+		intptr_t openScratchFile(const std::string& path)
+		{
+			const int file = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+			// the name is removed at once, the file lives until its descriptor is closed
+			if (file >= 0)
+			{
+				::unlink(path.c_str());
+			}
+			return file;
+		}
+
+		void closeFile(intptr_t file)
+		{
+			::close(static_cast<int>(file));
+		}
+
+		bool writeAt(intptr_t file, uint64_t offset, const char* data, size_t size)
+		{
+			while (size > 0)
+			{
+				const ssize_t written = ::pwrite(static_cast<int>(file), data, size, static_cast<off_t>(offset));
+				if (written <= 0)
+				{
+					return false;
+				}
+				data += written;
+				size -= static_cast<size_t>(written);
+				offset += static_cast<uint64_t>(written);
+			}
+			return true;
+		}
+
+		void* mapView(intptr_t file, intptr_t&, uint64_t offset, size_t size)
+		{
+			void* address = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, static_cast<int>(file), static_cast<off_t>(offset));
+			return address == MAP_FAILED ? nullptr : address;
+		}
+
+		void unmapView(void* address, size_t size)
+		{
+			::munmap(address, size);
+		}
+
+		void closeFileMapping(intptr_t&)
+		{}
+
+		void adviseWillNeed(void* address, size_t size)
+		{
+			::madvise(address, size, MADV_WILLNEED);
+		}
+#endif
+	}
+
+	// View of a chunk in the address space, unmapped with its owner
+	class GeometryStore::Mapping
+	{
+	public:
+		void* const address;
+		const size_t size;
+		StoredMesh mesh;
+
+		Mapping(void* address, size_t size, const StoredMesh& layout) :
+			address(address),
+			size(size),
+			mesh(layout)
+		{
+			placeSections(static_cast<const char*>(address), mesh);
+		}
+
+		~Mapping()
+		{
+			unmapView(address, size);
+		}
+
+		Mapping(const Mapping&) = delete;
+		Mapping& operator=(const Mapping&) = delete;
+	};
+
+	GeometryStore::GeometryStore(const std::string& path, size_t residentBudget) :
+		file(openScratchFile(path)),
+		fileMapping(0),
+		fileSize(0),
+		residentBudget(residentBudget),
+		mappedBytes(0),
+		mappings(0),
+		clockHand(0)
+	{
+		if (file == INVALID_FILE)
+		{
+			throw std::runtime_error("The geometry file " + path + " could not be created");
+		}
+	}
+
+	GeometryStore::~GeometryStore()
+	{
+		chunks.clear();
+		closeFileMapping(fileMapping);
+		closeFile(file);
+	}
+
+	void GeometryStore::store(Mesh& mesh)
+	{
+		if (mesh.bvh.nodes.empty() && !mesh.triangles.empty())
+		{
+			Raytracing::buildMeshBVH(mesh);
+		}
+
+		std::vector<Material*> materials{};
+		for (const Triangle& triangle : mesh.triangles)
+		{
+			if (std::find(materials.begin(), materials.end(), triangle.material) == materials.end())
+			{
+				materials.push_back(triangle.material);
+			}
+		}
+		StoredMesh layout{};
+		layout.triangleCount = mesh.triangles.size();
+		layout.nodeCount = mesh.bvh.nodes.size();
+		layout.wideNodeCount = mesh.bvh.wideNodes.size();
+		layout.primitiveIndexCount = mesh.bvh.primitiveIndices.size();
+
+		// the chunk is padded so that the next one starts on the alignment
+		size_t offsets[4];
+		std::vector<char> buffer(sectionOffsets(layout, offsets));
+		const size_t size = alignUp(std::max(buffer.size(), static_cast<size_t>(1)), GEOMETRY_CHUNK_ALIGNMENT);
+		buffer.resize(size);
+		auto copySection = [&buffer](size_t offset, const void* data, size_t size) {
+			if (size > 0)
+			{
+				std::memcpy(buffer.data() + offset, data, size);
+			}
+		};
+		copySection(offsets[0], mesh.bvh.wideNodes.data(), layout.wideNodeCount * sizeof(WideBVHNode));
+		copySection(offsets[1], mesh.bvh.nodes.data(), layout.nodeCount * sizeof(BVHNode));
+		copySection(offsets[2], mesh.bvh.primitiveIndices.data(), layout.primitiveIndexCount * sizeof(int));
+		copySection(offsets[3], mesh.triangles.data(), layout.triangleCount * sizeof(Triangle));
+
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!writeAt(file, fileSize, buffer.data(), buffer.size()))
+		{
+			throw std::runtime_error("The geometry file could not be written, the disk may be full");
+		}
+		closeFileMapping(fileMapping);
+		chunks.emplace_back();
+		Chunk& chunk = chunks.back();
+		chunk.offset = fileSize;
+		chunk.size = size;
+		chunk.bounds = mesh.bvh.nodes.empty() ? BoundingBox{} : mesh.bvh.nodes[0].bounds;
+		chunk.materials = std::move(materials);
+		chunk.layout = layout;
+		fileSize += size;
+
+		// replaced by empty ones so that their memory is given back
+		mesh.storedChunk = static_cast<int>(chunks.size()) - 1;
+		std::vector<Triangle>().swap(mesh.triangles);
+		mesh.bvh = BVH{};
+	}
+
+	StoredMeshPin GeometryStore::acquire(int chunk)
+	{
+		// the chunk is pinned before its mapping is read, and the eviction unpublishes the mapping before it checks the pins,
+		// so either the thread reads the mapping while the eviction sees the pin, or it reads null and takes the mutex
+		Chunk& acquired = chunks[chunk];
+		acquired.acquisitions.fetch_add(1);
+		const Mapping* mappingPtr = acquired.publishedPtr.load();
+		if (mappingPtr == nullptr)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			try
+			{
+				if (acquired.mappingPtr == nullptr)
+				{
+					evict(acquired.size);
+					map(chunk);
+				}
+			}
+			catch (...)
+			{
+				acquired.releases.fetch_add(1, std::memory_order_release);
+				throw;
+			}
+			mappingPtr = acquired.mappingPtr.get();
+		}
+		return StoredMeshPin(&mappingPtr->mesh, &acquired.releases);
+	}
+
+	void GeometryStore::prefetch()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+
+		// the most acquired chunks that fit in the budget together
+		std::vector<int> order{};
+		std::vector<uint64_t> visitCounts(chunks.size());
+		for (int i = 0; i < static_cast<int>(chunks.size()); ++i)
+		{
+			const uint64_t acquisitions = chunks[i].acquisitions.load(std::memory_order_relaxed);
+			visitCounts[i] = acquisitions - chunks[i].prefetchedAcquisitions;
+			chunks[i].prefetchedAcquisitions = acquisitions;
+			if (visitCounts[i] > 0)
+			{
+				order.push_back(i);
+			}
+		}
+		std::stable_sort(order.begin(), order.end(), [&visitCounts](int a, int b) { return visitCounts[a] > visitCounts[b]; });
+		size_t plannedBytes = 0;
+		size_t plannedCount = 0;
+		for (; plannedCount < order.size() && plannedBytes + chunks[order[plannedCount]].size <= residentBudget; ++plannedCount)
+		{
+			plannedBytes += chunks[order[plannedCount]].size;
+		}
+		order.resize(plannedCount);
+
+		// the planned chunks already mapped are spared first, so that mapping the rest evicts the others
+		for (int i : order)
+		{
+			chunks[i].isReferenced = true;
+		}
+		for (int i : order)
+		{
+			Chunk& chunk = chunks[i];
+			if (chunk.mappingPtr == nullptr)
+			{
+				evict(chunk.size);
+				map(i);
+				adviseWillNeed(chunk.mappingPtr->address, chunk.size);
+			}
+		}
+	}
+
+	size_t GeometryStore::residentBytes() const
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return mappedBytes;
+	}
+
+	size_t GeometryStore::mapCount() const
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return mappings;
+	}
+
+	void GeometryStore::map(int chunk)
+	{
+		Chunk& mapped = chunks[chunk];
+		void* address = mapView(file, fileMapping, mapped.offset, mapped.size);
+		if (address == nullptr)
+		{
+			throw std::runtime_error("A chunk of the geometry file could not be mapped, the address space may be exhausted");
+		}
+		mapped.mappingPtr.reset(new Mapping(address, mapped.size, mapped.layout));
+		mapped.publishedPtr.store(mapped.mappingPtr.get());
+		mapped.isReferenced = true;
+		mappedBytes += mapped.size;
+		++mappings;
+	}
+
+	void GeometryStore::evict(size_t reservedBytes)
+	{
+		// two turns of the clock, the first one may only clear the references
+		for (size_t step = 0; step < 2 * chunks.size() && mappedBytes + reservedBytes > residentBudget; ++step)
+		{
+			Chunk& chunk = chunks[clockHand];
+			clockHand = (clockHand + 1) % chunks.size();
+			if (chunk.mappingPtr == nullptr)
+			{
+				continue;
+			}
+			const uint64_t acquisitions = chunk.acquisitions.load();
+			if (chunk.isReferenced || acquisitions != chunk.sweptAcquisitions)
+			{
+				chunk.isReferenced = false;
+				chunk.sweptAcquisitions = acquisitions;
+				continue;
+			}
+
+			// a thread pinning the chunk from now on reads no mapping and waits for the mutex,
+			// the ones that pinned it before are counted in the acquisitions read after
+			chunk.publishedPtr.store(nullptr);
+			if (chunk.acquisitions.load() == chunk.releases.load())
+			{
+				mappedBytes -= chunk.size;
+				chunk.mappingPtr.reset();
+			}
+			else
+			{
+				chunk.publishedPtr.store(chunk.mappingPtr.get());
+			}
+		}
+	}
+}
@@ -0,0 +1,216 @@
+#ifndef GEOMETRY_STORE_H
+#define GEOMETRY_STORE_H
+
+// Out of core storage of the meshes, mapped from a file while the rays need them
+
+#include "stdafx.h"
+#include "GraphicsModel.h"
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace Graphics
+{
+	// The chunks start on multiples of this size, the allocation granularity of Windows and a multiple of the pages
+	constexpr size_t GEOMETRY_CHUNK_ALIGNMENT = 65536;
+
+	// Triangles and hierarchy of a stored mesh, read straight from its mapped chunk
+	struct StoredMesh
+	{
+		const Triangle* triangles;
+		size_t triangleCount;
+		const BVHNode* nodes;
+		size_t nodeCount;
+		const WideBVHNode* wideNodes;
+		size_t wideNodeCount;
+		const int* primitiveIndices;
+		size_t primitiveIndexCount;
+	};
+
+	// Stored mesh of a mapped chunk, which stays mapped as long as the pin lives
+	// A pin is moved, not copied, and must not outlive its store
+	class StoredMeshPin
+	{
+	public:
+		StoredMeshPin() :
+			meshPtr(nullptr),
+			releasesPtr(nullptr)
+		{}
+
+		StoredMeshPin(const StoredMesh* meshPtr, std::atomic<uint64_t>* releasesPtr) :
+			meshPtr(meshPtr),
+			releasesPtr(releasesPtr)
+		{}
+
+		StoredMeshPin(StoredMeshPin&& other) noexcept :
+			meshPtr(other.meshPtr),
+			releasesPtr(other.releasesPtr)
+		{
+			other.meshPtr = nullptr;
+			other.releasesPtr = nullptr;
+		}
+
+		StoredMeshPin& operator=(StoredMeshPin&& other) noexcept
+		{
+			if (this != &other)
+			{
+				release();
+				meshPtr = other.meshPtr;
+				releasesPtr = other.releasesPtr;
+				other.meshPtr = nullptr;
+				other.releasesPtr = nullptr;
+			}
+			return *this;
+		}
+
+		StoredMeshPin(const StoredMeshPin&) = delete;
+		StoredMeshPin& operator=(const StoredMeshPin&) = delete;
+
+		~StoredMeshPin()
+		{
+			release();
+		}
+
+		const StoredMesh& operator*() const
+		{
+			return *meshPtr;
+		}
+
+		const StoredMesh* operator->() const
+		{
+			return meshPtr;
+		}
+
+		explicit operator bool() const
+		{
+			return meshPtr != nullptr;
+		}
+
+	private:
+		const StoredMesh* meshPtr;
+		// releases of the chunk, which stays pinned while they are fewer than its acquisitions
+		std::atomic<uint64_t>* releasesPtr;
+
+		void release()
+		{
+			// the reads of the chunk happen before the store sees the release
+			if (releasesPtr != nullptr)
+			{
+				releasesPtr->fetch_add(1, std::memory_order_release);
+			}
+		}
+	};
+
+	// Keeps the meshes of a scene larger than the memory in a scratch file, one page aligned chunk per mesh
+	// holding its triangles and its bottom level hierarchy, and maps the chunks when the rays reach their instances
+	// The chunks beyond the resident budget are unmapped once no thread uses them anymore, the ones acquired since the last
+	// sweep of the clock getting a second chance, so that a scene only gets slower as it grows instead of running out of memory
+	// The threads pin a mapped chunk with its atomic counters, only a chunk that is not mapped takes the mutex
+	// The materials of the triangles are stored as pointers, so the file is only valid for the process that wrote it
+	// The setup and the writes throw std::runtime_error
+	// The meshes are stored before the rays acquire them, then the chunks can be acquired by several threads at once
+	class GeometryStore
+	{
+	public:
+		// Create the scratch file at the path, it is removed with the store
+		GeometryStore(const std::string& path, size_t residentBudget);
+		~GeometryStore();
+
+		GeometryStore(const GeometryStore&) = delete;
+		GeometryStore& operator=(const GeometryStore&) = delete;
+
+		// Move the triangles and the hierarchy of the mesh to a new chunk and free their memory
+		// The hierarchy is built first if the mesh has none, so a loader can store its meshes one by one as it reads them
+		void store(Mesh& mesh);
+
+		// Map the chunk if it is not, and return its mesh pinned
+		// The chunk stays mapped as long as the returned pin lives
+		StoredMeshPin acquire(int chunk);
+
+		// Bounds of the mesh of a chunk in its own space, kept in memory
+		const BoundingBox& bounds(int chunk) const
+		{
+			return chunks[chunk].bounds;
+		}
+
+		// Materials used by the triangles of the mesh of a chunk, kept in memory
+		const std::vector<Material*>& materials(int chunk) const
+		{
+			return chunks[chunk].materials;
+		}
+
+		// Map ahead the chunks the rays acquired the most since the last call, most acquired first and within the budget,
+		// and start reading their pages, then count the acquisitions again
+		// Called before every frame, it brings back what the last frame needed before the rays wait for it
+		void prefetch();
+
+		// Bytes of the chunks mapped at the moment, which may exceed the budget while all of them are in use
+		size_t residentBytes() const;
+
+		// Bytes written in the file
+		size_t storedBytes() const
+		{
+			return static_cast<size_t>(fileSize);
+		}
+
+		// Number of times a chunk was mapped, the ones of the prefetching included
+		size_t mapCount() const;
+
+		int chunkCount() const
+		{
+			return static_cast<int>(chunks.size());
+		}
+
+	private:
+		class Mapping;
+
+		struct Chunk
+		{
+			uint64_t offset = 0;
+			size_t size = 0;
+			BoundingBox bounds;
+			std::vector<Material*> materials;
+			// sizes of the sections of the chunk, the pointers of the layout being null
+			StoredMesh layout{};
+			// null while the chunk is not mapped, changed under the mutex
+			std::unique_ptr<Mapping> mappingPtr;
+			// mapping read by the threads without the mutex, null while the chunk is not mapped or is being evicted
+			std::atomic<Mapping*> publishedPtr{ nullptr };
+			// the chunk is pinned while it was acquired more often than released
+			std::atomic<uint64_t> acquisitions{ 0 };
+			std::atomic<uint64_t> releases{ 0 };
+			// acquisitions at the last prefetching, and when the clock last passed the chunk
+			uint64_t prefetchedAcquisitions = 0;
+			uint64_t sweptAcquisitions = 0;
+			// spared by the next sweep of the clock
+			bool isReferenced = false;
+		};
+
+		// native file handle, an int on POSIX and a HANDLE on Windows
+		intptr_t file;
+		// native handle of the mapping of the whole file on Windows, created again once the file grew
+		intptr_t fileMapping;
+		uint64_t fileSize;
+		size_t residentBudget;
+		size_t mappedBytes;
+		size_t mappings;
+		// a deque keeps the counters of the chunks in place as it grows
+		std::deque<Chunk> chunks;
+		// next chunk considered by the eviction
+		size_t clockHand;
+		mutable std::mutex mutex;
+
+		// Map the chunk, the mutex being locked
+		void map(int chunk);
+
+		// Unmap the chunks that no thread uses, the ones acquired since the last sweep once spared,
+		// until the budget leaves room for the reserved bytes, the mutex being locked
+		void evict(size_t reservedBytes);
+	};
+}
+
+#endif
@@ -1,5 +1,9 @@
 #include "stdafx.h"
 #include "GraphicsFunctions.h"
+#include "PhotonMap.h"
+#include "ShadingCache.h"
+#include "Denoiser.h"
+#include "Profiler.h"
 
 // Defines the functions declared in its GraphicsFunctions.h
 // All the functions descriptions could be found there
@@ -38,27 +42,61 @@ namespace Graphics
         return std::max(glm::dot(v1, v2), 0.0f);
     }
 
-    void Interpolate(const float a, const float b, vector<float>& result)
+    namespace Raytracing
     {
-        int N = result.size();
-        float step = float(b - a) / float(std::max(N - 1, 1));
+        // Position in the shading records of the context, the records added after it belong to the branch being traced
+        inline size_t recordMark(const TraceContext& context)
+        {
+            return context.shadingRecorderPtr == nullptr ? 0 : context.shadingRecorderPtr->mark();
+        }
 
-        float current = a;
-        for (float& pixelResult : result)
+        // Weight the shading points recorded since the mark by the factor of their branch in the color
+        inline void weightRecords(TraceContext& context, size_t mark, const glm_color_t& factor)
         {
-            pixelResult = current;
-            current += step;
+            if (context.shadingRecorderPtr != nullptr)
+            {
+                context.shadingRecorderPtr->weight(mark, factor);
+            }
+        }
+
+        // Record the shading point of the intersection with what its illumination is computed from
+        inline void recordShading(TraceContext& context, const Intersection& intersection, const vec3& lightDirection, float lightAttenuation, const glm_color_t& causticColor)
+        {
+            if (context.shadingRecorderPtr != nullptr)
+            {
+                context.shadingRecorderPtr->records.push_back(ShadingRecord{ glm_color_t(1, 1, 1), intersection.normal, intersection.rayPtr->direction,
+                    lightDirection, intersection.materialPtr, lightAttenuation, causticColor });
+            }
+        }
+
+        void recordGuide(TraceContext& context, const Intersection* intersectionPtr)
+        {
+            if (context.primaryGuidePtr == nullptr)
+            {
+                return;
+            }
+            if (intersectionPtr == nullptr)
+            {
+                *context.primaryGuidePtr = SurfaceGuide{ vec3(0, 0, 0), 0, SurfaceGuide::BACKGROUND, 0 };
+            }
+            else
+            {
+                const void* objectPtr = intersectionPtr->instancePtr != nullptr ? static_cast<const void*>(intersectionPtr->instancePtr) : intersectionPtr->shapePtr;
+                const uint32_t surfaceId = Sampling::hash(static_cast<uint32_t>(reinterpret_cast<uintptr_t>(intersectionPtr->materialPtr))
+                    ^ Sampling::hash(static_cast<uint32_t>(reinterpret_cast<uintptr_t>(objectPtr))));
+                *context.primaryGuidePtr = SurfaceGuide{ intersectionPtr->normal, intersectionPtr->distance,
+                    surfaceId > SurfaceGuide::BACKGROUND ? surfaceId : surfaceId + 2, 0 };
+                // the first spectral split of the path writes how much its wavelengths disagree
+                context.spectralVariancePtr = &context.primaryGuidePtr->variance;
+            }
+            context.primaryGuidePtr = nullptr;
         }
-        return;
-    }
 
-    namespace Raytracing
-    {
 
         glm_color_t lambertianIllumination(const Intersection& intersection, const glm_color_t& ambiantLight, const glm_color_t& directLight, const vec3& lightDirection)
         {
-            const Material* materialPtr = intersection.trianglePtr->material;
-            const glm::vec3 n = intersection.trianglePtr->normal;
+            const Material* materialPtr = intersection.materialPtr;
+            const glm::vec3 n = intersection.normal;
             const float cosAngle = positiveCos(lightDirection, n);
 
             return materialPtr->color * (materialPtr->ambiantCoeff * ambiantLight + materialPtr->diffuseCoeff * directLight * cosAngle);
@@ -67,9 +105,9 @@ namespace Graphics
 
         glm_color_t phongIllumination(const Intersection& intersection, const glm_color_t& ambiantLight, const glm_color_t& directLight, const vec3& lightDirection)
         {
-            const Material* materialPtr = intersection.trianglePtr->material;
+            const Material* materialPtr = intersection.materialPtr;
             const glm::vec3 viewDirection = intersection.rayPtr->direction;
-            const glm::vec3 n = intersection.trianglePtr->normal;
+            const glm::vec3 n = intersection.normal;
             const vec3 reflectedDirection = glm::reflect(lightDirection, n);
 
             const glm_color_t lambertianPart = lambertianIllumination(intersection, ambiantLight, directLight, lightDirection);
@@ -81,9 +119,9 @@ namespace Graphics
 
         glm_color_t blinnPhongIllumination(const Intersection& intersection, const glm_color_t& ambiantLight, const glm_color_t& directLight, const vec3& lightDirection)
         {
-            const Material* materialPtr = intersection.trianglePtr->material;
+            const Material* materialPtr = intersection.materialPtr;
             const glm::vec3 viewDirection = intersection.rayPtr->direction;
-            const glm::vec3 n = intersection.trianglePtr->normal;
+            const glm::vec3 n = intersection.normal;
             const vec3 halwayDirection = glm::normalize(lightDirection + viewDirection);
 
             const glm_color_t lambertianPart = lambertianIllumination(intersection, ambiantLight, directLight, lightDirection);
@@ -93,54 +131,114 @@ namespace Graphics
         }
 
 
-        glm_color_t refractedLight(const Scene& scene, const Intersection& intersection, const Ray& incidentRay, const int depthMax, const int depth)
+        DielectricInterface dielectricInterface(const vec3& incidentDirection, const vec3& normal, float refractiveIndex)
         {
-            auto normal = intersection.trianglePtr->normal;
-            float refractiveRatio{};
-            //exterior normals assumption
-            if (glm::dot(incidentRay.direction, normal) <= 0)
+            DielectricInterface interface{};
+
+            //exterior normals assumption: the ray enters the material when it goes against the normal
+            float cosIncident = -glm::dot(incidentDirection, normal);
+            vec3 facingNormal = normal;
+            float incidentIndex = 1.f;
+            float transmittedIndex = refractiveIndex;
+            if (cosIncident < 0)
             {
-                refractiveRatio = 1 / intersection.trianglePtr->material->refractiveIndex;
+                cosIncident = -cosIncident;
+                facingNormal = -normal;
+                std::swap(incidentIndex, transmittedIndex);
             }
-            else
+
+            interface.reflectedDirection = glm::reflect(incidentDirection, facingNormal);
+
+            // Snell's law, checked before refracting to detect total internal reflection
+            const float refractiveRatio = incidentIndex / transmittedIndex;
+            const float sinTransmittedSquared = refractiveRatio * refractiveRatio * (1 - cosIncident * cosIncident);
+            if (sinTransmittedSquared >= 1)
             {
-                refractiveRatio = intersection.trianglePtr->material->refractiveIndex;
+                interface.totalInternalReflection = true;
+                interface.reflectance = 1;
+                return interface;
             }
-            const Ray refractedRay(intersection.position, glm::refract(incidentRay.direction, normal, refractiveRatio));
-            auto refractedLightColor = raytrace_recursive_call(scene, refractedRay, depthMax, depth + 1);
-            
-            return refractedLightColor;
+            interface.refractedDirection = glm::refract(incidentDirection, facingNormal, refractiveRatio);
+
+            // Fresnel equations for unpolarized light
+            const float cosTransmitted = sqrt(1 - sinTransmittedSquared);
+            const float reflectionS = (incidentIndex * cosIncident - transmittedIndex * cosTransmitted) / (incidentIndex * cosIncident + transmittedIndex * cosTransmitted);
+            const float reflectionP = (transmittedIndex * cosIncident - incidentIndex * cosTransmitted) / (transmittedIndex * cosIncident + incidentIndex * cosTransmitted);
+            interface.reflectance = (reflectionS * reflectionS + reflectionP * reflectionP) / 2;
+
+            return interface;
         }
 
 
-        vector<Intersection> FindIntersections(const Ray& ray, const vector<Triangle>& triangles)
+        void selectInterfaceBranch(TraceContext& context, float& reflectionWeight, float& refractionWeight)
         {
-            vector<Intersection> intersectionsList{};
+            if (!context.stochasticInterfaces || reflectionWeight <= 0 || refractionWeight <= 0)
+            {
+                return;
+            }
+
+            // the kept branch carries the weight of both so that the result stays unbiased
+            const float reflectionProbability = reflectionWeight / (reflectionWeight + refractionWeight);
+            if (context.uniform() < reflectionProbability)
+            {
+                reflectionWeight /= reflectionProbability;
+                refractionWeight = 0;
+            }
+            else
+            {
+                refractionWeight /= 1 - reflectionProbability;
+                reflectionWeight = 0;
+            }
+        }
 
-            float distance{};
-            vec3 pointIntersection{};
 
-            //try to find an intersection for each triangle of the input vector
-            for (const Triangle& triangle : triangles)
+        glm_color_t refractedLight(const Scene& scene, const Intersection& intersection, const DielectricInterface& interface, float weight, TraceContext& context, const int depth)
+        {
+            if (interface.totalInternalReflection)
             {
-                if (TryIntersection(ray, triangle, distance, pointIntersection))
-                {
-                    if (distance > EPSILON) {
-                        auto intersection = Intersection{ pointIntersection, distance, &triangle, &ray };
-                        intersectionsList.push_back(intersection);
-                    }
-                }
+                return COLOR_BLACK;
             }
-            return intersectionsList;
+
+            const float continuation = pathContinuationFactor(context, weight, depth + 1);
+            if (continuation == 0)
+            {
+                return COLOR_BLACK;
+            }
+
+            const Ray refractedRay(intersection.position, interface.refractedDirection, weight * continuation);
+            const size_t refractionMark = recordMark(context);
+            auto refractedLightColor = raytrace_recursive_call(scene, refractedRay, context, depth + 1);
+            weightRecords(context, refractionMark, glm_color_t(continuation));
+            
+            return continuation * refractedLightColor;
         }
 
 
-        Intersection ClosestIntersection(vector<Intersection>& intersectionsList)
+        float pathContinuationFactor(TraceContext& context, float weight, const int depth)
         {
-            return *std::min_element(intersectionsList.begin(), intersectionsList.end(),
-                [](Intersection& a, Intersection& b) {
-                    return a.distance < b.distance;
-                });
+            if (depth >= context.depthMax || weight <= 0)
+            {
+                return 0;
+            }
+            if (weight >= context.minThroughput)
+            {
+                return 1;
+            }
+
+            // the branch would bring a negligible contribution
+            if (!context.russianRoulette)
+            {
+                return 0;
+            }
+            if (depth < context.rouletteDepth)
+            {
+                return 1;
+            }
+
+            // russian roulette: the branch survives with a probability proportional to its weight
+            // and its contribution is divided by that probability to stay unbiased
+            const float survivalProbability = weight / context.minThroughput;
+            return (context.uniform() < survivalProbability) ? 1 / survivalProbability : 0;
         }
 
 
@@ -187,30 +285,81 @@ namespace Graphics
         }
 
 
-        glm_color_t DirectLight(const Intersection& i, const vector<Triangle>& triangles, const Light& light) 
+        glm_color_t DirectLight(const Intersection& i, const Scene& scene, const Light& light) 
         {
+            return light.color * directLightAttenuation(i, scene, light);
+        }
+
+        float directLightAttenuation(const Intersection& i, const Scene& scene, const Light& light)
+        {
+            PROFILE_DETAIL_ZONE("Shadow ray");
             const glm::vec3 l = light.getIncidentRayDirection(i.position);
             Ray ray(light.pos, l);
             
             float lightToPointDistance = light.getDistance(i.position);
 
-            auto intersectionList = FindIntersections(ray, triangles);
-            if (intersectionList.size() > 0)
+            Intersection closestIntersec{};
+            if (FindClosestIntersection(scene, ray, closestIntersec))
             {
                 //equation for illumination
-                auto closestIntersec = ClosestIntersection(intersectionList);
                 // Check if the intersection point is the closest one to the light along the ray
                 // Otherwise, cast no light : Direct shadows
                 if (fabs(closestIntersec.distance - lightToPointDistance) > EPSILON)
                 {
-                    return COLOR_BLACK;
+                    return 0;
                 }
             }
 
-            const glm::vec3 n{ i.trianglePtr->normal };
+            const glm::vec3 n{ i.normal };
             const float cosAngle{ std::max(glm::dot(glm::normalize(l), n), 0.0f) };
 
-            return light.color * light.falloff(i.position);
+            return light.falloff(i.position);
+        }
+
+        glm_color_t causticIllumination(const Intersection& intersection, const TraceContext& context)
+        {
+            const Material* materialPtr = intersection.materialPtr;
+            if (context.photonMapPtr == nullptr || materialPtr->diffuseCoeff <= 0)
+            {
+                return COLOR_BLACK;
+            }
+            return materialPtr->color * materialPtr->diffuseCoeff * context.photonMapPtr->irradiance(intersection.position, intersection.normal);
+        }
+
+        Ray primaryRay(const Camera& camera, float x, float y)
+        {
+            vec3 dirRayFromPixel(x - camera.screen.width / 2, y - camera.screen.height / 2, camera.focal);
+            return Ray(camera.position, camera.rotationMatrix * dirRayFromPixel);
+        }
+
+        Frustum tileFrustum(const Camera& camera, float xBegin, float yBegin, float xEnd, float yEnd)
+        {
+            const vec3 corners[4] = {
+                primaryRay(camera, xBegin, yBegin).direction,
+                primaryRay(camera, xEnd, yBegin).direction,
+                primaryRay(camera, xEnd, yEnd).direction,
+                primaryRay(camera, xBegin, yEnd).direction
+            };
+            const vec3 center = primaryRay(camera, 0.5f * (xBegin + xEnd), 0.5f * (yBegin + yEnd)).direction;
+
+            // each plane holds the rays of an edge of the tile, its normal is turned towards the center of the tile
+            Frustum frustum{};
+            frustum.apex = camera.position;
+            for (int i = 0; i < 4; ++i)
+            {
+                const vec3 normal = glm::cross(corners[i], corners[(i + 1) % 4]);
+                frustum.normals[i] = glm::dot(normal, center) < 0 ? -normal : normal;
+            }
+            return frustum;
+        }
+
+        bool FindTracedIntersection(const Scene& scene, const Ray& ray, const TraceContext& context, const int depth, Intersection& closestOut)
+        {
+            if (depth == 0 && context.primaryCandidatesPtr != nullptr)
+            {
+                return FindClosestIntersection(scene, *context.primaryCandidatesPtr, ray, closestOut);
+            }
+            return FindClosestIntersection(scene, ray, closestOut);
         }
 
         glm_color_t raytrace(const Camera& camera, const Scene& scene, int x, int y)
@@ -222,10 +371,9 @@ namespace Graphics
 
             Graphics::Raytracing::Ray rayFromPixel(camera.position, camera.rotationMatrix * dirRayFromPixel);
 
-            auto intersectionList = FindIntersections(rayFromPixel, scene.polygons);
-            if (intersectionList.size() > 0)
+            Intersection closestIntersection{};
+            if (FindClosestIntersection(scene, rayFromPixel, closestIntersection))
             {
-                auto closestIntersection = ClosestIntersection(intersectionList);
                 //equation for illumination
                 vec3 incidentRayDir = scene.lightSource.getIncidentRayDirection(closestIntersection.position);
                 color = lambertianIllumination(closestIntersection, scene.ambiantLight, scene.lightSource.color, incidentRayDir);
@@ -234,58 +382,80 @@ namespace Graphics
         }
 
 
-        glm_color_t raytraceRecursive(const Camera& camera, const Scene& scene, int x, int y, const int depthMax)
+        glm_color_t raytraceRecursive(const Camera& camera, const Scene& scene, float x, float y, TraceContext& context)
         {
             int depth = 0;
             glm_color_t color = Graphics::COLOR_BLACK;
 
-            vec3 dirRayFromPixel(x - camera.screen.width / 2, y - camera.screen.height / 2, camera.focal);
-            Graphics::Raytracing::Ray rayFromPixel(camera.position, camera.rotationMatrix * dirRayFromPixel);
+            const Ray rayFromPixel = primaryRay(camera, x, y);
 
-            return raytrace_recursive_call(scene, rayFromPixel, depthMax, depth);
+            return raytrace_recursive_call(scene, rayFromPixel, context, depth);
         }
 
 
-        glm_color_t raytrace_recursive_call(const Scene& scene, const Ray& incomingRay, const int depthMax, const int depth)
+        glm_color_t raytrace_recursive_call(const Scene& scene, const Ray& incomingRay, TraceContext& context, const int depth)
         {
             // compute the direct light color at the end
-            if (depth >= depthMax)
+            if (depth >= context.depthMax)
             {
                 return Graphics::COLOR_BLACK;
             }
 
             //looking for intersection
-            auto intersectionList = FindIntersections(incomingRay, scene.polygons);
-            if (intersectionList.size() > 0)
+            Intersection closestIntersection{};
+            const bool isHit = FindTracedIntersection(scene, incomingRay, context, depth, closestIntersection);
+            recordGuide(context, isHit ? &closestIntersection : nullptr);
+            if (isHit)
             {
-                auto closestIntersection = ClosestIntersection(intersectionList);
-                auto normal = closestIntersection.trianglePtr->normal;
-
+                auto normal = closestIntersection.normal;
+                const Material* materialPtr = closestIntersection.materialPtr;
+
+                // SPLIT BETWEEN REFLECTION AND REFRACTION
+                float reflectionWeight = materialPtr->reflectionCoeff;
+                float refractionWeight = 0;
+                DielectricInterface interface{};
+                if (materialPtr->refractionCoeff > 0)
+                {
+                    interface = dielectricInterface(incomingRay.direction, normal, materialPtr->refractiveIndex);
+                    reflectionWeight += materialPtr->refractionCoeff * interface.reflectance;
+                    refractionWeight = materialPtr->refractionCoeff * (1 - interface.reflectance);
+                }
+                selectInterfaceBranch(context, reflectionWeight, refractionWeight);
 
                 // REFLECTION
                 glm_color_t reflectedLightColor = Graphics::COLOR_BLACK;
-                if (closestIntersection.trianglePtr->material->reflectionCoeff > 0)
+                const float reflectionThroughput = incomingRay.throughput * reflectionWeight;
+                const float reflectionContinuation = pathContinuationFactor(context, reflectionThroughput, depth + 1);
+                if (reflectionContinuation > 0)
                 {
-                    const Ray reflectedRay(closestIntersection.position, glm::reflect(incomingRay.direction, normal));
-                    auto reflectedLightColor = raytrace_recursive_call(scene, reflectedRay, depthMax, depth + 1);
+                    const Ray reflectedRay(closestIntersection.position, glm::reflect(incomingRay.direction, normal), reflectionThroughput * reflectionContinuation);
+                    const size_t reflectionMark = recordMark(context);
+                    reflectedLightColor = reflectionContinuation * raytrace_recursive_call(scene, reflectedRay, context, depth + 1);
+                    weightRecords(context, reflectionMark, glm_color_t(reflectionWeight * reflectionContinuation));
                 }
 
                 // REFRACTION
                 glm_color_t refractedLightColor = Graphics::COLOR_BLACK;
-                if (closestIntersection.trianglePtr->material->refractionCoeff > 0)
+                if (refractionWeight > 0)
                 {
-                    refractedLightColor = refractedLight(scene, closestIntersection, incomingRay, depthMax, depth);
+                    const size_t refractionMark = recordMark(context);
+                    refractedLightColor = refractedLight(scene, closestIntersection, interface, incomingRay.throughput * refractionWeight, context, depth);
+                    weightRecords(context, refractionMark, glm_color_t(refractionWeight));
                 }
 
                 // DIRECT ILLUMINATION
-                auto originLightColor = DirectLight(closestIntersection, scene.polygons, scene.lightSource);
+                const float lightAttenuation = directLightAttenuation(closestIntersection, scene, scene.lightSource);
+                auto originLightColor = scene.lightSource.color * lightAttenuation;
                 vec3 lightDir = -scene.lightSource.getIncidentRayDirection(closestIntersection.position);
-                auto illuminationColor = phongIllumination(closestIntersection, scene.ambiantLight, originLightColor, lightDir);
+                const glm_color_t causticColor = causticIllumination(closestIntersection, context);
+                auto illuminationColor = phongIllumination(closestIntersection, scene.ambiantLight, originLightColor, lightDir)
+                    + causticColor;
+                recordShading(context, closestIntersection, lightDir, lightAttenuation, causticColor);
 
                 // ADDING TOGETHER
                 auto color = illuminationColor
-                    + closestIntersection.trianglePtr->material->reflectionCoeff * reflectedLightColor
-                    + closestIntersection.trianglePtr->material->refractionCoeff * refractedLightColor;
+                    + reflectionWeight * reflectedLightColor
+                    + refractionWeight * refractedLightColor;
                 return color;
             }
             // no object found
@@ -295,115 +465,345 @@ namespace Graphics
 
         namespace Dispersion
         {
-            glm_color_t raytraceRecursiveWithDispersion(const Camera& camera, const Scene& scene, int x, int y, const int depthMax)
+            glm_color_t raytraceRecursiveWithDispersion(const Camera& camera, const Scene& scene, float x, float y, TraceContext& context)
             {
                 int depth = 0;
                 glm_color_t color = Graphics::COLOR_BLACK;
 
-                vec3 dirRayFromPixel(x - camera.screen.width / 2, y - camera.screen.height / 2, camera.focal);
-                RayWave rayFromPixel(camera.position, camera.rotationMatrix * dirRayFromPixel);
+                // the scratch data of the spectral splits is given back once the sample is traced
+                utilities::ArenaScope scratch(context.arena);
+
+                const Ray primary = primaryRay(camera, x, y);
+                RayWave rayFromPixel(primary.start, primary.direction);
 
                 //The first normal ray is assumed to be polychromatic
                 rayFromPixel.isMonochromatic = false;
-                return recursive_raytracing_with_dispersion_call(scene, rayFromPixel, depthMax, depth);
+                return recursive_raytracing_with_dispersion_call(scene, rayFromPixel, context, depth);
             }
 
-            glm_color_t refractedLightWithDispersion(const Scene& scene, const Intersection& intersection, const RayWave& incidentRayWave, const int depthMax, const int depth)
+            glm_color_t refractedLightWithDispersion(const Scene& scene, const Intersection& intersection, const RayWave& incidentRayWave, const DielectricInterface& interface, TraceContext& context, const int depth, const Intersection* knownHitPtr)
             {
-                auto normal = intersection.trianglePtr->normal;
-
-                float refractiveRatio{};
-                //exterior normals assumption
-                if (glm::dot(incidentRayWave.direction, normal) <= 0)
+                if (interface.totalInternalReflection)
                 {
-                    refractiveRatio = 1 / intersection.trianglePtr->material->cauchyRefractiveIndex(incidentRayWave.wavelength);
+                    return COLOR_BLACK;
                 }
-                else
+
+                // the refracted ray keeps the wavelength of the incident ray
+                const float weight = incidentRayWave.throughput * spectralWeight(incidentRayWave);
+                const float continuation = pathContinuationFactor(context, weight, depth + 1);
+                if (continuation == 0)
                 {
-                    refractiveRatio = intersection.trianglePtr->material->cauchyRefractiveIndex(incidentRayWave.wavelength);
+                    return COLOR_BLACK;
                 }
-                RayWave refractedRay(intersection.position, glm::refract(incidentRayWave.direction, normal, refractiveRatio));
+
+                RayWave refractedRay(intersection.position, interface.refractedDirection, weight * continuation);
                 refractedRay.isMonochromatic = true;
                 refractedRay.wavelength = incidentRayWave.wavelength;
-                auto refractedLightColor = recursive_raytracing_with_dispersion_call(scene, refractedRay, depthMax, depth + 1);
-
-                return refractedLightColor;
+                const size_t refractionMark = recordMark(context);
+                glm_color_t refractedLightColor{};
+                if (knownHitPtr == nullptr)
+                {
+                    refractedLightColor = recursive_raytracing_with_dispersion_call(scene, refractedRay, context, depth + 1);
+                }
+                else
+                {
+                    // intersection with the plane of the known triangle
+                    Intersection hit = *knownHitPtr;
+                    hit.distance = dot(knownHitPtr->position - refractedRay.start, knownHitPtr->normal) / dot(refractedRay.direction, knownHitPtr->normal);
+                    hit.position = refractedRay.pointOnRay(hit.distance);
+                    hit.rayPtr = &refractedRay;
+                    refractedLightColor = shadeIntersectionWithDispersion(scene, hit, refractedRay, context, depth + 1);
+                }
+                weightRecords(context, refractionMark, glm_color_t(continuation));
+                return continuation * refractedLightColor;
             }
 
-            glm_color_t recursive_raytracing_with_dispersion_call(const Scene& scene, const RayWave& incidentRayWave, const int depthMax, const int depth)
+            glm_color_t recursive_raytracing_with_dispersion_call(const Scene& scene, const RayWave& incidentRayWave, TraceContext& context, const int depth)
             {
                 // compute the direct light color at the end
-                if (depth >= depthMax)
+                if (depth >= context.depthMax)
                 {
                     return Graphics::COLOR_BLACK;
                 }
 
                 //looking for intersection
-                auto intersectionList = FindIntersections(incidentRayWave, scene.polygons);
-                if (intersectionList.size() > 0)
+                Intersection closestIntersection{};
+                const bool isHit = FindTracedIntersection(scene, incidentRayWave, context, depth, closestIntersection);
+                recordGuide(context, isHit ? &closestIntersection : nullptr);
+                if (isHit)
                 {
-                    auto closestIntersection = ClosestIntersection(intersectionList);
-                    auto normal = closestIntersection.trianglePtr->normal;
-
+                    return shadeIntersectionWithDispersion(scene, closestIntersection, incidentRayWave, context, depth);
+                }
+                // no object found
+                return Graphics::COLOR_BLACK;
+            }
 
-                    // REFLECTION
-                    glm_color_t reflectedLightColor = Graphics::COLOR_BLACK;
-                    if (closestIntersection.trianglePtr->material->reflectionCoeff > 0)
+            glm_color_t shadeIntersectionWithDispersion(const Scene& scene, const Intersection& closestIntersection, const RayWave& incidentRayWave, TraceContext& context, const int depth)
+            {
+                auto normal = closestIntersection.normal;
+                const Material* materialPtr = closestIntersection.materialPtr;
+
+                // SPLIT BETWEEN REFLECTION AND REFRACTION
+                // a polychromatic ray is split into monochromatic rays when it enters a dispersive material
+                // otherwise the ray keeps its wavelength, if any, to compute the interface
+                const int nbInterpolation = context.spectralSamples;
+                const bool isSpectrumSplit = !incidentRayWave.isMonochromatic && materialPtr->isDispersive();
+                utilities::ArenaVector<float> wavelengths{ utilities::ArenaAllocator<float>(context.arena) };
+                utilities::ArenaVector<DielectricInterface> spectralInterfaces{ utilities::ArenaAllocator<DielectricInterface>(context.arena) };
+                DielectricInterface interface{};
+
+                float reflectionWeight = materialPtr->reflectionCoeff;
+                float refractionWeight = 0;
+                float reflectance{};
+                if (materialPtr->refractionCoeff > 0)
+                {
+                    if (isSpectrumSplit)
                     {
-                        RayWave reflectedRay(closestIntersection.position, glm::reflect(incidentRayWave.direction, normal));
-                        if (incidentRayWave.isMonochromatic)
+                        // Stratified sampling of wavelengths
+                        wavelengths.resize(nbInterpolation);
+                        stratifiedWavelengths(context.spectralOffset, wavelengths);
+
+                        // each wavelength has its own reflectance, the reflected ray carries the average
+                        spectralInterfaces.reserve(nbInterpolation);
+                        for (float wavelength : wavelengths)
                         {
-                            reflectedRay.isMonochromatic = true;
-                            reflectedRay.wavelength = incidentRayWave.wavelength;
+                            spectralInterfaces.push_back(dielectricInterface(incidentRayWave.direction, normal, materialPtr->cauchyRefractiveIndex(wavelength)));
+                            reflectance += spectralInterfaces.back().reflectance / nbInterpolation;
                         }
-                        auto reflectedLightColor = recursive_raytracing_with_dispersion_call(scene, reflectedRay, depthMax, depth + 1);
                     }
+                    else
+                    {
+                        const float refractiveIndex = incidentRayWave.isMonochromatic ? materialPtr->cauchyRefractiveIndex(incidentRayWave.wavelength) : materialPtr->refractiveIndex;
+                        interface = dielectricInterface(incidentRayWave.direction, normal, refractiveIndex);
+                        reflectance = interface.reflectance;
+                    }
+                    reflectionWeight += materialPtr->refractionCoeff * reflectance;
+                    refractionWeight = materialPtr->refractionCoeff * (1 - reflectance);
+                }
+                selectInterfaceBranch(context, reflectionWeight, refractionWeight);
+
+                // REFLECTION
+                // the shading points of the branches are recorded after this mark, and the one of the intersection last
+                const size_t reflectionMark = recordMark(context);
+                glm_color_t reflectedLightColor = Graphics::COLOR_BLACK;
+                const float reflectionThroughput = incidentRayWave.throughput * reflectionWeight * spectralWeight(incidentRayWave);
+                const float reflectionContinuation = pathContinuationFactor(context, reflectionThroughput, depth + 1);
+                if (reflectionContinuation > 0)
+                {
+                    RayWave reflectedRay(closestIntersection.position, glm::reflect(incidentRayWave.direction, normal), reflectionThroughput * reflectionContinuation);
+                    if (incidentRayWave.isMonochromatic)
+                    {
+                        reflectedRay.isMonochromatic = true;
+                        reflectedRay.wavelength = incidentRayWave.wavelength;
+                    }
+                    reflectedLightColor = reflectionContinuation * recursive_raytracing_with_dispersion_call(scene, reflectedRay, context, depth + 1);
+                    weightRecords(context, reflectionMark, glm_color_t(reflectionWeight * reflectionContinuation));
+                }
 
-                    // REFRACTION
-                    glm_color_t refractedLightColor = Graphics::COLOR_BLACK;
-                    if (closestIntersection.trianglePtr->material->refractionCoeff > 0)
+                // REFRACTION
+                glm_color_t refractedLightColor = Graphics::COLOR_BLACK;
+                if (refractionWeight > 0)
+                {
+                    const size_t refractionMark = recordMark(context);
+                    if (!isSpectrumSplit)
+                    {
+                        refractedLightColor = refractedLight(scene, closestIntersection, interface, incidentRayWave.throughput * refractionWeight, context, depth);
+                    }
+                    else
                     {
-                        // check out if the ray is already monochromatic or if the material is non-dispersive
-                        if (incidentRayWave.isMonochromatic || (closestIntersection.trianglePtr->material->refractiveIndex == 1))
+                        PROFILE_DETAIL_ZONE("Spectral split");
+                        // when the whole cone of refracted rays lands on one triangle, the rays are not traced one by one
+                        Intersection coneTarget{};
+                        const bool isConeCoherent = context.dispersionCones && dispersionConeTarget(scene, closestIntersection, spectralInterfaces, context.arena, coneTarget);
+                        // the deeper splits leave the variance of the pixel to this one
+                        float* variancePtr = context.spectralVariancePtr;
+                        context.spectralVariancePtr = nullptr;
+                        const float count = static_cast<float>(nbInterpolation);
+                        glm_color_t squaredEstimates = Graphics::COLOR_BLACK;
+                        for (size_t i = 0; i < wavelengths.size(); ++i)
                         {
-                            refractedLightColor = refractedLight(scene, closestIntersection, incidentRayWave, depthMax, depth);
+                            // share of the transmitted light carried by this wavelength, none on total internal reflection
+                            const float share = (1 - spectralInterfaces[i].reflectance) / ((1 - reflectance) * nbInterpolation);
+
+                            //additive color mixing
+                            auto monochromaticIncidentRay = RayWave(incidentRayWave, wavelengths[i]);
+                            monochromaticIncidentRay.throughput *= refractionWeight * share;
+                            const size_t wavelengthMark = recordMark(context);
+                            const glm_color_t wavelengthColor = share * refractedLightWithDispersion(scene, closestIntersection, monochromaticIncidentRay, spectralInterfaces[i], context, depth, isConeCoherent ? &coneTarget : nullptr);
+                            refractedLightColor += wavelengthColor;
+                            squaredEstimates += (count * wavelengthColor) * (count * wavelengthColor);
+                            weightRecords(context, wavelengthMark, glm_color_t(share));
                         }
-                        else
+                        // every wavelength scaled by their number estimates the refracted light, whose variance is the one of their mean
+                        // it reaches the pixel weighted as the refracted light
+                        if (variancePtr != nullptr && nbInterpolation > 1)
                         {
-                            // Interpolation of wavelengths
-                            const int nbInterpolation = 10;
-                            vector<float> wavelengths{};
-                            wavelengths.resize(nbInterpolation);
-                            Interpolate(VISIBLE_SPECTRUM_START, VISIBLE_SPECTRUM_END, wavelengths);
-
-                            for (float wavelength : wavelengths)
-                            {
-                                //additive color mixing
-                                auto monochromaticIncidentRay = RayWave(incidentRayWave, wavelength);
-                                refractedLightColor += refractedLightWithDispersion(scene, closestIntersection, monochromaticIncidentRay, depthMax, depth);
-                            }
-                            refractedLightColor /= nbInterpolation; //energy preservation
+                            const glm_color_t variance = glm::max(squaredEstimates - count * refractedLightColor * refractedLightColor, Graphics::COLOR_BLACK)
+                                / (count * (count - 1));
+                            const float pixelWeight = incidentRayWave.throughput * refractionWeight;
+                            *variancePtr = pixelWeight * pixelWeight * (variance.r + variance.g + variance.b);
                         }
                     }
+                    weightRecords(context, refractionMark, glm_color_t(refractionWeight));
+                }
 
-                    // DIRECT ILLUMINATION
-                    auto originLightColor = DirectLight(closestIntersection, scene.polygons, scene.lightSource);
-                    vec3 lightDir = -scene.lightSource.getIncidentRayDirection(closestIntersection.position);
-                    auto illuminationColor = phongIllumination(closestIntersection, scene.ambiantLight, originLightColor, lightDir);
+                // DIRECT ILLUMINATION
+                const float lightAttenuation = directLightAttenuation(closestIntersection, scene, scene.lightSource);
+                auto originLightColor = scene.lightSource.color * lightAttenuation;
+                vec3 lightDir = -scene.lightSource.getIncidentRayDirection(closestIntersection.position);
+                const glm_color_t causticColor = causticIllumination(closestIntersection, context);
+                auto illuminationColor = phongIllumination(closestIntersection, scene.ambiantLight, originLightColor, lightDir)
+                    + causticColor;
+                recordShading(context, closestIntersection, lightDir, lightAttenuation, causticColor);
 
-                    // ADDING TOGETHER
-                    auto color = illuminationColor
-                        + closestIntersection.trianglePtr->material->reflectionCoeff * reflectedLightColor
-                        + closestIntersection.trianglePtr->material->refractionCoeff * refractedLightColor;
-                    if (incidentRayWave.isMonochromatic)
+                // ADDING TOGETHER
+                auto color = illuminationColor
+                    + reflectionWeight * reflectedLightColor
+                    + refractionWeight * refractedLightColor;
+                if (incidentRayWave.isMonochromatic)
+                {
+                    auto wavelengthColor = WavelengthRGBFilter(incidentRayWave.wavelength);
+                    color *= wavelengthColor;
+                    weightRecords(context, reflectionMark, wavelengthColor);
+                }
+                return color;
+            }
+
+            bool reachesDispersiveMaterial(const Scene& scene, const Ray& ray, const TraceContext& context, const int depth)
+            {
+                if (depth >= context.depthMax)
+                {
+                    return false;
+                }
+
+                Intersection closestIntersection{};
+                if (!FindClosestIntersection(scene, ray, closestIntersection))
+                {
+                    return false;
+                }
+                auto normal = closestIntersection.normal;
+                const Material* materialPtr = closestIntersection.materialPtr;
+                if (materialPtr->isDispersive())
+                {
+                    return true;
+                }
+
+                // branches below the threshold may still be traced with random choices
+                const float smallestWeight = (context.russianRoulette || context.stochasticInterfaces) ? 0 : context.minThroughput;
+
+                float reflectionWeight = materialPtr->reflectionCoeff;
+                float refractionWeight = 0;
+                DielectricInterface interface{};
+                if (materialPtr->refractionCoeff > 0)
+                {
+                    interface = dielectricInterface(ray.direction, normal, materialPtr->refractiveIndex);
+                    reflectionWeight += materialPtr->refractionCoeff * interface.reflectance;
+                    refractionWeight = materialPtr->refractionCoeff * (1 - interface.reflectance);
+                }
+
+                const float reflectionThroughput = ray.throughput * reflectionWeight;
+                if (reflectionThroughput > 0 && reflectionThroughput >= smallestWeight)
+                {
+                    const Ray reflectedRay(closestIntersection.position, glm::reflect(ray.direction, normal), reflectionThroughput);
+                    if (reachesDispersiveMaterial(scene, reflectedRay, context, depth + 1))
                     {
-                        auto wavelengthColor = WavelengthRGBFilter(incidentRayWave.wavelength);
-                        color *= wavelengthColor;
+                        return true;
                     }
-                    return color;
                 }
-                // no object found
-                return Graphics::COLOR_BLACK;
+
+                const float refractionThroughput = ray.throughput * refractionWeight;
+                if (!interface.totalInternalReflection && refractionThroughput > 0 && refractionThroughput >= smallestWeight)
+                {
+                    const Ray refractedRay(closestIntersection.position, interface.refractedDirection, refractionThroughput);
+                    return reachesDispersiveMaterial(scene, refractedRay, context, depth + 1);
+                }
+                return false;
+            }
+
+            // Return true if the segment [a,b] crosses the triangle, its end points excluded
+            inline bool segmentCrossesTriangle(const vec3& a, const vec3& b, const Triangle& triangle)
+            {
+                const Ray segment(a, b - a);
+                float distance{};
+                vec3 point{};
+                return TryIntersection(segment, triangle, distance, point)
+                    && EPSILON < distance && distance < glm::length(b - a) - EPSILON;
+            }
+
+            bool dispersionConeTarget(const Scene& scene, const Intersection& splitIntersection, const utilities::ArenaVector<DielectricInterface>& spectralInterfaces, utilities::FrameArena& arena, Intersection& targetOut)
+            {
+                // the refracted rays exist for a contiguous range of wavelengths, the others are totally reflected
+                auto first = std::find_if(spectralInterfaces.begin(), spectralInterfaces.end(),
+                    [](const DielectricInterface& interface) { return !interface.totalInternalReflection; });
+                auto last = std::find_if(spectralInterfaces.rbegin(), spectralInterfaces.rend(),
+                    [](const DielectricInterface& interface) { return !interface.totalInternalReflection; });
+                if (first == spectralInterfaces.end() || std::distance(first, last.base()) < 3)
+                {
+                    return false;
+                }
+
+                // both extreme rays must hit the same triangle, the curved surfaces of the shapes are left to the rays traced one by one
+                const vec3& apex = splitIntersection.position;
+                const Ray firstRay(apex, first->refractedDirection);
+                const Ray lastRay(apex, last->refractedDirection);
+                Intersection firstHit{};
+                Intersection lastHit{};
+                if (!FindClosestIntersection(scene, firstRay, firstHit) || !FindClosestIntersection(scene, lastRay, lastHit)
+                    || firstHit.shapePtr != nullptr || firstHit.triangleIndex != lastHit.triangleIndex || firstHit.instancePtr != lastHit.instancePtr)
+                {
+                    return false;
+                }
+
+                // the target is convex so the rays in between hit it too, unless another triangle crosses the swept triangle
+                // two triangles intersect only if an edge of one crosses the other, and the extreme rays are already free
+                // the shapes are not tested against the swept triangle, any of them close to it may stand in the way
+                const Triangle sweptTriangle(apex, firstHit.position, lastHit.position, nullptr);
+                if (anyShapeInBox(scene, triangleBounds(sweptTriangle)))
+                {
+                    return false;
+                }
+                utilities::ArenaVector<SceneTriangle> neighbours{ utilities::ArenaAllocator<SceneTriangle>(arena) };
+                FindTrianglesInBox(scene, triangleBounds(sweptTriangle), neighbours);
+                for (const SceneTriangle& neighbour : neighbours)
+                {
+                    const bool isTarget = neighbour.sourceIndex == firstHit.triangleIndex && neighbour.instancePtr == firstHit.instancePtr;
+                    const bool isSplitTriangle = neighbour.sourceIndex == splitIntersection.triangleIndex && neighbour.instancePtr == splitIntersection.instancePtr;
+                    if (isTarget || isSplitTriangle)
+                    {
+                        continue;
+                    }
+                    const Triangle& triangle = neighbour.triangle;
+                    if (segmentCrossesTriangle(triangle.v0, triangle.v1, sweptTriangle)
+                        || segmentCrossesTriangle(triangle.v1, triangle.v2, sweptTriangle)
+                        || segmentCrossesTriangle(triangle.v2, triangle.v0, sweptTriangle)
+                        || segmentCrossesTriangle(firstHit.position, lastHit.position, triangle))
+                    {
+                        return false;
+                    }
+                }
+
+                targetOut = firstHit;
+                targetOut.rayPtr = nullptr;
+                return true;
+            }
+
+            void stratifiedWavelengths(float offset, utilities::ArenaVector<float>& result)
+            {
+                const float stratumWidth = (VISIBLE_SPECTRUM_END - VISIBLE_SPECTRUM_START) / result.size();
+                for (size_t i = 0; i < result.size(); ++i)
+                {
+                    result[i] = VISIBLE_SPECTRUM_START + (i + offset) * stratumWidth;
+                }
+            }
+
+            float spectralWeight(const RayWave& rayWave)
+            {
+                if (!rayWave.isMonochromatic)
+                {
+                    return 1;
+                }
+                const glm_color_t filter = WavelengthRGBFilter(rayWave.wavelength);
+                return std::max(filter.r, std::max(filter.g, filter.b));
             }
 
             glm_color_t WavelengthRGBFilter(float wavelength)
@@ -5,6 +5,7 @@
 
 #include "stdafx.h"
 #include "GraphicsModel.h"
+#include "BVH.h"
 
 using std::vector;
 
@@ -37,28 +38,55 @@ namespace Graphics
 		// compute a color according to Blinn-Phong Illumination Model
 		glm_color_t blinnPhongIllumination(const Intersection& intersection, const glm_color_t& ambiantLight, const glm_color_t& directLight, const vec3& lightDirection);
 
-		// compute the refracted light at an intersection
-		glm_color_t refractedLight(const Scene& scene, const Intersection& intersection, const Ray& incidentRay, const int depthMax, const int depth);
+		// compute how a ray is reflected and refracted when hitting a dielectric material of a given refractive index
+		// total internal reflection is detected before any refracted direction is computed
+		DielectricInterface dielectricInterface(const vec3& incidentDirection, const vec3& normal, float refractiveIndex);
 
-		// Returns the list of the intersections along a ray
-		vector<Intersection> FindIntersections(const Ray& ray, const vector<Triangle>& triangles);
+		// keep only one of the reflected and refracted branches when the context uses stochastic interfaces
+		// the branch is chosen according to the weights, which are updated accordingly
+		void selectInterfaceBranch(TraceContext& context, float& reflectionWeight, float& refractionWeight);
 
-		// Returns the closest intersection assuming that all intersection share the same ray
-		Intersection ClosestIntersection(vector<Intersection>& intersectionsList);
+		// compute the refracted light at an intersection for a ray of a given throughput
+		glm_color_t refractedLight(const Scene& scene, const Intersection& intersection, const DielectricInterface& interface, float weight, TraceContext& context, const int depth);
+
+		// Decide whether a branch of a given weight spawned at a given depth is traced
+		// Return 0 if the branch is skipped, otherwise the factor to apply to its throughput and its color
+		float pathContinuationFactor(TraceContext& context, float weight, const int depth);
 
 		// Returns true if an intersection with a triangle is found along the ray
 		// Fills out the distance as lambdaOut and the intersection point as pointOut
 		bool TryIntersection(const Ray& ray, const Triangle& triangle, float& lambdaOut, glm::vec3& pointOut);
 
 		// Compute the color of a point directly illuminated by a light source Light
-		glm_color_t DirectLight(const Intersection& i, const vector<Triangle>& triangles, const Light& light);
+		glm_color_t DirectLight(const Intersection& i, const Scene& scene, const Light& light);
+
+		// Return the fraction of the color of a light source Light reaching the point, 0 in the shadow
+		float directLightAttenuation(const Intersection& i, const Scene& scene, const Light& light);
+
+		// Compute the color of a diffuse point lit by the caustic photons of the context, if any
+		glm_color_t causticIllumination(const Intersection& intersection, const TraceContext& context);
+
+		// Return the ray leaving the camera through the floating point pixel coordinates (x,y)
+		Ray primaryRay(const Camera& camera, float x, float y);
+
+		// Return the frustum of the rays leaving the camera through the rectangle of floating point pixel coordinates
+		Frustum tileFrustum(const Camera& camera, float xBegin, float yBegin, float xEnd, float yEnd);
+
+		// Write the surface hit by the primary ray in the guide of the context, the intersection being null when it hits nothing
+		// The material and the object hit make the surface, so that the triangles of a face are blended together
+		void recordGuide(TraceContext& context, const Intersection* intersectionPtr);
+
+		// Find the closest intersection of a ray traced at a given depth
+		// The primary rays are only intersected with the candidates of the context, if it has any
+		bool FindTracedIntersection(const Scene& scene, const Ray& ray, const TraceContext& context, const int depth, Intersection& closestOut);
 
 		// Return the color of the pixel according to raytracing
 		glm_color_t raytrace(const Camera& camera, const Scene& scene, int x, int y);
 
 		// Return the color of the pixel according to recursive raytracing
-		glm_color_t raytraceRecursive(const Camera& camera, const Scene& scene, int x, int y, const int depthMax);
-		glm_color_t raytrace_recursive_call(const Scene& scene, const Ray& incomingRay, const int depthMax, const int depth);
+		// (x,y) are floating point coordinates so that sub-pixel samples can be traced
+		glm_color_t raytraceRecursive(const Camera& camera, const Scene& scene, float x, float y, TraceContext& context);
+		glm_color_t raytrace_recursive_call(const Scene& scene, const Ray& incomingRay, TraceContext& context, const int depth);
 
 		//Namespace for objects associated with dispersive raytracing
 		namespace Dispersion
@@ -68,12 +96,35 @@ namespace Graphics
 
 			// Return the color of the pixel according to recursive raytracing
 			// Use a dispersive model
-			glm_color_t raytraceRecursiveWithDispersion(const Camera& camera, const Scene& scene, int x, int y, const int depthMax);
+			// (x,y) are floating point coordinates so that sub-pixel samples can be traced
+			glm_color_t raytraceRecursiveWithDispersion(const Camera& camera, const Scene& scene, float x, float y, TraceContext& context);
 
 			// Return the color of refracted light
 			// Dispersion aware version
-			glm_color_t refractedLightWithDispersion(const Scene& scene, const Intersection& intersection, const RayWave& incidentRayWave, const int depthMax, const int depth);
-			glm_color_t recursive_raytracing_with_dispersion_call(const Scene& scene, const RayWave& incidentRayWave, const int depthMax, const int depth);
+			// If the triangle hit by the refracted ray is already known from another hit, it is intersected directly instead of traversing the scene
+			glm_color_t refractedLightWithDispersion(const Scene& scene, const Intersection& intersection, const RayWave& incidentRayWave, const DielectricInterface& interface, TraceContext& context, const int depth, const Intersection* knownHitPtr = nullptr);
+			glm_color_t recursive_raytracing_with_dispersion_call(const Scene& scene, const RayWave& incidentRayWave, TraceContext& context, const int depth);
+
+			// Return the color of a ray at its closest intersection, which has been found beforehand
+			glm_color_t shadeIntersectionWithDispersion(const Scene& scene, const Intersection& intersection, const RayWave& incidentRayWave, TraceContext& context, const int depth);
+
+			// Return true if all the refracted rays of a spectral split hit the same triangle, and fill out one of these hits
+			// The rays of the extreme wavelengths are traced, and as all the refracted directions lie in the plane of incidence
+			// the rays in between sweep the triangle joining the split point to both hits: it must not be crossed by any other triangle
+			// The triangles around the rays are gathered in the arena
+			bool dispersionConeTarget(const Scene& scene, const Intersection& splitIntersection, const utilities::ArenaVector<DielectricInterface>& spectralInterfaces, utilities::FrameArena& arena, Intersection& targetOut);
+
+			// Fill the result with one wavelength per stratum of the visible spectrum
+			// The wavelengths are at the same relative offset, in [0,1), inside their stratum
+			void stratifiedWavelengths(float offset, utilities::ArenaVector<float>& result);
+
+			// Return the largest weight the RGB filter gives to the wavelength of a monochromatic ray, 1 otherwise
+			float spectralWeight(const RayWave& rayWave);
+
+			// Return true if the ray, or one of the reflected and refracted rays it spawns, hits a dispersive material
+			// Only the closest intersections are computed, without any illumination
+			// The branches are the ones the tracing functions may follow with the given context
+			bool reachesDispersiveMaterial(const Scene& scene, const Ray& ray, const TraceContext& context, const int depth);
 
 			// compute an approximation of the RGB color from the wavelength using
 			// the method from Mihai and Strajescu, FROM WAVELENGTH TO RGB FILTER, 2007
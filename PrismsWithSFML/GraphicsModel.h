@@ -4,6 +4,10 @@
 // This file defines all the useful objects and constants used to model the graphics components
 
 #include "stdafx.h"
+#include "Sampling.h"
+#include "AlignedAllocator.h"
+#include "FrameArena.h"
+#include <cstdint>
 
 namespace Graphics
 {
@@ -54,6 +58,16 @@ namespace Graphics
 			return vec3(rotationMatrix[2]);
 		}
 
+		// Return true if both cameras project the scene on the same pixels
+		bool hasSameView(const Camera& other) const
+		{
+			return position == other.position
+				&& rotationMatrix == other.rotationMatrix
+				&& focal == other.focal
+				&& screen.width == other.screen.width
+				&& screen.height == other.screen.height;
+		}
+
 	};
 
 	// Describes a light source
@@ -77,6 +91,14 @@ namespace Graphics
 
 		virtual float falloff(vec3 hitPoint) const = 0;
 
+		// Sample the start and the direction of a photon sent towards a sphere, from two uniform numbers in [0,1)
+		// Photons that do not leave a point start at startDistance before the center of the sphere
+		// Return the measure of the set the photons are sampled from: an area across the light direction, or a solid angle
+		virtual float samplePhoton(const vec3& targetCenter, float targetRadius, float startDistance, float u, float v, vec3& startOut, vec3& directionOut) const = 0;
+
+		// Return the area over which photons sampled from a set of a given measure spread around a point, if nothing deviated them
+		virtual float photonFootprint(vec3 hitPoint, float sampledMeasure) const = 0;
+
 	};
 
 	// Describes an omni-directional light source
@@ -104,6 +126,38 @@ namespace Graphics
 			return 1 / (4 * PI * d*d);
 		}
 
+		// The directions are sampled uniformly in the cone holding the sphere, or in all directions from inside it
+		// The photons start at the light, whatever the distance
+		float samplePhoton(const vec3& targetCenter, float targetRadius, float, float u, float v, vec3& startOut, vec3& directionOut) const override
+		{
+			const vec3 toTarget = targetCenter - pos;
+			const float targetDistance = glm::length(toTarget);
+			const float cosMax = targetDistance > targetRadius ? sqrt(1 - targetRadius * targetRadius / (targetDistance * targetDistance)) : -1.f;
+			const float cosTheta = 1 - u * (1 - cosMax);
+			const float sinTheta = sqrt(std::max(1 - cosTheta * cosTheta, 0.f));
+			const float phi = 2 * PI * v;
+
+			vec3 axis(0, 0, 1);
+			vec3 tangent(1, 0, 0);
+			if (targetDistance > targetRadius)
+			{
+				axis = toTarget / targetDistance;
+				tangent = glm::normalize(glm::cross(fabs(axis.x) < 0.9f ? vec3(1, 0, 0) : vec3(0, 1, 0), axis));
+			}
+			const vec3 bitangent = glm::cross(axis, tangent);
+
+			startOut = pos;
+			directionOut = cosTheta * axis + sinTheta * (cos(phi) * tangent + sin(phi) * bitangent);
+			return 2 * PI * (1 - cosMax);
+		}
+
+		// A solid angle spreads over an area growing with the square of the distance
+		float photonFootprint(vec3 hitPoint, float sampledMeasure) const override
+		{
+			float d = getDistance(hitPoint);
+			return sampledMeasure * d*d;
+		}
+
 	};
 
 	// Describes an directional source
@@ -136,6 +190,25 @@ namespace Graphics
 			return 1/ (d);
 		}
 
+		// The photons start on the disk across the light direction that covers the sphere
+		float samplePhoton(const vec3& targetCenter, float targetRadius, float startDistance, float u, float v, vec3& startOut, vec3& directionOut) const override
+		{
+			const vec3 tangent = glm::normalize(glm::cross(fabs(direction.x) < 0.9f ? vec3(1, 0, 0) : vec3(0, 1, 0), direction));
+			const vec3 bitangent = glm::cross(direction, tangent);
+			const float radius = targetRadius * sqrt(u);
+			const float phi = 2 * PI * v;
+
+			startOut = targetCenter - startDistance * direction + radius * (cos(phi) * tangent + sin(phi) * bitangent);
+			directionOut = direction;
+			return PI * targetRadius * targetRadius;
+		}
+
+		// The photons travel in parallel, they keep their area
+		float photonFootprint(vec3, float sampledMeasure) const override
+		{
+			return sampledMeasure;
+		}
+
 	};
 
 	// Describes a material and how it reflects light
@@ -144,13 +217,14 @@ namespace Graphics
 
 	public:
 		const glm_color_t color;
-		const float specularCoeff;
+		// the specular and ambiant coefficients and the shininess only change the shading, they can be tuned at any time
+		float specularCoeff;
 		const float diffuseCoeff;
-		const float ambiantCoeff;
-		const float shininess;
+		float ambiantCoeff;
+		float shininess;
 		const float reflectionCoeff;
 		const float refractionCoeff;
-		const float refractiveIndex;
+		float refractiveIndex;
 		float cauchyCoeff_A; // no unit
 		float cauchyCoeff_B; //nanometer squared
 
@@ -187,10 +261,24 @@ namespace Graphics
 
 		// Return the refractive index according to Cauchy's formula
 		// wavelength is in nanometer
-		float cauchyRefractiveIndex(float wavelength)
+		float cauchyRefractiveIndex(float wavelength) const
 		{
 			return cauchyCoeff_A + cauchyCoeff_B / (wavelength * wavelength);
 		}
+
+		// Change the glass of the material, the refractive index used without dispersion follows A
+		void setCauchyCoefficients(float A, float B)
+		{
+			refractiveIndex = A;
+			cauchyCoeff_A = A;
+			cauchyCoeff_B = B;
+		}
+
+		// Return true if the refractive index depends on the wavelength
+		bool isDispersive() const
+		{
+			return cauchyCoeff_B != 0;
+		}
 		
 	};
 
@@ -221,11 +309,308 @@ namespace Graphics
 
 	};
 
+	// Axis aligned box, empty by default
+	struct BoundingBox
+	{
+		vec3 min{ std::numeric_limits<float>::max() };
+		vec3 max{ -std::numeric_limits<float>::max() };
+
+		void expand(const vec3& point)
+		{
+			min = glm::min(min, point);
+			max = glm::max(max, point);
+		}
+
+		void expand(const BoundingBox& box)
+		{
+			min = glm::min(min, box.min);
+			max = glm::max(max, box.max);
+		}
+
+		vec3 centroid() const
+		{
+			return 0.5f * (min + max);
+		}
+
+		float surfaceArea() const
+		{
+			const vec3 size = max - min;
+			return 2 * (size.x * size.y + size.y * size.z + size.z * size.x);
+		}
+	};
+
+	// Convex solid bounded by analytic surfaces, hit in closed form with the exact normal of its surface
+	// It is the intersection of half-spaces and balls: the half-spaces alone make a convex polyhedron such as a prism,
+	// a ball alone a sphere, and a ball cut by a plane or by a second ball a spherical-cap lens
+	class Shape
+	{
+	public:
+		// points p with dot(normal, p) <= offset, the normal is normalized and points outwards
+		struct HalfSpace
+		{
+			vec3 normal;
+			float offset;
+		};
+
+		struct Ball
+		{
+			vec3 center;
+			float radius;
+		};
+
+		std::vector<HalfSpace> halfSpaces;
+		std::vector<Ball> balls;
+		Material* material;
+		// bounds of the solid, computed with the hierarchies of the scene
+		BoundingBox bounds;
+
+		Shape(Material* material) :
+			material(material)
+		{}
+
+		// Bound the solid by the plane through the point, on the side opposite to the outward normal
+		void addHalfSpace(const vec3& outwardNormal, const vec3& pointOnPlane)
+		{
+			const vec3 normal = glm::normalize(outwardNormal);
+			halfSpaces.push_back(HalfSpace{ normal, glm::dot(normal, pointOnPlane) });
+		}
+
+		static Shape sphere(const vec3& center, float radius, Material* material)
+		{
+			Shape shape(material);
+			shape.balls.push_back(Ball{ center, radius });
+			return shape;
+		}
+
+		// Lens centered on a point whose two faces are spherical caps of the same radius of curvature, bulging along the axis
+		// The thickness is measured along the axis, it must be less than twice the radius of curvature
+		static Shape biconvexLens(const vec3& center, const vec3& axis, float curvatureRadius, float thickness, Material* material)
+		{
+			const vec3 direction = glm::normalize(axis);
+			Shape shape(material);
+			shape.balls.push_back(Ball{ center + (curvatureRadius - thickness / 2) * direction, curvatureRadius });
+			shape.balls.push_back(Ball{ center - (curvatureRadius - thickness / 2) * direction, curvatureRadius });
+			return shape;
+		}
+
+		// Lens with a flat face centered on a point, and a spherical cap of the radius of curvature bulging along the axis
+		// The thickness is measured along the axis, it must be less than the radius of curvature
+		static Shape planoConvexLens(const vec3& flatCenter, const vec3& axis, float curvatureRadius, float thickness, Material* material)
+		{
+			const vec3 direction = glm::normalize(axis);
+			Shape shape(material);
+			shape.balls.push_back(Ball{ flatCenter + (thickness - curvatureRadius) * direction, curvatureRadius });
+			shape.addHalfSpace(-direction, flatCenter);
+			return shape;
+		}
+
+		// Prism standing on the triangle (a, b, c), its top is the triangle translated by height
+		static Shape triangularPrism(const vec3& a, const vec3& b, const vec3& c, const vec3& height, Material* material)
+		{
+			Shape shape(material);
+			const vec3 centroid = (a + b + c) / 3.f + height / 2.f;
+			auto addFace = [&](const vec3& p0, const vec3& p1, const vec3& p2) {
+				const vec3 normal = glm::cross(p1 - p0, p2 - p0);
+				shape.addHalfSpace(glm::dot(normal, centroid - p0) > 0 ? -normal : normal, p0);
+			};
+			addFace(a, b, c);
+			addFace(a + height, b + height, c + height);
+			addFace(a, b, b + height);
+			addFace(b, c, c + height);
+			addFace(c, a, a + height);
+			return shape;
+		}
+	};
+
+	// Convex cone of the rays leaving an apex between four planes, such as the rays through a tile of the screen
+	// The normals of the planes point inwards
+	struct Frustum
+	{
+		vec3 apex;
+		vec3 normals[4];
+
+		// Return false if the points all lie outside one of the planes, then no ray of the frustum reaches their convex hull
+		bool mayContain(const vec3* points, int pointCount) const
+		{
+			for (const vec3& normal : normals)
+			{
+				bool isOutside = true;
+				for (int i = 0; i < pointCount && isOutside; ++i)
+				{
+					isOutside = glm::dot(normal, points[i] - apex) < 0;
+				}
+				if (isOutside)
+				{
+					return false;
+				}
+			}
+			return true;
+		}
+
+		// Return false if no ray of the frustum reaches the box
+		// the corner of the box the farthest inside each plane is tested
+		bool mayContain(const BoundingBox& box) const
+		{
+			for (const vec3& normal : normals)
+			{
+				const vec3 corner(
+					normal.x > 0 ? box.max.x : box.min.x,
+					normal.y > 0 ? box.max.y : box.min.y,
+					normal.z > 0 ? box.max.z : box.min.z);
+				if (glm::dot(normal, corner - apex) < 0)
+				{
+					return false;
+				}
+			}
+			return true;
+		}
+	};
+
+	// Node of a bounding volume hierarchy
+	// A leaf references primitiveCount primitives from firstIndex in the primitive indices of its hierarchy
+	// An inner node has no primitive and its children are stored at firstIndex and firstIndex + 1
+	struct BVHNode
+	{
+		BoundingBox bounds;
+		int firstIndex;
+		int primitiveCount;
+
+		bool isLeaf() const
+		{
+			return primitiveCount > 0;
+		}
+	};
+
+	// Node of a hierarchy with up to four children, filling a cache line
+	// The bounds of the children are quantized on 8 bits over a grid laid on the bounds of the node:
+	// along an axis, a child spans from origin + lower * 2^exponent to origin + upper * 2^exponent
+	// A child is a leaf when it has primitives, then childIndices holds its first index in the primitive indices
+	struct alignas(64) WideBVHNode
+	{
+		float origin[3];
+		int8_t exponents[3];
+		uint8_t childCount;
+		uint8_t lowerX[4];
+		uint8_t upperX[4];
+		uint8_t lowerY[4];
+		uint8_t upperY[4];
+		uint8_t lowerZ[4];
+		uint8_t upperZ[4];
+		int32_t childIndices[4];
+		uint8_t primitiveCounts[4];
+	};
+
+	// Bounding volume hierarchy over primitives referenced by their index, the root is the first node
+	struct BVH
+	{
+		std::vector<BVHNode> nodes;
+		std::vector<int> primitiveIndices;
+		// the same hierarchy with four children per node, traversed by the rays
+		// it is collapsed from the binary nodes, which are kept for refitting and for the box queries
+		std::vector<WideBVHNode, utilities::AlignedAllocator<WideBVHNode, 64>> wideNodes;
+		// surface area heuristic cost of the subtree of each node when it was built
+		// refitting compares the current costs to them to detect the subtrees it degraded
+		std::vector<float> builtCosts;
+		// nodes of the subtrees that were built again, they stay unused until the next full build
+		int unusedNodeCount = 0;
+	};
+
+	// Geometry stored once in its own space and shared by all its instances
+	class Mesh
+	{
+	public:
+		std::vector<Triangle> triangles;
+		// bottom level hierarchy over the triangles
+		BVH bvh;
+		// chunk of the geometry store of the scene holding the triangles and the hierarchy, which are then empty, -1 while they are in memory
+		// a stored mesh can be placed by its instances but not deformed
+		int storedChunk = -1;
+	};
+
+	// Copy of a mesh placed in the scene
+	// A local point p is placed at linear * p + translation
+	class Instance
+	{
+	public:
+		int meshIndex;
+		// replaces the materials of the mesh when not null
+		Material* materialOverride;
+		// bounds of the placed mesh, computed with the top level hierarchy
+		BoundingBox worldBounds;
+
+		Instance(int meshIndex, const glm::mat3& linear, const vec3& translation, Material* materialOverride = nullptr) :
+			meshIndex(meshIndex),
+			materialOverride(materialOverride)
+		{
+			setTransform(linear, translation);
+		}
+
+		void setTransform(const glm::mat3& linear, const vec3& translation)
+		{
+			this->linear = linear;
+			this->translation = translation;
+			inverseLinear = glm::inverse(linear);
+			normalMatrix = glm::transpose(inverseLinear);
+		}
+
+		const glm::mat3& getLinear() const
+		{
+			return linear;
+		}
+
+		const vec3& getTranslation() const
+		{
+			return translation;
+		}
+
+		vec3 toWorldPoint(const vec3& localPoint) const
+		{
+			return linear * localPoint + translation;
+		}
+
+		vec3 toWorldNormal(const vec3& localNormal) const
+		{
+			return glm::normalize(normalMatrix * localNormal);
+		}
+
+		vec3 toLocalPoint(const vec3& worldPoint) const
+		{
+			return inverseLinear * (worldPoint - translation);
+		}
+
+		// the result is not normalized so that distances along a ray are the same in both spaces
+		vec3 toLocalDirection(const vec3& worldDirection) const
+		{
+			return inverseLinear * worldDirection;
+		}
+
+	private:
+		glm::mat3 linear;
+		vec3 translation;
+		glm::mat3 inverseLinear;
+		glm::mat3 normalMatrix;
+	};
+
+	class GeometryStore;
+
 	// Represents a scene with only one light source
+	// The polygons and the analytic shapes are placed in the scene as they are, the meshes through their instances
+	// The hierarchies are built by the functions declared in BVH.h
 	class Scene
 	{
 	public:
 		std::vector<Triangle> polygons;
+		std::vector<Mesh> meshes;
+		std::vector<Instance> instances;
+		std::vector<Shape> shapes;
+		// hierarchy over the polygons
+		BVH polygonsBVH;
+		// top level hierarchy over the instances
+		BVH instancesBVH;
+		// hierarchy over the analytic shapes
+		BVH shapesBVH;
+		// store of the meshes moved out of memory, nullptr if they all stay in it
+		GeometryStore* geometryStorePtr = nullptr;
 		Light& lightSource;
 		glm_color_t ambiantLight;
 
@@ -240,13 +625,15 @@ namespace Graphics
 	namespace Raytracing
 	{
 		// Describes a ray with a normalized direction
+		// The throughput is the weight of the light brought back by the ray in the final pixel color
 		class Ray
 		{
 		public:
 			vec3 start;
 			vec3 direction;
+			float throughput;
 
-			Ray(vec3 start, vec3 dir) : start(start)
+			Ray(vec3 start, vec3 dir, float throughput = 1.f) : start(start), throughput(throughput)
 			{
 				direction = glm::normalize(dir);
 			}
@@ -262,8 +649,135 @@ namespace Graphics
 		{
 			vec3 position;
 			float distance;
-			const Triangle* trianglePtr;
+			// index of the triangle that is hit in its mesh, or in the polygons of the scene without an instance, -1 when a shape is hit
+			// along with the instance it identifies the triangle, even when its mesh is stored and mapped again elsewhere
+			int triangleIndex;
 			const Ray* rayPtr;
+			// instance the triangle belongs to, null for the polygons of the scene
+			const Instance* instancePtr;
+			// analytic shape that is hit, null when a triangle is hit
+			const Shape* shapePtr;
+			// normal and material at the intersection, once placed in the scene
+			vec3 normal;
+			const Material* materialPtr;
+		};
+
+		// Describes how a ray is split at the interface with a dielectric material
+		struct DielectricInterface
+		{
+			vec3 reflectedDirection;
+			vec3 refractedDirection;
+			// fraction of the light that is reflected according to Fresnel equations
+			float reflectance;
+			// no refracted direction exists in that case and the reflectance is 1
+			bool totalInternalReflection;
+		};
+
+		// Primitives of the scene a group of rays may hit, the others having been culled beforehand
+		struct CandidatePrimitives
+		{
+			std::vector<int> polygonIndices;
+			std::vector<int> instanceIndices;
+			std::vector<int> shapeIndices;
+
+			bool empty() const
+			{
+				return polygonIndices.empty() && instanceIndices.empty() && shapeIndices.empty();
+			}
+
+			size_t size() const
+			{
+				return polygonIndices.size() + instanceIndices.size() + shapeIndices.size();
+			}
+
+			void clear()
+			{
+				polygonIndices.clear();
+				instanceIndices.clear();
+				shapeIndices.clear();
+			}
+		};
+
+		class PhotonMap;
+		class ShadingRecorder;
+		struct SurfaceGuide;
+
+		// State shared by all the rays traced for a pixel
+		// It controls when the recursive paths are terminated
+		class TraceContext
+		{
+		public:
+			// Hard limit on the recursion depth
+			int depthMax;
+			// Branches whose throughput is below this weight are not traced
+			float minThroughput;
+			// When enabled, branches below minThroughput are randomly kept instead of being skipped
+			// and their contribution is scaled accordingly so that the result stays unbiased
+			bool russianRoulette;
+			// Depth from which the russian roulette is played, shallower branches are always traced
+			int rouletteDepth;
+			// When enabled, only one of the reflected and refracted rays is followed at a refractive surface
+			// it is chosen randomly according to the Fresnel terms
+			bool stochasticInterfaces;
+			// Number of wavelengths a polychromatic ray is split into, one per stratum of the visible spectrum
+			int spectralSamples;
+			// Position of the wavelengths inside their stratum, in [0,1)
+			// 0.5 samples the middle of the strata, jittering it from a sample to the other removes the banding
+			float spectralOffset;
+			// When enabled, the refracted rays of a spectral split that all hit the same triangle
+			// are intersected with it directly instead of being traced through the scene one by one
+			bool dispersionCones;
+			// Primitives the primary ray of the traced sample may hit, nullptr to search the whole scene
+			const CandidatePrimitives* primaryCandidatesPtr;
+			// Photons gathered on the diffuse surfaces to light them with the caustics, nullptr for none
+			const PhotonMap* photonMapPtr;
+			// Records of the shading points met by the traced samples, nullptr to record nothing
+			ShadingRecorder* shadingRecorderPtr;
+			// Guide where the surface hit by the primary ray of the traced sample is written, nullptr to write nothing
+			// It is cleared once written, so that the deeper rays leave it alone
+			SurfaceGuide* primaryGuidePtr;
+			// Variance of the guide written by the primary ray, written in turn by the first spectral split of the path, nullptr to write nothing
+			float* spectralVariancePtr;
+			// Scratch memory of the rays traced with the context, given back after every sample and reset at the end of every frame
+			// It is not copied with the settings, so every context keeps its own blocks
+			utilities::FrameArena arena;
+
+			TraceContext(int depthMax, float minThroughput = 0.01f, bool russianRoulette = false, int rouletteDepth = 2, bool stochasticInterfaces = false) :
+				depthMax(depthMax),
+				minThroughput(minThroughput),
+				russianRoulette(russianRoulette),
+				rouletteDepth(rouletteDepth),
+				stochasticInterfaces(stochasticInterfaces),
+				spectralSamples(10),
+				spectralOffset(0.5f),
+				dispersionCones(true),
+				primaryCandidatesPtr(nullptr),
+				photonMapPtr(nullptr),
+				shadingRecorderPtr(nullptr),
+				primaryGuidePtr(nullptr),
+				spectralVariancePtr(nullptr)
+			{}
+
+			// Restart the random numbers on the stream of a given sample
+			void seed(uint64_t sampleSeed, uint64_t frameIndex = 0)
+			{
+				randomStream.reseed(sampleSeed, frameIndex);
+			}
+
+			// Return a random number uniformly distributed in [0,1)
+			float uniform()
+			{
+				return randomStream.uniform();
+			}
+
+			// Exchange the random numbers of the context with the stream, so that the samples traced together each keep their own
+			void swapRandomStream(Sampling::RandomStream& stream)
+			{
+				std::swap(randomStream, stream);
+			}
+
+		private:
+			Sampling::RandomStream randomStream;
 		};
 
 
@@ -277,22 +791,22 @@ namespace Graphics
 				bool isMonochromatic;
 				float wavelength;
 
-				RayWave(vec3 start, vec3 dir) :
-					Ray(start, dir)
+				RayWave(vec3 start, vec3 dir, float throughput = 1.f) :
+					Ray(start, dir, throughput)
 				{
 					wavelength = 0;
 					isMonochromatic = false;
 				}
 
 				RayWave(const RayWave& upgradedRay) :
-					Ray(upgradedRay.start, upgradedRay.direction),
+					Ray(upgradedRay.start, upgradedRay.direction, upgradedRay.throughput),
 					wavelength(0)
 				{
 					isMonochromatic = false;
 				}
 
 				RayWave(const RayWave& upgradedRay, float wavelength) :
-					Ray(upgradedRay.start, upgradedRay.direction),
+					Ray(upgradedRay.start, upgradedRay.direction, upgradedRay.throughput),
 					wavelength(wavelength)
 				{
 					isMonochromatic = true;
@@ -23,7 +23,11 @@ public:
 		T,
 		Y,
 		G,
-		H
+		H,
+		Z,
+		X,
+		C,
+		V
 	};
 
 	virtual bool isKeyPressed(Key key) = 0;
@@ -12,6 +12,23 @@
 #include "TestModel.h"
 #include "SFMLhelper.h"
 #include "Utilities.h"
+#include "Profiler.h"
+#include "FrameBuffer.h"
+#include "Renderer.h"
+#include "FrameBudget.h"
+#include "ThreadPool.h"
+#include "BVH.h"
+#include "BatchRenderer.h"
+#include "DistributedRendering.h"
+#include "GeometryStore.h"
+#include "SharedMemoryManager.h"
+#include <string>
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <limits>
+#include <memory>
 
 // ----------------------------------------------------------------------------
 // USING STATEMENTS
@@ -23,13 +40,34 @@ using glm::mat3;
 // FUNCTIONS DECLARATIONS
 
 // Draw the scene at a current instant
-void Draw(const Graphics::Scene& scene, const Graphics::Camera& camera, IDrawingManager& manager);
+// While the user interacts, the quality is lowered to keep the frame budget
+void Draw(const Graphics::Scene& scene, const Graphics::Camera& camera, Graphics::Rendering::Renderer& renderer,
+	Graphics::Rendering::FrameBudgetController& frameBudget, bool isInteracting, IDrawingManager& manager);
 // Update objects positions according to inputs
-void Update(Graphics::Scene& scene, Graphics::Camera& camera, IInputManager& manager);
+// Restart what the renderer accumulated if the scene changed
+// Return true if anything moved
+bool Update(Graphics::Scene& scene, Graphics::Camera& camera, Graphics::Rendering::Renderer& renderer, IInputManager& manager);
 // Handle the camera movements
-void ControlCamera(Graphics::Scene& scene, Graphics::Camera& camera, IInputManager& manager);
+// Return true if the camera moved
+bool ControlCamera(Graphics::Scene& scene, Graphics::Camera& camera, IInputManager& manager);
 // Handle the camera displacements
-void ControlLight(Graphics::Scene& scene, Graphics::Camera& camera, IInputManager& manager);
+// Return true if the light moved
+bool ControlLight(Graphics::Scene& scene, Graphics::Camera& camera, IInputManager& manager);
+// Handle the rotations of the prisms
+// Return true if they moved
+bool ControlObjects(Graphics::Scene& scene, IInputManager& manager);
+// Handle the intensity of the ambiant light
+// Return true if it changed
+bool ControlShading(Graphics::Scene& scene, IInputManager& manager);
+// Render a camera orbit around the prism and a sweep of its glass dispersion into the output directory
+// Return the number of images written
+int RunBatch(Graphics::Scene& scene, const Graphics::Camera& camera, utilities::ThreadPool& threadPool, const std::string& outputDirectory);
+// Render a high quality still of the camera view with the workers connecting to the port
+// Return true if the image was written
+bool RunCoordinator(const Graphics::Camera& camera, uint16_t port, const std::string& outputFile);
+// Read a whole decimal number in [minimum, maximum] from a command line argument
+// Return false if the argument is not one
+bool ParseNumber(const char* argument, unsigned long long minimum, unsigned long long maximum, unsigned long long& valueOut);
 // Welcome the user and provides commands
 void printWelcomeMessage();
 
@@ -38,7 +76,34 @@ void printWelcomeMessage();
 
 int main(int argc, char* argv[])
 {
-	printWelcomeMessage();
+	// "--batch <directory>" renders a list of images there instead of opening the window
+	// "--coordinator <port> <file>" renders a still with the workers started by "--worker <host> <port>"
+	// "--lookdev" keeps the shading points of the frames in the window so that the shading edits are not traced again
+	// "--optics" loads the analytic prism, ball and lenses instead of the prism mesh
+	// "--out-of-core <megabytes>" moves the meshes to a file and keeps at most that much of them mapped
+	// "--shared-memory <name>" publishes the frames in shared memory instead of opening the window
+	// "--denoise" traces 4 wavelengths per spectral split instead of 10 and filters their noise
+	// "--sort-rays" traces the samples of a tile together, their secondary rays sorted by direction and origin
+	const std::string mode = argc >= 3 ? argv[1] : "";
+	const bool isLookDev = std::find(argv + 1, argv + argc, std::string("--lookdev")) != argv + argc;
+	const bool isOptics = std::find(argv + 1, argv + argc, std::string("--optics")) != argv + argc;
+	const bool isDenoised = std::find(argv + 1, argv + argc, std::string("--denoise")) != argv + argc;
+	const bool isSortingRays = std::find(argv + 1, argv + argc, std::string("--sort-rays")) != argv + argc;
+	char** const outOfCoreFlag = std::find(argv + 1, argv + argc, std::string("--out-of-core"));
+	const bool isOutOfCore = outOfCoreFlag != argv + argc && outOfCoreFlag + 1 != argv + argc;
+	char** const sharedMemoryFlag = std::find(argv + 1, argv + argc, std::string("--shared-memory"));
+	const bool isSharedMemory = sharedMemoryFlag != argv + argc && sharedMemoryFlag + 1 != argv + argc;
+	const bool isBatch = mode == "--batch";
+	const bool isCoordinator = mode == "--coordinator" && argc >= 4;
+	const bool isWorker = mode == "--worker" && argc >= 4;
+	if (!isBatch && !isCoordinator && !isWorker)
+	{
+		printWelcomeMessage();
+	}
+
+	// the zones of the frames are timed, the ones hit by every ray are left out to keep the overhead low
+	utilities::Profiler& profiler = utilities::Profiler::instance();
+	profiler.setLevel(utilities::ProfileLevel::FRAME);
 
 	// Screen where rays are projected to pixels
 	const Graphics::Screen SCREEN{
@@ -66,34 +131,161 @@ int main(int argc, char* argv[])
 	//3D models
 	Graphics::Scene scene(light, INDIRECT_LIGHT);
 
-	//SFML SCREEN - change those two lines to change of display and input handling libraries
-	auto drawingManager = SFML_Manager(camera.screen.width, camera.screen.height);
-	auto inputManager = drawingManager;
+	//threads shared by the loading and the rendering
+	utilities::ThreadPool threadPool;
+
+	//Load a test model, the batch needs the prism mesh
+	if (isOptics && !isBatch)
+	{
+		TestModel::LoadTestModelOptics(scene, 6.0f);
+	}
+	else
+	{
+		TestModel::LoadTestModelTriangularPrism(scene, 6.0f);
+	}
+	Graphics::Raytracing::buildSceneBVH(scene, threadPool);
+
+	if (isBatch)
+	{
+		const int imageCount = RunBatch(scene, camera, threadPool, argv[2]);
+		return imageCount > 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	//the meshes are moved to the file once their hierarchies are built, the batch needs the prism mesh in memory
+	//the ones that could not be written stay in memory
+	std::unique_ptr<Graphics::GeometryStore> geometryStorePtr;
+	unsigned long long residentMegabytes{};
+	if (isOutOfCore && !ParseNumber(outOfCoreFlag[1], 1, std::numeric_limits<size_t>::max() >> 20, residentMegabytes))
+	{
+		std::cout << "The out-of-core budget must be a positive number of megabytes, the meshes stay in memory" << std::endl;
+	}
+	else if (isOutOfCore)
+	{
+		try
+		{
+			geometryStorePtr.reset(new Graphics::GeometryStore("PrismsGeometry.bin", static_cast<size_t>(residentMegabytes) << 20));
+			scene.geometryStorePtr = geometryStorePtr.get();
+			for (Graphics::Mesh& mesh : scene.meshes)
+			{
+				geometryStorePtr->store(mesh);
+			}
+			std::cout << geometryStorePtr->chunkCount() << " meshes stored out of core in " << (geometryStorePtr->storedBytes() >> 10) << " KB" << std::endl;
+		}
+		catch (const std::runtime_error& error)
+		{
+			std::cout << error.what() << std::endl;
+		}
+	}
+
+	unsigned long long port{};
+	if ((isCoordinator || isWorker) && !ParseNumber(argv[isCoordinator ? 2 : 3], 1, 65535, port))
+	{
+		std::cout << "The port must be a number between 1 and 65535" << std::endl;
+		return EXIT_FAILURE;
+	}
+	if (isCoordinator)
+	{
+		return RunCoordinator(camera, static_cast<uint16_t>(port), argv[3]) ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+	if (isWorker)
+	{
+		try
+		{
+			const int tileCount = Graphics::Rendering::runTileWorker(scene, argv[2], static_cast<uint16_t>(port), threadPool);
+			std::cout << tileCount << " tiles traced" << std::endl;
+			return EXIT_SUCCESS;
+		}
+		catch (const std::runtime_error& error)
+		{
+			std::cout << error.what() << std::endl;
+			return EXIT_FAILURE;
+		}
+	}
+
+	//SFML SCREEN - change those lines to change of display and input handling libraries
+	//without the window, the frames are read by other processes and the run stops once one of them asks for it
+	std::unique_ptr<SFML_Manager> windowPtr;
+	std::unique_ptr<SharedMemoryManager> sharedMemoryPtr;
+	try
+	{
+		if (isSharedMemory)
+		{
+			sharedMemoryPtr.reset(new SharedMemoryManager(sharedMemoryFlag[1], camera.screen.width, camera.screen.height));
+		}
+		else
+		{
+			windowPtr.reset(new SFML_Manager(camera.screen.width, camera.screen.height));
+		}
+	}
+	catch (const std::runtime_error& error)
+	{
+		std::cout << error.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+	IDrawingManager& drawingManager = isSharedMemory ? static_cast<IDrawingManager&>(*sharedMemoryPtr) : *windowPtr;
+	IInputManager& inputManager = isSharedMemory ? static_cast<IInputManager&>(*sharedMemoryPtr) : *windowPtr;
+
+	//renderer
+	// paths are cut at depth 5 or once their weight in the pixel drops below 1%
+	// the russian roulette and the stochastic interfaces are left disabled to keep a noise-free interactive image
+	// anti-aliasing: 8x8 tiles with a contrast above 10% get extra samples
+	// at most one extra sample per pixel on average is spent in a frame
+	// caustics: 200000 photons per frame, gathered on disks of radius 0.01
+	// while the view does not change, 64 frames with jittered wavelengths are averaged
+	Graphics::Rendering::Renderer renderer(
+		threadPool,
+		Graphics::Raytracing::TraceContext(5, 0.01f),
+		{ 8, 0.1f, 4, SCREEN.width * SCREEN.height },
+		{ 200000, 0.01f, 8 },
+		true,
+		64);
+	renderer.cacheShading = isLookDev;
+	renderer.batchSecondaryRays = isSortingRays;
+	if (isDenoised)
+	{
+		renderer.denoise = true;
+		renderer.context.spectralSamples = 4;
+	}
 
-	//Load a test model
-	TestModel::LoadTestModelTriangularPrism(scene.polygons, 6.0f);
+	// frame budget: 33 ms per frame while the user moves the camera, the light or the prisms,
+	// down to a quarter of the resolution, 3 wavelengths per spectral split and a depth of 2
+	Graphics::Rendering::FrameBudgetController frameBudget({ 33.f, 0.25f, 3, 2 }, renderer);
 
-	auto chrono = utilities::Chrono();
-	chrono.startChrono();
+	// the loading is not part of the first frame
+	profiler.endFrame();
 	while (!drawingManager.closedWindowEventHandler())
 	{
 		drawingManager.cleanWindow();
 
-		Update(scene, camera, inputManager);
-		Draw(scene, camera, drawingManager);
+		bool isInteracting = false;
+		{
+			PROFILE_ZONE("Update");
+			isInteracting = Update(scene, camera, renderer, inputManager);
+		}
+		const bool isConverged = renderer.isConverged();
+		Draw(scene, camera, renderer, frameBudget, isInteracting, drawingManager);
 
-		drawingManager.display();
-		
-		std::cout << "Render time: " << chrono.getChronoElapsedTime() << " ms." << std::endl;
+		{
+			PROFILE_ZONE("Display");
+			drawingManager.display();
+		}
+
+		const std::string frameSummary = profiler.endFrame();
+		if (!isConverged)
+		{
+			std::cout << frameSummary << std::endl << "Accumulated frames: " << renderer.accumulatedFrames()
+				<< ", quality: " << frameBudget.currentQuality() << std::endl;
+		}
 	}
-	drawingManager.saveToFile("Screenshot.png");
+	drawingManager.saveToFile(isSharedMemory ? "Screenshot.ppm" : "Screenshot.png");
+	profiler.exportChromeTrace("Profile.json");
 	return EXIT_SUCCESS;
 }
 
 // ----------------------------------------------------------------------------
 // MAIN FUNCTIONS DEFINITIONS
 
-void Update(Graphics::Scene& scene, Graphics::Camera& camera, IInputManager& manager)
+bool Update(Graphics::Scene& scene, Graphics::Camera& camera, Graphics::Rendering::Renderer& renderer, IInputManager& manager)
 {
 	//step for translations
 	float step{ 0.1f };
@@ -102,25 +294,48 @@ void Update(Graphics::Scene& scene, Graphics::Camera& camera, IInputManager& man
 	float yaw{ 10.0f };
 
 	//moving camera
-	ControlCamera(scene, camera, manager);
+	const bool cameraMoved = ControlCamera(scene, camera, manager);
 
 	//moving light
-	ControlLight(scene, camera, manager);
+	const bool lightMoved = ControlLight(scene, camera, manager);
+	if (lightMoved)
+	{
+		renderer.resetAccumulation();
+	}
+
+	//turning prisms
+	const bool objectsMoved = ControlObjects(scene, manager);
+	if (objectsMoved)
+	{
+		renderer.resetGeometry();
+	}
+
+	//changing the ambiant light, which is not an interaction when the frame is only shaded again
+	if (ControlShading(scene, manager))
+	{
+		renderer.shadingChanged();
+	}
+
+	return cameraMoved || lightMoved || objectsMoved;
 }
 
-void Draw(const Graphics::Scene& scene, const Graphics::Camera& camera, IDrawingManager& drawingManager)
+void Draw(const Graphics::Scene& scene, const Graphics::Camera& camera, Graphics::Rendering::Renderer& renderer,
+	Graphics::Rendering::FrameBudgetController& frameBudget, bool isInteracting, IDrawingManager& drawingManager)
 {
+	PROFILE_ZONE("Draw");
+	Graphics::FrameBuffer frame(camera.screen.width, camera.screen.height);
+	frameBudget.render(renderer, scene, camera, frame, isInteracting);
+
 	for (int y = 0; y < camera.screen.height; ++y)
 	{
 		for (int x = 0; x < camera.screen.width; ++x)
 		{
-			auto color = Graphics::Raytracing::Dispersion::raytraceRecursiveWithDispersion(camera, scene, x, y, 5);
-			drawingManager.drawPixel(x, y, color);
+			drawingManager.drawPixel(x, y, frame.at(x, y));
 		}
 	}
 }
 
-void ControlCamera(Graphics::Scene& scene, Graphics::Camera& camera, IInputManager& manager)
+bool ControlCamera(Graphics::Scene& scene, Graphics::Camera& camera, IInputManager& manager)
 {
 	//step for translations
 	float step{ 0.1f };
@@ -128,6 +343,9 @@ void ControlCamera(Graphics::Scene& scene, Graphics::Camera& camera, IInputManag
 	//in degrees
 	float yaw{ 10.0f };
 
+	const vec3 previousPosition = camera.position;
+	const mat3 previousRotation = camera.rotationMatrix;
+
 	if (manager.isKeyPressed(IInputManager::Key::LEFT_ARROW))
 	{
 		camera.position.x -= step;
@@ -168,9 +386,11 @@ void ControlCamera(Graphics::Scene& scene, Graphics::Camera& camera, IInputManag
 	{
 		camera.rotationMatrix = Graphics::rotationXMatrix(-yaw) * camera.rotationMatrix;
 	}
+
+	return camera.position != previousPosition || camera.rotationMatrix != previousRotation;
 }
 
-void ControlLight(Graphics::Scene& scene, Graphics::Camera& camera, IInputManager& manager)
+bool ControlLight(Graphics::Scene& scene, Graphics::Camera& camera, IInputManager& manager)
 {
 	//step for translations
 	float step{ 0.1f };
@@ -178,6 +398,8 @@ void ControlLight(Graphics::Scene& scene, Graphics::Camera& camera, IInputManage
 	//in degrees
 	float yaw{ 10.0f };
 
+	const vec3 previousPosition = scene.lightSource.pos;
+
 	if (manager.isKeyPressed(IInputManager::Key::W))
 	{
 		scene.lightSource.pos += step * camera.forward();
@@ -202,8 +424,145 @@ void ControlLight(Graphics::Scene& scene, Graphics::Camera& camera, IInputManage
 	{
 		scene.lightSource.pos += step * camera.down();
 	}
+
+	return scene.lightSource.pos != previousPosition;
 }
 
+bool ControlObjects(Graphics::Scene& scene, IInputManager& manager)
+{
+	//in degrees
+	float yaw{ 5.0f };
+
+	float turn{ 0 };
+	if (manager.isKeyPressed(IInputManager::Key::Z))
+	{
+		turn += yaw;
+	}
+	if (manager.isKeyPressed(IInputManager::Key::X))
+	{
+		turn -= yaw;
+	}
+	if (turn == 0 || scene.instances.empty())
+	{
+		return false;
+	}
+
+	// each prism turns around its own vertical axis, then only the top level hierarchy is refitted
+	for (Graphics::Instance& instance : scene.instances)
+	{
+		instance.setTransform(instance.getLinear() * Graphics::rotationYMatrix(turn), instance.getTranslation());
+	}
+	Graphics::Raytracing::updateInstancesBVH(scene);
+	return true;
+}
+
+bool ControlShading(Graphics::Scene& scene, IInputManager& manager)
+{
+	//factor of intensity per frame
+	float step{ 1.1f };
+
+	const Graphics::glm_color_t previousAmbiantLight = scene.ambiantLight;
+
+	if (manager.isKeyPressed(IInputManager::Key::C))
+	{
+		scene.ambiantLight /= step;
+	}
+	if (manager.isKeyPressed(IInputManager::Key::V))
+	{
+		scene.ambiantLight *= step;
+	}
+
+	return scene.ambiantLight != previousAmbiantLight;
+}
+
+int RunBatch(Graphics::Scene& scene, const Graphics::Camera& camera, utilities::ThreadPool& threadPool, const std::string& outputDirectory)
+{
+	// same settings as the interactive renderer, each image averaging 16 frames
+	constexpr int FRAMES{ 16 };
+	Graphics::Rendering::BatchRenderer batchRenderer(
+		threadPool,
+		Graphics::Raytracing::TraceContext(5, 0.01f),
+		{ 8, 0.1f, 4, camera.screen.width * camera.screen.height },
+		{ 200000, 0.01f, 8 });
+
+	std::vector<Graphics::Rendering::BatchJob> jobs;
+	const Graphics::Instance& prism = scene.instances.front();
+	const vec3 center = prism.worldBounds.centroid();
+
+	//orbit of the camera around the prism, by steps of 10 degrees
+	for (int i = 0; i < 36; ++i)
+	{
+		const mat3 rotation = Graphics::rotationYMatrix(10.f * i);
+		Graphics::Camera orbitCamera = camera;
+		orbitCamera.position = center + rotation * (camera.position - center);
+		orbitCamera.rotationMatrix = rotation * camera.rotationMatrix;
+		jobs.push_back({ orbitCamera, scene.lightSource.pos, scene.lightSource.color, {}, FRAMES,
+			outputDirectory + "/orbit_" + std::to_string(i) + ".ppm" });
+	}
+
+	//glass of the prism going from no dispersion to four times the one of the BK7
+	Graphics::Material* glass = scene.meshes[prism.meshIndex].triangles.front().material;
+	for (int i = 0; i < 16; ++i)
+	{
+		const float cauchyB = glass->cauchyCoeff_B * 4.f * i / 15;
+		jobs.push_back({ camera, scene.lightSource.pos, scene.lightSource.color, { { glass, glass->cauchyCoeff_A, cauchyB } }, FRAMES,
+			outputDirectory + "/dispersion_" + std::to_string(i) + ".ppm" });
+	}
+
+	utilities::Profiler& profiler = utilities::Profiler::instance();
+	profiler.endFrame();
+	utilities::Stopwatch stopwatch;
+	const int imageCount = batchRenderer.run(scene, jobs);
+	const double batchTime = stopwatch.lap();
+	std::cout << imageCount << " of " << jobs.size() << " images written in " << outputDirectory << " in " << batchTime / 1000 << " s, "
+		<< imageCount * 3600000. / batchTime << " images per hour" << std::endl;
+
+	// the whole batch is summed up as a single frame
+	std::cout << profiler.endFrame() << std::endl;
+	profiler.exportChromeTrace(outputDirectory + "/profile.json");
+	return imageCount;
+}
+
+bool RunCoordinator(const Graphics::Camera& camera, uint16_t port, const std::string& outputFile)
+{
+	// 64x64 tiles with 32 passes of 10 wavelengths per pixel
+	// a worker silent for a minute is replaced, the coordinator gives up after ten minutes without any worker
+	Graphics::Raytracing::TraceContext context(5, 0.01f);
+	const Graphics::Rendering::DistributedSettings settings{ port, 64, 32, 60000, 600000 };
+
+	Graphics::FrameBuffer frame(camera.screen.width, camera.screen.height);
+	utilities::Stopwatch stopwatch;
+	try
+	{
+		std::cout << "Waiting for workers on port " << port << std::endl;
+		Graphics::Rendering::renderDistributed(camera, context, settings, frame);
+	}
+	catch (const std::runtime_error& error)
+	{
+		std::cout << error.what() << std::endl;
+		return false;
+	}
+	std::cout << "Render time: " << stopwatch.lap() << " ms" << std::endl;
+	return Graphics::Rendering::writePPM(frame, outputFile);
+}
+
+bool ParseNumber(const char* argument, unsigned long long minimum, unsigned long long maximum, unsigned long long& valueOut)
+{
+	// strtoull skips the spaces and accepts a sign, only digits are taken here
+	if (!std::isdigit(static_cast<unsigned char>(argument[0])))
+	{
+		return false;
+	}
+	char* end = nullptr;
+	errno = 0;
+	const unsigned long long value = std::strtoull(argument, &end, 10);
+	if (*end != '\0' || errno == ERANGE || value < minimum || value > maximum)
+	{
+		return false;
+	}
+	valueOut = value;
+	return true;
+}
 
 void printWelcomeMessage()
 {
@@ -224,6 +583,25 @@ void printWelcomeMessage()
 	std::cout << "- Q, E: to move along the Y-axis" << std::endl;
 	std::cout << std::endl;
 
+	std::cout << "Prism commands:" << std::endl;
+	std::cout << "- Z, X: to turn around their vertical axis" << std::endl;
+	std::cout << "- Run with --optics to replace the prism mesh by an analytic prism, ball and lenses, which do not turn" << std::endl;
+	std::cout << "- Run with --out-of-core <megabytes> to keep the meshes in a file, with at most that much of them in memory" << std::endl;
+	std::cout << "- Run with --sort-rays to trace the reflected and refracted rays of a tile together, sorted by direction and origin" << std::endl;
+	std::cout << std::endl;
+
+	std::cout << "Shading commands:" << std::endl;
+	std::cout << "- C, V: to dim or brighten the ambiant light" << std::endl;
+	std::cout << "- Run with --lookdev to shade the frame again instead of tracing it, which needs much more memory" << std::endl;
+	std::cout << "- Run with --denoise to trace fewer wavelengths and filter their noise, which is faster" << std::endl;
+	std::cout << std::endl;
+
+	std::cout << "Batch mode:" << std::endl;
+	std::cout << "- Run with --batch <directory> to write a camera orbit and a dispersion sweep there without the window" << std::endl;
+	std::cout << "- Run with --coordinator <port> <file> to write a still traced by the processes run with --worker <host> <port>" << std::endl;
+	std::cout << "- Run with --shared-memory <name> to publish the frames for other processes instead of opening the window" << std::endl;
+	std::cout << std::endl;
+
 	std::cout << "Please be sure to hold the button down during the rendering process" << std::endl;
 	std::cout << "It usually takes a few seconds to display a 500x500 window" << std::endl;
 	std::cout << std::endl;
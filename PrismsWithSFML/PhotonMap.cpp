@@ -0,0 +1,276 @@
+#include "stdafx.h"
+#include "PhotonMap.h"
+
+// Defines the functions declared in its PhotonMap.h
+// All the functions descriptions could be found there
+
+#include "GeometryStore.h"
+#include "GraphicsFunctions.h"
+#include "Profiler.h"
+#include <atomic>
+
+namespace Graphics
+{
+	namespace Raytracing
+	{
+		// Photons traced by a task, in a fixed number so that the photons do not depend on the number of threads
+		constexpr int PHOTON_CHUNK_SIZE = 4096;
+
+		uint32_t PhotonMap::cellHash(int x, int y, int z) const
+		{
+			return (static_cast<uint32_t>(x) * 73856093u ^ static_cast<uint32_t>(y) * 19349663u ^ static_cast<uint32_t>(z) * 83492791u) & tableMask;
+		}
+
+		void PhotonMap::build(const std::vector<Photon>& photonList, float radius, utilities::ThreadPool& pool)
+		{
+			PROFILE_ZONE("Photon map build");
+			gatherRadius = radius;
+			cellSize = 2 * radius;
+			photons.clear();
+			cellStarts.clear();
+			if (photonList.empty())
+			{
+				return;
+			}
+
+			// twice as many entries as photons keeps the collisions of the hash rare
+			uint32_t tableSize = 1;
+			while (tableSize < 2 * photonList.size())
+			{
+				tableSize <<= 1;
+			}
+			tableMask = tableSize - 1;
+
+			// COUNTING
+			const int photonCount = static_cast<int>(photonList.size());
+			std::vector<uint32_t> hashes(photonCount);
+			std::vector<std::atomic<int>> counts(tableSize);
+			pool.parallelFor(0, photonCount, PHOTON_CHUNK_SIZE, [&](int begin, int end) {
+				for (int i = begin; i < end; ++i)
+				{
+					const vec3 cell = glm::floor(photonList[i].position / cellSize);
+					hashes[i] = cellHash(static_cast<int>(cell.x), static_cast<int>(cell.y), static_cast<int>(cell.z));
+					counts[hashes[i]].fetch_add(1, std::memory_order_relaxed);
+				}
+			});
+
+			cellStarts.resize(tableSize + 1);
+			cellStarts[0] = 0;
+			for (uint32_t i = 0; i < tableSize; ++i)
+			{
+				cellStarts[i + 1] = cellStarts[i] + counts[i].load(std::memory_order_relaxed);
+			}
+
+			// SCATTERING
+			// the counters are reused as the next free place of each cell
+			std::vector<int> order(photonCount);
+			pool.parallelFor(0, static_cast<int>(tableSize), PHOTON_CHUNK_SIZE, [&](int begin, int end) {
+				for (int i = begin; i < end; ++i)
+				{
+					counts[i].store(cellStarts[i], std::memory_order_relaxed);
+				}
+			});
+			pool.parallelFor(0, photonCount, PHOTON_CHUNK_SIZE, [&](int begin, int end) {
+				for (int i = begin; i < end; ++i)
+				{
+					order[counts[hashes[i]].fetch_add(1, std::memory_order_relaxed)] = i;
+				}
+			});
+
+			// the threads fill a cell in any order, the photons are sorted back to the order of the list
+			photons.resize(photonCount);
+			pool.parallelFor(0, static_cast<int>(tableSize), PHOTON_CHUNK_SIZE, [&](int begin, int end) {
+				for (int i = begin; i < end; ++i)
+				{
+					std::sort(order.begin() + cellStarts[i], order.begin() + cellStarts[i + 1]);
+					for (int j = cellStarts[i]; j < cellStarts[i + 1]; ++j)
+					{
+						photons[j] = photonList[order[j]];
+					}
+				}
+			});
+		}
+
+		glm_color_t PhotonMap::irradiance(const vec3& position, const vec3& normal) const
+		{
+			glm_color_t power = COLOR_BLACK;
+			if (photons.empty())
+			{
+				return power;
+			}
+
+			// the cells are twice as large as the radius, so the disk overlaps at most two of them along each axis
+			const vec3 firstCell = glm::floor((position - vec3(gatherRadius)) / cellSize);
+			const float radiusSquared = gatherRadius * gatherRadius;
+			uint32_t visitedHashes[8];
+			int visitedCount = 0;
+			for (int corner = 0; corner < 8; ++corner)
+			{
+				const uint32_t hash = cellHash(
+					static_cast<int>(firstCell.x) + (corner & 1),
+					static_cast<int>(firstCell.y) + ((corner >> 1) & 1),
+					static_cast<int>(firstCell.z) + ((corner >> 2) & 1));
+				// two cells may share their hash, their photons are only counted once
+				if (std::find(visitedHashes, visitedHashes + visitedCount, hash) != visitedHashes + visitedCount)
+				{
+					continue;
+				}
+				visitedHashes[visitedCount++] = hash;
+
+				for (int i = cellStarts[hash]; i < cellStarts[hash + 1]; ++i)
+				{
+					const Photon& photon = photons[i];
+					const vec3 offset = photon.position - position;
+					if (glm::dot(offset, offset) <= radiusSquared && glm::dot(photon.direction, normal) < 0)
+					{
+						power += photon.power;
+					}
+				}
+			}
+			return power / (PI * radiusSquared);
+		}
+
+
+		// Return the bounds of the dielectric objects of the scene, empty if there is none
+		BoundingBox dielectricBounds(const Scene& scene)
+		{
+			BoundingBox bounds{};
+			for (const Triangle& triangle : scene.polygons)
+			{
+				if (triangle.material->refractionCoeff > 0)
+				{
+					bounds.expand(triangleBounds(triangle));
+				}
+			}
+			for (const Instance& instance : scene.instances)
+			{
+				// the materials of a stored mesh are known without mapping it
+				const Mesh& mesh = scene.meshes[instance.meshIndex];
+				const bool isDielectric = instance.materialOverride != nullptr
+					? instance.materialOverride->refractionCoeff > 0
+					: mesh.storedChunk >= 0
+					? std::any_of(scene.geometryStorePtr->materials(mesh.storedChunk).begin(), scene.geometryStorePtr->materials(mesh.storedChunk).end(),
+						[](const Material* material) { return material->refractionCoeff > 0; })
+					: std::any_of(mesh.triangles.begin(), mesh.triangles.end(), [](const Triangle& triangle) { return triangle.material->refractionCoeff > 0; });
+				if (isDielectric)
+				{
+					bounds.expand(instance.worldBounds);
+				}
+			}
+			for (const Shape& shape : scene.shapes)
+			{
+				if (shape.material->refractionCoeff > 0)
+				{
+					bounds.expand(shape.bounds);
+				}
+			}
+			return bounds;
+		}
+
+		// Follow a photon of a given wavelength through the dielectric objects until it lands on a diffuse surface
+		// Return true if it has to be kept, the photon is then filled out with where it landed
+		bool tracePhoton(const Scene& scene, Ray ray, float wavelength, int maxBounces, Sampling::RandomStream& random, Photon& photonOut)
+		{
+			bool isCaustic = false;
+			for (int bounce = 0; bounce <= maxBounces; ++bounce)
+			{
+				Intersection hit{};
+				if (!FindClosestIntersection(scene, ray, hit))
+				{
+					return false;
+				}
+
+				const Material* materialPtr = hit.materialPtr;
+				if (materialPtr->refractionCoeff <= 0)
+				{
+					photonOut.position = hit.position;
+					photonOut.direction = ray.direction;
+					return isCaustic && materialPtr->diffuseCoeff > 0;
+				}
+
+				// the photon is reflected, refracted or absorbed according to the weights of its wavelength
+				const DielectricInterface interface = dielectricInterface(ray.direction, hit.normal, materialPtr->cauchyRefractiveIndex(wavelength));
+				const float refractionWeight = materialPtr->refractionCoeff * (1 - interface.reflectance);
+				const float reflectionWeight = materialPtr->reflectionCoeff + materialPtr->refractionCoeff * interface.reflectance;
+				const float choice = random.uniform();
+				if (choice >= refractionWeight + reflectionWeight)
+				{
+					return false;
+				}
+				ray = Ray(hit.position, choice < refractionWeight ? interface.refractedDirection : interface.reflectedDirection);
+				isCaustic = true;
+			}
+			return false;
+		}
+
+		void emitCausticPhotons(const Scene& scene, const PhotonMapSettings& settings, uint32_t frameIndex, utilities::ThreadPool& pool, PhotonMap& photonMap)
+		{
+			PROFILE_ZONE("Caustics");
+			std::vector<Photon> photons{};
+			const BoundingBox targetBounds = dielectricBounds(scene);
+			if (settings.photonCount <= 0 || targetBounds.min.x > targetBounds.max.x)
+			{
+				photonMap.build(photons, settings.gatherRadius, pool);
+				return;
+			}
+
+			// the photons are aimed at the sphere holding the dielectric objects
+			// the ones of a directional light start outside of the whole scene so that everything in their way is hit
+			BoundingBox sceneBounds = targetBounds;
+			if (!scene.polygonsBVH.nodes.empty())
+			{
+				sceneBounds.expand(scene.polygonsBVH.nodes[0].bounds);
+			}
+			if (!scene.instancesBVH.nodes.empty())
+			{
+				sceneBounds.expand(scene.instancesBVH.nodes[0].bounds);
+			}
+			if (!scene.shapesBVH.nodes.empty())
+			{
+				sceneBounds.expand(scene.shapesBVH.nodes[0].bounds);
+			}
+			const vec3 targetCenter = targetBounds.centroid();
+			const float targetRadius = 0.5f * glm::length(targetBounds.max - targetBounds.min);
+			const float startDistance = glm::length(sceneBounds.max - sceneBounds.min);
+
+			const Light& light = scene.lightSource;
+			const int chunkCount = (settings.photonCount + PHOTON_CHUNK_SIZE - 1) / PHOTON_CHUNK_SIZE;
+			std::vector<std::vector<Photon>> chunkPhotons(chunkCount);
+			const float spectrumOffset = Sampling::radicalInverse(frameIndex);
+			pool.parallelFor(0, chunkCount, 1, [&](int chunkBegin, int chunkEnd) {
+				for (int chunk = chunkBegin; chunk < chunkEnd; ++chunk)
+				{
+					PROFILE_ZONE("Photon tracing");
+					const int photonEnd = std::min((chunk + 1) * PHOTON_CHUNK_SIZE, settings.photonCount);
+					for (int i = chunk * PHOTON_CHUNK_SIZE; i < photonEnd; ++i)
+					{
+						Sampling::RandomStream random(Sampling::hash(static_cast<uint32_t>(i)), frameIndex);
+						vec3 start{};
+						vec3 direction{};
+						const float sampledMeasure = light.samplePhoton(targetCenter, targetRadius, startDistance, random.uniform(), random.uniform(), start, direction);
+
+						// the wavelengths evenly cover the visible spectrum, shifted at each frame
+						const float spectralPosition = Sampling::radicalInverse(static_cast<uint32_t>(i)) + spectrumOffset;
+						const float wavelength = Dispersion::VISIBLE_SPECTRUM_START
+							+ (spectralPosition - std::floor(spectralPosition)) * (Dispersion::VISIBLE_SPECTRUM_END - Dispersion::VISIBLE_SPECTRUM_START);
+
+						Photon photon{};
+						if (tracePhoton(scene, Ray(start, direction), wavelength, settings.maxBounces, random, photon))
+						{
+							// the photon carries its share of the light that would reach the point if nothing deviated it
+							const float share = light.falloff(photon.position) * light.photonFootprint(photon.position, sampledMeasure) / settings.photonCount;
+							photon.power = share * light.color * Dispersion::WavelengthRGBFilter(wavelength);
+							chunkPhotons[chunk].push_back(photon);
+						}
+					}
+				}
+			});
+
+			for (const std::vector<Photon>& chunk : chunkPhotons)
+			{
+				photons.insert(photons.end(), chunk.begin(), chunk.end());
+			}
+			photonMap.build(photons, settings.gatherRadius, pool);
+		}
+	}
+}
@@ -0,0 +1,82 @@
+#ifndef PHOTON_MAP_H
+#define PHOTON_MAP_H
+
+// Defines the photons traced from the light through the dielectric objects to render their caustics,
+// such as the spectrum a prism casts on the floor
+
+#include "stdafx.h"
+#include "GraphicsModel.h"
+#include "ThreadPool.h"
+
+namespace Graphics
+{
+	namespace Raytracing
+	{
+		// Parameters of the caustics
+		struct PhotonMapSettings
+		{
+			// number of photons emitted towards the dielectric objects at each frame, 0 to disable the caustics
+			int photonCount;
+			// radius of the disk on which the photons around a point are gathered
+			float gatherRadius;
+			// a photon is dropped after that many reflections and refractions
+			int maxBounces;
+		};
+
+		// Light of one wavelength landing on a diffuse surface
+		struct Photon
+		{
+			vec3 position;
+			// direction the photon was travelling in
+			vec3 direction;
+			glm_color_t power;
+		};
+
+		// Photons indexed by a hashed grid whose cells are as large as the gathering disk
+		// Gathering around a point only looks at the eight cells the disk may overlap
+		class PhotonMap
+		{
+		public:
+			PhotonMap() :
+				gatherRadius(0),
+				cellSize(1),
+				tableMask(0)
+			{}
+
+			// Index the photons for gathers of a given radius, the grid is built in parallel by the pool
+			// The photons of a cell keep their order in the list, so the map does not depend on the number of threads
+			void build(const std::vector<Photon>& photonList, float radius, utilities::ThreadPool& pool);
+
+			// Return the irradiance brought to a point of a surface by the photons arriving on the side of its normal
+			glm_color_t irradiance(const vec3& position, const vec3& normal) const;
+
+			bool empty() const
+			{
+				return photons.empty();
+			}
+
+			size_t size() const
+			{
+				return photons.size();
+			}
+
+		private:
+			float gatherRadius;
+			float cellSize;
+			uint32_t tableMask;
+			// the photons of the cells hashed to i lie from cellStarts[i] to cellStarts[i + 1]
+			std::vector<int> cellStarts;
+			std::vector<Photon> photons;
+
+			uint32_t cellHash(int x, int y, int z) const;
+		};
+
+		// Trace photons of random wavelengths from the light of the scene towards its dielectric objects
+		// The photons landing on a diffuse surface after at least one reflection or refraction on them are kept in the map,
+		// the others are already accounted for by the direct light
+		// The photons are traced in parallel by the pool, the frame index changes their random numbers
+		void emitCausticPhotons(const Scene& scene, const PhotonMapSettings& settings, uint32_t frameIndex, utilities::ThreadPool& pool, PhotonMap& photonMap);
+	}
+}
+
+#endif
@@ -0,0 +1,61 @@
+#include "stdafx.h"
+#include "PixelOrder.h"
+
+// Defines the functions declared in its PixelOrder.h
+// All the functions descriptions could be found there
+
+namespace Graphics
+{
+	namespace Rendering
+	{
+		void PixelOrder::update(int width, int height)
+		{
+			if (width == this->width && height == this->height)
+			{
+				return;
+			}
+			this->width = width;
+			this->height = height;
+
+			// the curves cover the smallest power of two squares holding the screen and the tiles,
+			// the points lying outside are skipped
+			const int tilesX = (width + tileSize - 1) / tileSize;
+			const int tilesY = (height + tileSize - 1) / tileSize;
+			uint32_t tileCurveSize = 1;
+			while (tileCurveSize < static_cast<uint32_t>(std::max(tilesX, tilesY)))
+			{
+				tileCurveSize *= 2;
+			}
+
+			pixelIndices.clear();
+			pixelIndices.reserve(width * height);
+			tileStarts.clear();
+			tileStarts.reserve(tilesX * tilesY + 1);
+			for (uint32_t tileCode = 0; tileCode < tileCurveSize * tileCurveSize; ++tileCode)
+			{
+				int tileX = 0;
+				int tileY = 0;
+				mortonDecode(tileCode, tileX, tileY);
+				if (tileX >= tilesX || tileY >= tilesY)
+				{
+					continue;
+				}
+
+				tileStarts.push_back(static_cast<int>(pixelIndices.size()));
+				for (uint32_t pixelCode = 0; pixelCode < static_cast<uint32_t>(tileSize * tileSize); ++pixelCode)
+				{
+					int x = 0;
+					int y = 0;
+					mortonDecode(pixelCode, x, y);
+					x += tileX * tileSize;
+					y += tileY * tileSize;
+					if (x < width && y < height)
+					{
+						pixelIndices.push_back(y * width + x);
+					}
+				}
+			}
+			tileStarts.push_back(static_cast<int>(pixelIndices.size()));
+		}
+	}
+}
@@ -0,0 +1,81 @@
+#ifndef PIXEL_ORDER_H
+#define PIXEL_ORDER_H
+
+// Order in which the pixels of the screen are traced
+
+#include "stdafx.h"
+#include <cstdint>
+#include <vector>
+
+namespace Graphics
+{
+	namespace Rendering
+	{
+		// Walks the screen tile by tile, the tiles and the pixels inside each of them following a Morton curve
+		// Consecutive rays then leave through neighbouring pixels and meet the same nodes and triangles,
+		// which stay in the caches instead of being evicted by the rest of a long row
+		// The order is computed once per screen size
+		class PixelOrder
+		{
+		public:
+			// side of the square tiles, in pixels, a power of two
+			const int tileSize;
+
+			PixelOrder(int tileSize = 16) :
+				tileSize(tileSize),
+				width(0),
+				height(0),
+				tileStarts(1, 0)
+			{}
+
+			// Compute the order again if the size of the screen changed
+			void update(int width, int height);
+
+			int tileCount() const
+			{
+				return static_cast<int>(tileStarts.size()) - 1;
+			}
+
+			// Index, row by row in the frame, of every pixel in the order they are traced
+			// The pixels of the tile i are the ones in [tileBegin(i), tileEnd(i))
+			const std::vector<int>& pixels() const
+			{
+				return pixelIndices;
+			}
+
+			int tileBegin(int tile) const
+			{
+				return tileStarts[tile];
+			}
+
+			int tileEnd(int tile) const
+			{
+				return tileStarts[tile + 1];
+			}
+
+		private:
+			int width;
+			int height;
+			std::vector<int> pixelIndices;
+			// first pixel of every tile, followed by the number of pixels
+			std::vector<int> tileStarts;
+		};
+
+		// Coordinates of the point at the given position along the Morton curve, its even bits are x and its odd bits are y
+		inline void mortonDecode(uint32_t code, int& x, int& y)
+		{
+			auto compact = [](uint32_t bits) {
+				bits &= 0x55555555u;
+				bits = (bits | (bits >> 1)) & 0x33333333u;
+				bits = (bits | (bits >> 2)) & 0x0f0f0f0fu;
+				bits = (bits | (bits >> 4)) & 0x00ff00ffu;
+				bits = (bits | (bits >> 8)) & 0x0000ffffu;
+				return static_cast<int>(bits);
+			};
+			x = compact(code);
+			y = compact(code >> 1);
+		}
+	}
+}
+
+#endif
@@ -0,0 +1,200 @@
+#include "stdafx.h"
+#include "Profiler.h"
+
+// Defines the functions declared in its Profiler.h
+// All the functions descriptions could be found there
+
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <sstream>
+
+namespace utilities
+{
+	namespace
+	{
+		// the names are literals, only the characters that would break the JSON are escaped
+		std::string escapeJSON(const char* text)
+		{
+			std::string escaped{};
+			for (const char* character = text; *character != '\0'; ++character)
+			{
+				if (*character == '"' || *character == '\\')
+				{
+					escaped += '\\';
+				}
+				escaped += *character;
+			}
+			return escaped;
+		}
+	}
+
+	constexpr size_t Profiler::RING_SIZE;
+	constexpr size_t Profiler::MAX_ZONES;
+
+	Profiler::Profiler() :
+		origin(std::chrono::steady_clock::now()),
+		currentLevel(static_cast<int>(ProfileLevel::OFF)),
+		frameStartNs(0)
+	{}
+
+	Profiler& Profiler::instance()
+	{
+		static Profiler profiler;
+		return profiler;
+	}
+
+	class Profiler::ThreadBufferOwner
+	{
+	public:
+		ThreadBuffer* bufferPtr = nullptr;
+
+		ThreadBufferOwner() = default;
+		ThreadBufferOwner(const ThreadBufferOwner&) = delete;
+		ThreadBufferOwner& operator=(const ThreadBufferOwner&) = delete;
+
+		~ThreadBufferOwner()
+		{
+			if (bufferPtr != nullptr)
+			{
+				Profiler& profiler = Profiler::instance();
+				std::lock_guard<std::mutex> lock(profiler.mutex);
+				profiler.freeBuffers.push_back(bufferPtr);
+			}
+		}
+	};
+
+	Profiler::ThreadBuffer& Profiler::threadBuffer()
+	{
+		thread_local ThreadBufferOwner owner{};
+		if (owner.bufferPtr == nullptr)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (!freeBuffers.empty())
+			{
+				// the zones of the thread that exited are kept, and shown on its line of the trace
+				owner.bufferPtr = freeBuffers.back();
+				freeBuffers.pop_back();
+			}
+			else
+			{
+				buffers.push_back(std::unique_ptr<ThreadBuffer>(new ThreadBuffer()));
+				ThreadBuffer& buffer = *buffers.back();
+				buffer.threadIndex = static_cast<int>(buffers.size()) - 1;
+				buffer.eventCount = 0;
+				buffer.zoneCount = 0;
+				owner.bufferPtr = &buffer;
+			}
+		}
+		return *owner.bufferPtr;
+	}
+
+	void Profiler::record(const char* name, int64_t startNs, int64_t endNs)
+	{
+		ThreadBuffer& buffer = threadBuffer();
+
+		// TRACE
+		const size_t eventIndex = buffer.eventCount.load(std::memory_order_relaxed);
+		buffer.events[eventIndex % RING_SIZE] = Event{ name, startNs, endNs - startNs };
+		buffer.eventCount.store(eventIndex + 1, std::memory_order_release);
+
+		// SUMMARY
+		// the zones are found by the address of their name, a thread only meets a few of them
+		const size_t zoneCount = buffer.zoneCount.load(std::memory_order_relaxed);
+		size_t zoneIndex = 0;
+		while (zoneIndex < zoneCount && buffer.zones[zoneIndex].name.load(std::memory_order_relaxed) != name)
+		{
+			++zoneIndex;
+		}
+		if (zoneIndex == zoneCount)
+		{
+			if (zoneCount == MAX_ZONES)
+			{
+				return;
+			}
+			ZoneTotal& zone = buffer.zones[zoneIndex];
+			zone.name.store(name, std::memory_order_relaxed);
+			zone.totalNs.store(0, std::memory_order_relaxed);
+			zone.count.store(0, std::memory_order_relaxed);
+			buffer.zoneCount.store(zoneCount + 1, std::memory_order_release);
+		}
+		ZoneTotal& zone = buffer.zones[zoneIndex];
+		zone.totalNs.fetch_add(endNs - startNs, std::memory_order_relaxed);
+		zone.count.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	std::string Profiler::endFrame()
+	{
+		const int64_t frameEndNs = now();
+
+		// the same name may come from several literals, the zones are merged by their text
+		std::map<std::string, std::pair<int64_t, int64_t>> totals{};
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			for (const std::unique_ptr<ThreadBuffer>& buffer : buffers)
+			{
+				const size_t zoneCount = buffer->zoneCount.load(std::memory_order_acquire);
+				for (size_t i = 0; i < zoneCount; ++i)
+				{
+					ZoneTotal& zone = buffer->zones[i];
+					const int64_t count = zone.count.exchange(0, std::memory_order_relaxed);
+					const int64_t totalNs = zone.totalNs.exchange(0, std::memory_order_relaxed);
+					if (count > 0)
+					{
+						std::pair<int64_t, int64_t>& total = totals[zone.name.load(std::memory_order_relaxed)];
+						total.first += totalNs;
+						total.second += count;
+					}
+				}
+			}
+		}
+
+		std::vector<std::pair<std::string, std::pair<int64_t, int64_t>>> sortedTotals(totals.begin(), totals.end());
+		std::sort(sortedTotals.begin(), sortedTotals.end(),
+			[](const std::pair<std::string, std::pair<int64_t, int64_t>>& a, const std::pair<std::string, std::pair<int64_t, int64_t>>& b) {
+				return a.second.first > b.second.first;
+			});
+
+		// the zones run by several threads may add up to more than the frame
+		std::ostringstream summary{};
+		summary << std::fixed << std::setprecision(2);
+		summary << "Frame: " << (frameEndNs - frameStartNs) * 1e-6 << " ms";
+		for (const std::pair<std::string, std::pair<int64_t, int64_t>>& total : sortedTotals)
+		{
+			summary << "\n  " << total.first << ": " << total.second.first * 1e-6 << " ms in " << total.second.second << " zones";
+		}
+		frameStartNs = frameEndNs;
+		return summary.str();
+	}
+
+	bool Profiler::exportChromeTrace(const std::string& path) const
+	{
+		std::ofstream file(path);
+		if (!file)
+		{
+			return false;
+		}
+
+		// complete events, with their start and duration in microseconds
+		file << std::fixed << std::setprecision(3);
+		file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+		bool isFirst = true;
+		std::lock_guard<std::mutex> lock(mutex);
+		for (const std::unique_ptr<ThreadBuffer>& buffer : buffers)
+		{
+			const size_t eventCount = buffer->eventCount.load(std::memory_order_acquire);
+			const size_t firstEvent = eventCount > RING_SIZE ? eventCount - RING_SIZE : 0;
+			for (size_t i = firstEvent; i < eventCount; ++i)
+			{
+				const Event& event = buffer->events[i % RING_SIZE];
+				file << (isFirst ? "\n" : ",\n")
+					<< "{\"name\":\"" << escapeJSON(event.name) << "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << buffer->threadIndex
+					<< ",\"ts\":" << event.startNs * 1e-3 << ",\"dur\":" << event.durationNs * 1e-3 << "}";
+				isFirst = false;
+			}
+		}
+		file << "\n]}\n";
+		return static_cast<bool>(file);
+	}
+}
@@ -0,0 +1,143 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+// Instrumentation of the interactive loop and of the headless runs
+// Scoped zones are timed on the steady clock, every thread records them in its own buffers without any lock,
+// and they are exported as a Chrome trace (chrome://tracing or Perfetto) or summed up at the end of every frame
+
+#include "stdafx.h"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+namespace utilities
+{
+	// Zones recorded by the profiler, the detailed ones are hit for every ray and cost more
+	enum class ProfileLevel
+	{
+		OFF = 0,
+		FRAME = 1,
+		DETAIL = 2
+	};
+
+	// Records the zones of all the threads
+	// The buffers are read by the summaries and the exports, which are expected between frames while the other threads wait
+	class Profiler
+	{
+	public:
+		// Number of zones kept by every thread for the trace, the oldest ones are overwritten
+		static constexpr size_t RING_SIZE = 1 << 16;
+		// Number of different zone names a thread can sum up
+		static constexpr size_t MAX_ZONES = 64;
+
+		// Zone recorded in the ring of a thread
+		struct Event
+		{
+			const char* name;
+			int64_t startNs;
+			int64_t durationNs;
+		};
+
+		static Profiler& instance();
+
+		void setLevel(ProfileLevel level)
+		{
+			currentLevel.store(static_cast<int>(level), std::memory_order_relaxed);
+		}
+
+		bool isEnabled(ProfileLevel level) const
+		{
+			return currentLevel.load(std::memory_order_relaxed) >= static_cast<int>(level);
+		}
+
+		// Nanoseconds on the steady clock since the profiler was created
+		int64_t now() const
+		{
+			return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - origin).count();
+		}
+
+		// Record a zone of the current thread, the name must outlive the profiler, like a string literal
+		void record(const char* name, int64_t startNs, int64_t endNs);
+
+		// Close the current frame and return its summary: the time spent in every zone by all the threads, and how many times
+		// The sums of the frame are then cleared
+		std::string endFrame();
+
+		// Write the zones still in the rings as a Chrome trace
+		// Return false if the file could not be written
+		bool exportChromeTrace(const std::string& path) const;
+
+	private:
+		// sum of a zone over the current frame
+		struct ZoneTotal
+		{
+			std::atomic<const char*> name;
+			std::atomic<int64_t> totalNs;
+			std::atomic<int64_t> count;
+		};
+
+		// written by its thread only
+		struct ThreadBuffer
+		{
+			int threadIndex;
+			std::atomic<size_t> eventCount;
+			Event events[RING_SIZE];
+			std::atomic<size_t> zoneCount;
+			ZoneTotal zones[MAX_ZONES];
+		};
+
+		// hands the buffer of a thread back to the profiler when the thread exits
+		class ThreadBufferOwner;
+
+		Profiler();
+
+		// Return the buffer of the current thread, taken at its first zone from the ones of the threads that exited,
+		// or created if there are none, so that the pools created again do not add buffers
+		ThreadBuffer& threadBuffer();
+
+		std::chrono::steady_clock::time_point origin;
+		std::atomic<int> currentLevel;
+		int64_t frameStartNs;
+		mutable std::mutex mutex;
+		std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+		// buffers of the threads that exited, whose zones stay in the summary and the trace until a thread reuses them
+		std::vector<ThreadBuffer*> freeBuffers;
+	};
+
+	// Times its own lifetime as a zone of the profiler
+	class ProfileZone
+	{
+	public:
+		ProfileZone(const char* name, ProfileLevel level) :
+			name(Profiler::instance().isEnabled(level) ? name : nullptr),
+			startNs(this->name != nullptr ? Profiler::instance().now() : 0)
+		{}
+
+		~ProfileZone()
+		{
+			if (name != nullptr)
+			{
+				Profiler::instance().record(name, startNs, Profiler::instance().now());
+			}
+		}
+
+		ProfileZone(const ProfileZone&) = delete;
+		ProfileZone& operator=(const ProfileZone&) = delete;
+
+	private:
+		const char* name;
+		int64_t startNs;
+	};
+}
+
+#define PROFILE_ZONE_NAME_JOIN(a, b) a##b
+#define PROFILE_ZONE_NAME(line) PROFILE_ZONE_NAME_JOIN(profileZone, line)
+
+// Time the rest of the enclosing scope
+#define PROFILE_ZONE(name) utilities::ProfileZone PROFILE_ZONE_NAME(__LINE__)(name, utilities::ProfileLevel::FRAME)
+// Time the rest of the enclosing scope when the details are profiled, for the zones hit by every ray
+#define PROFILE_DETAIL_ZONE(name) utilities::ProfileZone PROFILE_ZONE_NAME(__LINE__)(name, utilities::ProfileLevel::DETAIL)
+
+#endif
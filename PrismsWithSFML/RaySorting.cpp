@@ -0,0 +1,55 @@
+#include "stdafx.h"
+#include "RaySorting.h"
+#include "GraphicsFunctions.h"
+
+// Defines the functions declared in its RaySorting.h
+// All the functions descriptions could be found there
+
+#include <algorithm>
+
+namespace Graphics
+{
+	namespace Raytracing
+	{
+		// Spread the 9 lowest bits of the value so that two zeros follow each of them
+		inline uint32_t spreadBits(uint32_t value)
+		{
+			value &= 0x1ff;
+			value = (value | (value << 16)) & 0x030000ffu;
+			value = (value | (value << 8)) & 0x0300f00fu;
+			value = (value | (value << 4)) & 0x030c30c3u;
+			value = (value | (value << 2)) & 0x09249249u;
+			return value;
+		}
+
+		uint32_t rayCoherenceKey(const Ray& ray, const BoundingBox& bounds)
+		{
+			const uint32_t octant = (ray.direction.x < 0 ? 1u : 0u) | (ray.direction.y < 0 ? 2u : 0u) | (ray.direction.z < 0 ? 4u : 0u);
+
+			// the origins are quantized on a grid of 512 cells along each axis of the bounds
+			const vec3 extent = glm::max(bounds.max - bounds.min, vec3(static_cast<float>(EPSILON)));
+			const vec3 cell = glm::clamp((ray.start - bounds.min) / extent, 0.f, 1.f) * 511.f;
+			const uint32_t morton = spreadBits(static_cast<uint32_t>(cell.x))
+				| (spreadBits(static_cast<uint32_t>(cell.y)) << 1)
+				| (spreadBits(static_cast<uint32_t>(cell.z)) << 2);
+			return (octant << 27) | morton;
+		}
+
+		void coherentRayOrder(const std::vector<Ray>& rays, const BoundingBox& bounds, std::vector<uint32_t>& orderOut)
+		{
+			// the index of the ray is kept below its key, which also makes the order deterministic
+			std::vector<uint64_t> entries(rays.size());
+			for (size_t i = 0; i < rays.size(); ++i)
+			{
+				entries[i] = (static_cast<uint64_t>(rayCoherenceKey(rays[i], bounds)) << 32) | i;
+			}
+			std::sort(entries.begin(), entries.end());
+
+			orderOut.resize(rays.size());
+			for (size_t i = 0; i < entries.size(); ++i)
+			{
+				orderOut[i] = static_cast<uint32_t>(entries[i] & 0xffffffffu);
+			}
+		}
+	}
+}
@@ -0,0 +1,24 @@
+#ifndef RAY_SORTING_H
+#define RAY_SORTING_H
+
+// Reordering of batches of incoherent rays before they are traced
+
+#include "stdafx.h"
+#include "GraphicsModel.h"
+#include <cstdint>
+#include <vector>
+
+namespace Graphics
+{
+	namespace Raytracing
+	{
+		// Key bringing together the rays that go the same way from close origins
+		// Its highest 3 bits are the octant of the direction, the others the Morton code of the origin in the bounds
+		uint32_t rayCoherenceKey(const Ray& ray, const BoundingBox& bounds);
+
+		// Fill out the indices of the rays in the order of their coherence keys, the rays with equal keys keeping their order
+		void coherentRayOrder(const std::vector<Ray>& rays, const BoundingBox& bounds, std::vector<uint32_t>& orderOut);
+	}
+}
+
+#endif
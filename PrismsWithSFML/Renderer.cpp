@@ -0,0 +1,219 @@
+#include "stdafx.h"
+#include "Renderer.h"
+#include "GeometryStore.h"
+#include "GraphicsFunctions.h"
+#include "Profiler.h"
+#include "SampleBatch.h"
+
+// Defines the functions declared in its Renderer.h
+// All the functions descriptions could be found there
+
+namespace Graphics
+{
+	namespace Rendering
+	{
+		void Renderer::render(const Scene& scene, const Camera& camera, FrameBuffer& frame)
+		{
+			PROFILE_ZONE("Render");
+
+			// RESHADING
+			// the frame is shaded again from its cached points, and starts a new accumulation
+			if (isShadingChanged)
+			{
+				isShadingChanged = false;
+				if (cacheShading && shadingCache.canReshade(scene, camera, frame))
+				{
+					shadingCache.reshade(scene, frame, pool);
+					if (progressive)
+					{
+						accumulation.reset(frame.width, frame.height);
+						accumulation.accumulate(frame);
+					}
+					reprojection.invalidate();
+					// the guides of the last traced frame are the ones of the frame shaded again
+					if (denoise)
+					{
+						denoiser.filter(frame, pool);
+					}
+					return;
+				}
+				resetAccumulation();
+			}
+
+			// ACCUMULATION
+			// the accumulated frames are only valid for the view they were rendered from
+			const bool isNewView = !camera.hasSameView(lastCamera) || accumulation.frameCount == 0;
+			if (isNewView)
+			{
+				accumulation.reset(frame.width, frame.height);
+				lastCamera = camera;
+			}
+			if (isConverged())
+			{
+				accumulation.resolve(frame);
+				if (denoise)
+				{
+					denoiser.filter(frame, pool, accumulation.frameCount);
+				}
+				return;
+			}
+
+			// GEOMETRY
+			// the stored meshes the last frame needed are mapped back before the rays reach them
+			if (scene.geometryStorePtr != nullptr)
+			{
+				scene.geometryStorePtr->prefetch();
+			}
+
+			dispersionMask.update(scene, camera, context, pool);
+			tileCulling.update(scene, camera, pool);
+
+			// CAUSTICS
+			const uint32_t frameIndex = static_cast<uint32_t>(accumulation.frameCount);
+			Raytracing::emitCausticPhotons(scene, caustics, frameIndex, pool, photonMap);
+
+			// REPROJECTION
+			// the surface points of a new view are found even without a last frame, so that the next view can reuse this one
+			const std::vector<char>* reusedPixelsPtr = nullptr;
+			if (reusePreviousFrame && isNewView && reprojection.reproject(scene, camera, tileCulling, frame, pool) > 0)
+			{
+				reusedPixelsPtr = &reprojection.reusedPixels();
+			}
+
+			// TRACING
+			if (cacheShading)
+			{
+				shadingCache.begin(scene, camera, frame.width, frame.height, pool.threadCount());
+			}
+			if (denoise)
+			{
+				denoiser.beginFrame(frame.width, frame.height);
+			}
+			for (unsigned i = 0; i < threadContexts.size(); ++i)
+			{
+				threadContexts[i] = context;
+				threadContexts[i].photonMapPtr = photonMap.empty() ? nullptr : &photonMap;
+				threadContexts[i].shadingRecorderPtr = cacheShading ? &shadingCache.recorder(i) : nullptr;
+			}
+			// the settings of a sample, the context of its thread holding the ones shared by all the samples
+			auto setUpSample = [&](float x, float y, const Raytracing::TraceContext& threadContext) {
+				Raytracing::BatchSample sample{};
+				sample.x = x;
+				sample.y = y;
+				sample.pixel = static_cast<int>(y) * frame.width + static_cast<int>(x);
+				sample.isDispersive = dispersionMask.isDispersive(x, y);
+				sample.candidatesPtr = tileCulling.candidates(x, y);
+				// the guide is written by the sample at the center of the pixel
+				// a pixel is only traced by one thread at a time, by the base samples and then by the refinement of its tile
+				const bool isPixelCenter = x - std::floor(x) == 0.5f && y - std::floor(y) == 0.5f;
+				sample.guidePtr = denoise && isPixelCenter ? &denoiser.guide(sample.pixel) : nullptr;
+				const uint32_t seed = Sampling::sampleSeed(x, y);
+				sample.random.reseed(seed, frameIndex);
+				sample.spectralOffset = threadContext.spectralOffset;
+				if (progressive)
+				{
+					// the frames follow a low-discrepancy sequence of offsets, shifted by a random amount for each sample
+					const float offset = Sampling::radicalInverse(frameIndex) + Sampling::hash(seed) * (1.f / 4294967296.f);
+					sample.spectralOffset = offset - std::floor(offset);
+				}
+				return sample;
+			};
+
+			// nothing lies in the frustum of the tile of the sample, its primary ray hits nothing
+			auto isCulled = [](Raytracing::BatchSample& sample, Raytracing::TraceContext& threadContext) {
+				if (sample.candidatesPtr == nullptr || !sample.candidatesPtr->empty())
+				{
+					return false;
+				}
+				if (threadContext.shadingRecorderPtr != nullptr)
+				{
+					threadContext.shadingRecorderPtr->beginSample(sample.pixel);
+				}
+				if (sample.guidePtr != nullptr)
+				{
+					sample.guidePtr->surfaceId = Raytracing::SurfaceGuide::BACKGROUND;
+				}
+				return true;
+			};
+
+			if (batchSecondaryRays)
+			{
+				sampler.renderBatches(frame, [&](const std::vector<SamplePosition>& positions, std::vector<glm_color_t>& colorsOut) {
+					Raytracing::TraceContext& threadContext = threadContexts[pool.threadIndex()];
+					std::vector<Raytracing::BatchSample> samples{};
+					std::vector<int> sampleIndices{};
+					colorsOut.assign(positions.size(), COLOR_BLACK);
+					for (size_t i = 0; i < positions.size(); ++i)
+					{
+						Raytracing::BatchSample sample = setUpSample(positions[i].x, positions[i].y, threadContext);
+						if (!isCulled(sample, threadContext))
+						{
+							samples.push_back(sample);
+							sampleIndices.push_back(static_cast<int>(i));
+						}
+					}
+					Raytracing::traceSampleBatch(camera, scene, samples, threadContext);
+					for (size_t i = 0; i < samples.size(); ++i)
+					{
+						colorsOut[sampleIndices[i]] = samples[i].color;
+					}
+				}, pool, reusedPixelsPtr);
+			}
+			else
+			{
+				sampler.render(frame, [&](float x, float y) {
+					Raytracing::TraceContext& threadContext = threadContexts[pool.threadIndex()];
+					Raytracing::BatchSample sample = setUpSample(x, y, threadContext);
+					if (isCulled(sample, threadContext))
+					{
+						return COLOR_BLACK;
+					}
+					if (threadContext.shadingRecorderPtr != nullptr)
+					{
+						threadContext.shadingRecorderPtr->beginSample(sample.pixel);
+					}
+					threadContext.primaryGuidePtr = sample.guidePtr;
+					threadContext.spectralVariancePtr = nullptr;
+					threadContext.primaryCandidatesPtr = sample.candidatesPtr;
+					threadContext.swapRandomStream(sample.random);
+					const float spectralOffset = threadContext.spectralOffset;
+					threadContext.spectralOffset = sample.spectralOffset;
+
+					const glm_color_t color = sample.isDispersive ? Raytracing::Dispersion::raytraceRecursiveWithDispersion(camera, scene, x, y, threadContext)
+						: Raytracing::raytraceRecursive(camera, scene, x, y, threadContext);
+					threadContext.spectralOffset = spectralOffset;
+					return color;
+				}, pool, reusedPixelsPtr);
+			}
+			if (cacheShading)
+			{
+				shadingCache.end(reusedPixelsPtr == nullptr);
+			}
+
+			// nothing traced in the frame is kept, the scratch memory is reused by the next one
+			for (Raytracing::TraceContext& threadContext : threadContexts)
+			{
+				threadContext.arena.reset();
+			}
+
+			if (progressive)
+			{
+				PROFILE_ZONE("Accumulation");
+				accumulation.accumulate(frame);
+				accumulation.resolve(frame);
+			}
+
+			// the averaged colors are the ones reused by the next view
+			if (reusePreviousFrame)
+			{
+				reprojection.store(camera, frame);
+			}
+
+			// DENOISING
+			if (denoise)
+			{
+				denoiser.filter(frame, pool, progressive ? accumulation.frameCount : 1);
+			}
+		}
+	}
+}
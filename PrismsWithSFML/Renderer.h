@@ -0,0 +1,129 @@
+#ifndef RENDERER_H
+#define RENDERER_H
+
+// Produces the images of a scene from the raytracing functions
+
+#include "stdafx.h"
+#include "GraphicsModel.h"
+#include "FrameBuffer.h"
+#include "AdaptiveSampling.h"
+#include "DispersionMask.h"
+#include "TileCulling.h"
+#include "Reprojection.h"
+#include "ShadingCache.h"
+#include "Denoiser.h"
+#include "PhotonMap.h"
+#include "ThreadPool.h"
+
+namespace Graphics
+{
+	namespace Rendering
+	{
+		// Renders the frames of the interactive loop
+		// Keeps the data that can be reused from a frame to the next one
+		class Renderer
+		{
+		public:
+			// settings copied to the context of each thread at every frame
+			Raytracing::TraceContext context;
+			AdaptiveSampler sampler;
+			DispersionMask dispersionMask;
+			TileCulling tileCulling;
+			TemporalReprojection reprojection;
+			Denoiser denoiser;
+			// photons emitted at every frame to light the diffuse surfaces with the caustics of the dielectric objects
+			Raytracing::PhotonMapSettings caustics;
+			// When enabled, the wavelengths are jittered at each frame and the frames are averaged while the view does not change
+			bool progressive;
+			// Once that many frames are accumulated the image is considered converged and nothing more is traced, 0 for no limit
+			int targetFrames;
+			// When enabled, a new view starts from the colors of the last frame that it still sees, and only traces the others
+			bool reusePreviousFrame;
+			// When enabled, the shading points of every fully traced frame are kept so that the frame following a shading edit,
+			// see shadingChanged, is shaded from them instead of being traced, at the cost of their memory
+			bool cacheShading;
+			// When enabled, the displayed frames are filtered by the denoiser guided by the surfaces seen through the pixel centers,
+			// so that fewer wavelengths can be traced per sample, the accumulated and reused colors staying unfiltered
+			bool denoise;
+			// When enabled, the samples of a tile are traced together depth after depth, the secondary rays of a depth
+			// being sorted by direction and origin before they are traced, see traceSampleBatch
+			// The colors are the ones of the recursive functions, only the random choices are drawn in another order
+			bool batchSecondaryRays;
+
+			Renderer(utilities::ThreadPool& pool, const Raytracing::TraceContext& context, const AdaptiveSamplingSettings& antiAliasing,
+				const Raytracing::PhotonMapSettings& caustics, bool progressive = true, int targetFrames = 0, int maskTileSize = 16, int cullingTileSize = 16) :
+				context(context),
+				sampler(antiAliasing),
+				dispersionMask(maskTileSize),
+				tileCulling(cullingTileSize),
+				caustics(caustics),
+				progressive(progressive),
+				targetFrames(targetFrames),
+				reusePreviousFrame(true),
+				cacheShading(false),
+				denoise(false),
+				batchSecondaryRays(false),
+				isShadingChanged(false),
+				pool(pool),
+				threadContexts(pool.threadCount(), context),
+				accumulation(0, 0),
+				lastCamera(vec3(0, 0, 0), 0, Screen{ 0, 0 })
+			{}
+
+			// Render the scene seen by the camera in the frame
+			// The dispersive raytracing is only used inside the dispersion mask, the cheaper one elsewhere
+			// The primary rays are only intersected with the primitives in the frustum of their tile
+			// The caustics are gathered from photons traced again at each frame, their noise averages out with the frames
+			// Each sample draws its random numbers from its own stream, so the image does not depend on the number of threads
+			void render(const Scene& scene, const Camera& camera, FrameBuffer& frame);
+
+			// Restart the accumulation, to be called when the scene changes
+			// The last frame is not reused either
+			void resetAccumulation()
+			{
+				accumulation.frameCount = 0;
+				reprojection.invalidate();
+				shadingCache.invalidate();
+			}
+
+			// Restart the accumulation from the last traced frame shaded again, to be called when only the shading changed:
+			// the ambiant, specular coefficients or shininess of materials, the ambiant light or the color of the light source
+			// When the shading points of the frame are not cached, it is traced again as after resetAccumulation
+			void shadingChanged()
+			{
+				isShadingChanged = true;
+			}
+
+			// Restart the accumulation, the dispersion mask and the culling, to be called when objects of the scene move
+			void resetGeometry()
+			{
+				dispersionMask.invalidate();
+				tileCulling.invalidate();
+				resetAccumulation();
+			}
+
+			// Number of frames averaged in the last rendered image
+			int accumulatedFrames() const
+			{
+				return accumulation.frameCount;
+			}
+
+			// Return true when the target number of frames is reached and the image stops changing
+			bool isConverged() const
+			{
+				return progressive && targetFrames > 0 && accumulation.frameCount >= targetFrames;
+			}
+
+		private:
+			bool isShadingChanged;
+			utilities::ThreadPool& pool;
+			std::vector<Raytracing::TraceContext> threadContexts;
+			AccumulationBuffer accumulation;
+			Raytracing::PhotonMap photonMap;
+			ShadingCache shadingCache;
+			Camera lastCamera;
+		};
+	}
+}
+
+#endif
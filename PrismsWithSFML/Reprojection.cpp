@@ -0,0 +1,148 @@
+#include "stdafx.h"
+#include "Reprojection.h"
+#include "GraphicsFunctions.h"
+#include "BVH.h"
+#include "Profiler.h"
+
+// Defines the functions declared in its Reprojection.h
+// All the functions descriptions could be found there
+
+#include <atomic>
+
+namespace Graphics
+{
+	namespace Rendering
+	{
+		int TemporalReprojection::reproject(const Scene& scene, const Camera& camera, const TileCulling& tileCulling, FrameBuffer& frame, utilities::ThreadPool& pool)
+		{
+			PROFILE_ZONE("Reprojection");
+
+			const size_t pixelCount = static_cast<size_t>(frame.width) * frame.height;
+			currentCamera = camera;
+			currentDistances.assign(pixelCount, 0);
+			isViewDependent.assign(pixelCount, 0);
+			isReused.assign(pixelCount, 0);
+			currentAges.assign(pixelCount, 0);
+
+			// SURFACE POINTS
+			pool.parallelFor(0, frame.height, 1, [&](int rowBegin, int rowEnd) {
+				for (int y = rowBegin; y < rowEnd; ++y)
+				{
+					for (int x = 0; x < frame.width; ++x)
+					{
+						const float sampleX = x + 0.5f;
+						const float sampleY = y + 0.5f;
+						const Raytracing::CandidatePrimitives* candidatesPtr = tileCulling.candidates(sampleX, sampleY);
+						if (candidatesPtr != nullptr && candidatesPtr->empty())
+						{
+							continue;
+						}
+						const Raytracing::Ray ray = Raytracing::primaryRay(camera, sampleX, sampleY);
+						Raytracing::Intersection intersection{};
+						const bool isHit = candidatesPtr != nullptr
+							? Raytracing::FindClosestIntersection(scene, *candidatesPtr, ray, intersection)
+							: Raytracing::FindClosestIntersection(scene, ray, intersection);
+						if (isHit)
+						{
+							const size_t pixelIndex = static_cast<size_t>(y) * frame.width + x;
+							const Material* materialPtr = intersection.materialPtr;
+							currentDistances[pixelIndex] = intersection.distance;
+							isViewDependent[pixelIndex] = materialPtr->refractionCoeff > 0 || materialPtr->reflectionCoeff > maxReflection;
+						}
+					}
+				}
+			});
+			if (!isValid)
+			{
+				return 0;
+			}
+
+			// REUSE
+			// the last frame is seen from the history camera: a point is projected back with its inverse rotation
+			const glm::mat3 historyInverseRotation = glm::transpose(historyCamera.rotationMatrix);
+			std::atomic<int> reusedCount(0);
+			pool.parallelFor(0, frame.height, 1, [&](int rowBegin, int rowEnd) {
+				int rowReusedCount = 0;
+				for (int y = rowBegin; y < rowEnd; ++y)
+				{
+					for (int x = 0; x < frame.width; ++x)
+					{
+						const size_t pixelIndex = static_cast<size_t>(y) * frame.width + x;
+						const float distance = currentDistances[pixelIndex];
+						if (distance == 0)
+						{
+							continue;
+						}
+
+						// the refined samples of a pixel next to a refractive surface or to the background may see them,
+						// and its color in the last frame was mixed with theirs
+						bool isNearEdge = false;
+						for (int j = std::max(y - 1, 0); j <= std::min(y + 1, frame.height - 1); ++j)
+						{
+							for (int i = std::max(x - 1, 0); i <= std::min(x + 1, frame.width - 1); ++i)
+							{
+								const size_t neighbourIndex = static_cast<size_t>(j) * frame.width + i;
+								isNearEdge = isNearEdge || isViewDependent[neighbourIndex] != 0 || currentDistances[neighbourIndex] == 0;
+							}
+						}
+						if (isNearEdge)
+						{
+							continue;
+						}
+
+						// same projection as the primary rays
+						const vec3 position = camera.position + distance * Raytracing::primaryRay(camera, x + 0.5f, y + 0.5f).direction;
+						const vec3 historyDirection = historyInverseRotation * (position - historyCamera.position);
+						if (historyDirection.z <= 0)
+						{
+							continue;
+						}
+						const float historyX = historyDirection.x * historyCamera.focal / historyDirection.z + historyCamera.screen.width / 2;
+						const float historyY = historyDirection.y * historyCamera.focal / historyDirection.z + historyCamera.screen.height / 2;
+						if (historyX < 0 || historyY < 0 || historyX >= historyColors.width || historyY >= historyColors.height)
+						{
+							continue;
+						}
+						const size_t historyIndex = static_cast<size_t>(historyY) * historyColors.width + static_cast<size_t>(historyX);
+
+						// another surface was seen there: the point was hidden, or lies on an edge
+						const float historyDistance = historyDistances[historyIndex];
+						if (historyDistance == 0 || std::fabs(glm::length(historyDirection) - historyDistance) > depthTolerance * historyDistance
+							|| historyAges[historyIndex] >= maxReuse)
+						{
+							continue;
+						}
+						frame.at(x, y) = historyColors.pixels[historyIndex];
+						isReused[pixelIndex] = 1;
+						currentAges[pixelIndex] = historyAges[historyIndex] + 1;
+						++rowReusedCount;
+					}
+				}
+				reusedCount += rowReusedCount;
+			});
+			return reusedCount;
+		}
+
+		void TemporalReprojection::store(const Camera& camera, const FrameBuffer& frame)
+		{
+			if (!camera.hasSameView(currentCamera) || currentDistances.size() != frame.pixels.size())
+			{
+				isValid = false;
+				return;
+			}
+
+			historyCamera = currentCamera;
+			historyColors = frame;
+			historyDistances = currentDistances;
+			historyAges.resize(currentAges.size());
+			for (size_t i = 0; i < currentAges.size(); ++i)
+			{
+				historyAges[i] = isReused[i] != 0 ? currentAges[i] : 0;
+			}
+			isValid = true;
+
+			// the next frames of the same view trace every pixel
+			std::fill(isReused.begin(), isReused.end(), 0);
+		}
+	}
+}
@@ -0,0 +1,82 @@
+#ifndef REPROJECTION_H
+#define REPROJECTION_H
+
+// Reuse of the previous frame while the camera moves
+
+#include "stdafx.h"
+#include "GraphicsModel.h"
+#include "FrameBuffer.h"
+#include "TileCulling.h"
+#include "ThreadPool.h"
+
+namespace Graphics
+{
+	namespace Rendering
+	{
+		// Keeps the colors of the last frame with the surface point seen by every pixel,
+		// and warps them into the view of a new camera
+		// A pixel is reused when it sees the same point as a pixel of the last frame, which only holds for the view-independent shading:
+		// the pixels on or next to refractive and mirror surfaces or to the background, and the disoccluded ones are traced again
+		// The faint reflections and the specular highlights of the other surfaces are reused as they are
+		class TemporalReprojection
+		{
+		public:
+			// a color reused that many frames in a row is traced again, so that the errors of the warping do not build up
+			const int maxReuse;
+			// a point is the one a pixel of the last frame saw if their distances to the last camera differ by less than this fraction
+			const float depthTolerance;
+			// surfaces reflecting more than that share of the light are mirrors, whose colors change with the view
+			const float maxReflection;
+
+			TemporalReprojection(int maxReuse = 8, float depthTolerance = 0.02f, float maxReflection = 0.1f) :
+				maxReuse(maxReuse),
+				depthTolerance(depthTolerance),
+				maxReflection(maxReflection),
+				isValid(false),
+				currentCamera(vec3(0, 0, 0), 0, Screen{ 0, 0 }),
+				historyCamera(vec3(0, 0, 0), 0, Screen{ 0, 0 }),
+				historyColors(0, 0)
+			{}
+
+			// Find the surface point seen by the center of every pixel of the camera,
+			// then copy in the frame the colors of the last frame that can be reused and flag them in the reused pixels
+			// The primary rays are only intersected with the candidates of their tile, and are traced in parallel by the pool
+			// Return the number of reused pixels
+			int reproject(const Scene& scene, const Camera& camera, const TileCulling& tileCulling, FrameBuffer& frame, utilities::ThreadPool& pool);
+
+			// Keep the frame as the last one, to be called once it is complete
+			// The camera must be the one of the last reprojection, the pixels that were not flagged as reused are considered traced
+			void store(const Camera& camera, const FrameBuffer& frame);
+
+			// Forget the last frame, to be called when the shading of the scene changes
+			void invalidate()
+			{
+				isValid = false;
+			}
+
+			// Flags of the pixels filled by the last reprojection, row by row
+			const std::vector<char>& reusedPixels() const
+			{
+				return isReused;
+			}
+
+		private:
+			bool isValid;
+
+			// distance to the camera of the surface point seen by every pixel of the last reprojection, 0 if the pixel saw nothing
+			Camera currentCamera;
+			std::vector<float> currentDistances;
+			std::vector<char> isViewDependent;
+			std::vector<char> isReused;
+			std::vector<int> currentAges;
+
+			// last stored frame, with the number of frames each of its colors was reused
+			Camera historyCamera;
+			FrameBuffer historyColors;
+			std::vector<float> historyDistances;
+			std::vector<int> historyAges;
+		};
+	}
+}
+
+#endif
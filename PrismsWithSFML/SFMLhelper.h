@@ -5,6 +5,7 @@
 #include <SFML/Graphics.hpp>
 #include "IDrawingManager.h"
 #include "IInputManager.h"
+#include "Profiler.h"
 
 // Class that makes it possible to use SFML by implementing the provided interfaces
 class SFML_Manager : public IDrawingManager, public IInputManager
@@ -45,6 +46,7 @@ public:
 
 	void display() override
 	{
+		PROFILE_ZONE("Texture upload");
 		texture->update(*image);
 		sprite->setTexture(*texture);
 		window->draw(*sprite);
@@ -95,6 +97,14 @@ public:
 			return sf::Keyboard::isKeyPressed(sf::Keyboard::G);
 		case Key::H:
 			return sf::Keyboard::isKeyPressed(sf::Keyboard::H);
+		case Key::Z:
+			return sf::Keyboard::isKeyPressed(sf::Keyboard::Z);
+		case Key::X:
+			return sf::Keyboard::isKeyPressed(sf::Keyboard::X);
+		case Key::C:
+			return sf::Keyboard::isKeyPressed(sf::Keyboard::C);
+		case Key::V:
+			return sf::Keyboard::isKeyPressed(sf::Keyboard::V);
 		case Key::LEFT_ARROW:
 			return sf::Keyboard::isKeyPressed(sf::Keyboard::Left);
 		case Key::RIGHT_ARROW:
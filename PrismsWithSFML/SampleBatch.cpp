@@ -0,0 +1,369 @@
+#include "stdafx.h"
+#include "SampleBatch.h"
+#include "GraphicsFunctions.h"
+#include "RaySorting.h"
+#include "ShadingCache.h"
+
+// Defines the functions declared in its SampleBatch.h
+// All the functions descriptions could be found there
+
+#include <algorithm>
+
+namespace Graphics
+{
+	namespace Raytracing
+	{
+		namespace
+		{
+			// Ray waiting for its depth to be traced, with what the recursive functions would pass down to it
+			struct PathRay
+			{
+				Ray ray;
+				int sample;
+				// factor of the color of the ray in the color of its sample
+				glm_color_t factor;
+				// traced by the dispersive functions, a polychromatic ray can then be split
+				bool isDispersive;
+				bool isMonochromatic;
+				float wavelength;
+				// wavelength of the split writing the variance of the sample that the ray comes from, -1 for none
+				int spectralBranch;
+				// index of the hit among the known hits of its depth when the ray belongs to a dispersion cone, -1 when it must be traced
+				int knownHit;
+			};
+
+			// Shading point of a sample, added to the recorder once the sample is traced
+			struct BatchRecord
+			{
+				int sample;
+				ShadingRecord record;
+			};
+
+			// What the rays of the samples of a batch add up to, and the rays of the next depth
+			struct BatchState
+			{
+				std::vector<BatchSample>& samples;
+				std::vector<PathRay> nextRays;
+				std::vector<Intersection> nextKnownHits;
+				// variance of the guide of every sample, taken by the first spectral split of its path
+				std::vector<float*> variancePtrs;
+				// split writing the variance of every sample, and what each of its wavelengths brings to the sample
+				std::vector<float*> splitVariancePtrs;
+				std::vector<glm_color_t> spectralContributions;
+				std::vector<BatchRecord> records;
+
+				BatchState(std::vector<BatchSample>& samples) :
+					samples(samples),
+					variancePtrs(samples.size(), nullptr),
+					splitVariancePtrs(samples.size(), nullptr)
+				{}
+			};
+
+			// Return the bounds of the primitives of the scene
+			BoundingBox sceneBounds(const Scene& scene)
+			{
+				BoundingBox bounds{};
+				if (!scene.polygonsBVH.nodes.empty())
+				{
+					bounds.expand(scene.polygonsBVH.nodes[0].bounds);
+				}
+				if (!scene.instancesBVH.nodes.empty())
+				{
+					bounds.expand(scene.instancesBVH.nodes[0].bounds);
+				}
+				if (!scene.shapesBVH.nodes.empty())
+				{
+					bounds.expand(scene.shapesBVH.nodes[0].bounds);
+				}
+				return bounds;
+			}
+
+			// Ray of a branch, which keeps the sample, the model, the wavelength and the split of the ray it comes from
+			inline PathRay branchRay(const PathRay& pathRay, const Ray& ray, const glm_color_t& factor)
+			{
+				PathRay branch = pathRay;
+				branch.ray = ray;
+				branch.factor = factor;
+				branch.knownHit = -1;
+				return branch;
+			}
+
+			// Largest weight the RGB filter gives to a wavelength
+			inline float filterWeight(const glm_color_t& filter)
+			{
+				return std::max(filter.r, std::max(filter.g, filter.b));
+			}
+
+			// Shade the hit of the ray as shadeIntersectionWithDispersion, or raytrace_recursive_call for a ray that is not dispersive,
+			// the rays of its branches being left to the next depth with the factor the recursion would give their colors
+			void shadePathRay(const Scene& scene, const PathRay& pathRay, const Intersection& hit, TraceContext& context, const int depth, BatchState& state)
+			{
+				const Ray& incidentRay = pathRay.ray;
+				const vec3 normal = hit.normal;
+				const Material* materialPtr = hit.materialPtr;
+				utilities::ArenaScope scratch(context.arena);
+
+				// SPLIT BETWEEN REFLECTION AND REFRACTION
+				const int nbInterpolation = context.spectralSamples;
+				const bool isSpectrumSplit = pathRay.isDispersive && !pathRay.isMonochromatic && materialPtr->isDispersive();
+				utilities::ArenaVector<float> wavelengths{ utilities::ArenaAllocator<float>(context.arena) };
+				utilities::ArenaVector<DielectricInterface> spectralInterfaces{ utilities::ArenaAllocator<DielectricInterface>(context.arena) };
+				DielectricInterface interface{};
+
+				float reflectionWeight = materialPtr->reflectionCoeff;
+				float refractionWeight = 0;
+				float reflectance{};
+				if (materialPtr->refractionCoeff > 0)
+				{
+					if (isSpectrumSplit)
+					{
+						wavelengths.resize(nbInterpolation);
+						Dispersion::stratifiedWavelengths(context.spectralOffset, wavelengths);
+						spectralInterfaces.reserve(nbInterpolation);
+						for (float wavelength : wavelengths)
+						{
+							spectralInterfaces.push_back(dielectricInterface(incidentRay.direction, normal, materialPtr->cauchyRefractiveIndex(wavelength)));
+							reflectance += spectralInterfaces.back().reflectance / nbInterpolation;
+						}
+					}
+					else
+					{
+						const float refractiveIndex = pathRay.isMonochromatic ? materialPtr->cauchyRefractiveIndex(pathRay.wavelength) : materialPtr->refractiveIndex;
+						interface = dielectricInterface(incidentRay.direction, normal, refractiveIndex);
+						reflectance = interface.reflectance;
+					}
+					reflectionWeight += materialPtr->refractionCoeff * reflectance;
+					refractionWeight = materialPtr->refractionCoeff * (1 - reflectance);
+				}
+				selectInterfaceBranch(context, reflectionWeight, refractionWeight);
+
+				// the filter of a monochromatic ray scales its whole color, the one of its branches included
+				const glm_color_t wavelengthFilter = pathRay.isMonochromatic ? Dispersion::WavelengthRGBFilter(pathRay.wavelength) : glm_color_t(1, 1, 1);
+				const glm_color_t factor = pathRay.factor * wavelengthFilter;
+
+				// REFLECTION
+				const float reflectionThroughput = incidentRay.throughput * reflectionWeight * (pathRay.isMonochromatic ? filterWeight(wavelengthFilter) : 1);
+				const float reflectionContinuation = pathContinuationFactor(context, reflectionThroughput, depth + 1);
+				if (reflectionContinuation > 0)
+				{
+					state.nextRays.push_back(branchRay(pathRay, Ray(hit.position, glm::reflect(incidentRay.direction, normal), reflectionThroughput * reflectionContinuation),
+						factor * (reflectionWeight * reflectionContinuation)));
+				}
+
+				// REFRACTION
+				if (refractionWeight > 0 && !isSpectrumSplit)
+				{
+					// the refracted ray is traced by the functions that are not dispersive, as refractedLight does
+					const float weight = incidentRay.throughput * refractionWeight;
+					const float continuation = interface.totalInternalReflection ? 0 : pathContinuationFactor(context, weight, depth + 1);
+					if (continuation > 0)
+					{
+						PathRay refractedRay = branchRay(pathRay, Ray(hit.position, interface.refractedDirection, weight * continuation), factor * (refractionWeight * continuation));
+						refractedRay.isDispersive = false;
+						refractedRay.isMonochromatic = false;
+						state.nextRays.push_back(refractedRay);
+					}
+				}
+				else if (refractionWeight > 0)
+				{
+					Intersection coneTarget{};
+					const bool isConeCoherent = context.dispersionCones && Dispersion::dispersionConeTarget(scene, hit, spectralInterfaces, context.arena, coneTarget);
+
+					// the deeper splits leave the variance of the sample to this one
+					const int sample = pathRay.sample;
+					const bool isVarianceSplit = state.variancePtrs[sample] != nullptr;
+					if (isVarianceSplit)
+					{
+						state.splitVariancePtrs[sample] = state.variancePtrs[sample];
+						state.variancePtrs[sample] = nullptr;
+						if (state.spectralContributions.empty())
+						{
+							state.spectralContributions.assign(state.samples.size() * nbInterpolation, COLOR_BLACK);
+						}
+					}
+
+					for (size_t i = 0; i < wavelengths.size(); ++i)
+					{
+						if (spectralInterfaces[i].totalInternalReflection)
+						{
+							continue;
+						}
+						const float share = (1 - spectralInterfaces[i].reflectance) / ((1 - reflectance) * nbInterpolation);
+						const float weight = incidentRay.throughput * (refractionWeight * share) * filterWeight(Dispersion::WavelengthRGBFilter(wavelengths[i]));
+						const float continuation = pathContinuationFactor(context, weight, depth + 1);
+						if (continuation == 0)
+						{
+							continue;
+						}
+
+						PathRay refractedRay = branchRay(pathRay, Ray(hit.position, spectralInterfaces[i].refractedDirection, weight * continuation),
+							factor * (refractionWeight * share * continuation));
+						refractedRay.isMonochromatic = true;
+						refractedRay.wavelength = wavelengths[i];
+						if (isVarianceSplit)
+						{
+							refractedRay.spectralBranch = static_cast<int>(i);
+						}
+						if (isConeCoherent)
+						{
+							// intersection with the plane of the known triangle
+							Intersection knownHit = coneTarget;
+							knownHit.distance = dot(coneTarget.position - refractedRay.ray.start, coneTarget.normal) / dot(refractedRay.ray.direction, coneTarget.normal);
+							knownHit.position = refractedRay.ray.pointOnRay(knownHit.distance);
+							refractedRay.knownHit = static_cast<int>(state.nextKnownHits.size());
+							state.nextKnownHits.push_back(knownHit);
+						}
+						state.nextRays.push_back(refractedRay);
+					}
+				}
+
+				// DIRECT ILLUMINATION
+				const float lightAttenuation = directLightAttenuation(hit, scene, scene.lightSource);
+				const glm_color_t originLightColor = scene.lightSource.color * lightAttenuation;
+				const vec3 lightDir = -scene.lightSource.getIncidentRayDirection(hit.position);
+				const glm_color_t causticColor = causticIllumination(hit, context);
+				const glm_color_t illuminationColor = phongIllumination(hit, scene.ambiantLight, originLightColor, lightDir) + causticColor;
+
+				// ADDING TOGETHER
+				const glm_color_t contribution = factor * illuminationColor;
+				state.samples[pathRay.sample].color += contribution;
+				if (pathRay.spectralBranch >= 0)
+				{
+					state.spectralContributions[pathRay.sample * nbInterpolation + pathRay.spectralBranch] += contribution;
+				}
+				if (context.shadingRecorderPtr != nullptr)
+				{
+					state.records.push_back(BatchRecord{ pathRay.sample, ShadingRecord{ factor, normal, incidentRay.direction, lightDir, materialPtr, lightAttenuation, causticColor } });
+				}
+			}
+		}
+
+		void traceSampleBatch(const Camera& camera, const Scene& scene, std::vector<BatchSample>& samples, TraceContext& context)
+		{
+			BatchState state(samples);
+			const float spectralOffset = context.spectralOffset;
+			std::vector<PathRay> rays{};
+			rays.reserve(samples.size());
+			for (size_t i = 0; i < samples.size(); ++i)
+			{
+				samples[i].color = COLOR_BLACK;
+				if (context.depthMax > 0)
+				{
+					// the dispersive functions normalize the direction of the primary ray again when they make it a RayWave
+					const Ray primary = primaryRay(camera, samples[i].x, samples[i].y);
+					rays.push_back(PathRay{ samples[i].isDispersive ? Ray(primary.start, primary.direction) : primary, static_cast<int>(i), glm_color_t(1, 1, 1),
+						samples[i].isDispersive, false, 0, -1, -1 });
+				}
+			}
+
+			const BoundingBox bounds = sceneBounds(scene);
+			std::vector<Ray> depthRays{};
+			std::vector<uint32_t> order{};
+			std::vector<PathRay> sortedRays{};
+			std::vector<Intersection> knownHits{};
+			for (int depth = 0; !rays.empty(); ++depth)
+			{
+				// REORDERING
+				// the primary rays of a tile are already coherent, the rays of the deeper depths are traced and shaded
+				// in the order of their coherence keys, each one adding its light to its own sample
+				if (depth > 0)
+				{
+					depthRays.clear();
+					for (const PathRay& pathRay : rays)
+					{
+						depthRays.push_back(pathRay.ray);
+					}
+					coherentRayOrder(depthRays, bounds, order);
+					sortedRays.clear();
+					for (const uint32_t rayIndex : order)
+					{
+						sortedRays.push_back(rays[rayIndex]);
+					}
+					std::swap(rays, sortedRays);
+				}
+
+				// INTERSECTION AND SHADING
+				// each sample draws from its own stream, whatever the order of the rays
+				state.nextRays.clear();
+				state.nextKnownHits.clear();
+				for (PathRay& pathRay : rays)
+				{
+					BatchSample& sample = samples[pathRay.sample];
+					Intersection hit{};
+					bool isHit = true;
+					if (depth == 0)
+					{
+						// the primary rays only meet the candidates of their tile
+						isHit = sample.candidatesPtr != nullptr ? FindClosestIntersection(scene, *sample.candidatesPtr, pathRay.ray, hit)
+							: FindClosestIntersection(scene, pathRay.ray, hit);
+
+						context.primaryGuidePtr = sample.guidePtr;
+						context.spectralVariancePtr = nullptr;
+						recordGuide(context, isHit ? &hit : nullptr);
+						state.variancePtrs[pathRay.sample] = context.spectralVariancePtr;
+						context.spectralVariancePtr = nullptr;
+					}
+					else if (pathRay.knownHit >= 0)
+					{
+						hit = knownHits[pathRay.knownHit];
+					}
+					else
+					{
+						isHit = FindClosestIntersection(scene, pathRay.ray, hit);
+					}
+					if (!isHit)
+					{
+						continue;
+					}
+
+					hit.rayPtr = &pathRay.ray;
+					context.spectralOffset = sample.spectralOffset;
+					context.swapRandomStream(sample.random);
+					shadePathRay(scene, pathRay, hit, context, depth, state);
+					context.swapRandomStream(sample.random);
+				}
+				std::swap(rays, state.nextRays);
+				std::swap(knownHits, state.nextKnownHits);
+			}
+
+			context.spectralOffset = spectralOffset;
+
+			// VARIANCE
+			// what every wavelength brings to the sample, scaled by their number, estimates the refracted light
+			const float count = static_cast<float>(context.spectralSamples);
+			for (size_t i = 0; i < samples.size(); ++i)
+			{
+				if (state.splitVariancePtrs[i] == nullptr || context.spectralSamples < 2)
+				{
+					continue;
+				}
+				glm_color_t refractedLightColor = COLOR_BLACK;
+				glm_color_t squaredEstimates = COLOR_BLACK;
+				for (int j = 0; j < context.spectralSamples; ++j)
+				{
+					const glm_color_t& wavelengthColor = state.spectralContributions[i * context.spectralSamples + j];
+					refractedLightColor += wavelengthColor;
+					squaredEstimates += (count * wavelengthColor) * (count * wavelengthColor);
+				}
+				const glm_color_t variance = glm::max(squaredEstimates - count * refractedLightColor * refractedLightColor, COLOR_BLACK) / (count * (count - 1));
+				*state.splitVariancePtrs[i] = variance.r + variance.g + variance.b;
+			}
+
+			// RECORDS
+			if (context.shadingRecorderPtr != nullptr)
+			{
+				std::stable_sort(state.records.begin(), state.records.end(),
+					[](const BatchRecord& a, const BatchRecord& b) { return a.sample < b.sample; });
+				size_t record = 0;
+				for (size_t i = 0; i < samples.size(); ++i)
+				{
+					context.shadingRecorderPtr->beginSample(samples[i].pixel);
+					for (; record < state.records.size() && state.records[record].sample == static_cast<int>(i); ++record)
+					{
+						context.shadingRecorderPtr->records.push_back(state.records[record].record);
+					}
+				}
+			}
+		}
+	}
+}
@@ -0,0 +1,46 @@
+#ifndef SAMPLE_BATCH_H
+#define SAMPLE_BATCH_H
+
+// Tracing of the samples of a tile together, depth after depth, so that their secondary rays can be reordered
+
+#include "stdafx.h"
+#include "GraphicsModel.h"
+#include <vector>
+
+namespace Graphics
+{
+	namespace Raytracing
+	{
+		// Sample traced in a batch, with the settings that the context holds for a sample traced alone
+		struct BatchSample
+		{
+			// floating point pixel coordinates
+			float x;
+			float y;
+			// pixel the shading records of the sample belong to
+			int pixel;
+			// traced with the dispersive model
+			bool isDispersive;
+			// primitives the primary ray may hit, nullptr to search the whole scene
+			const CandidatePrimitives* candidatesPtr;
+			// guide written by the primary ray, nullptr to write nothing
+			SurfaceGuide* guidePtr;
+			// position of the wavelengths inside their stratum, in [0,1)
+			float spectralOffset;
+			Sampling::RandomStream random;
+			// filled out by the tracing
+			glm_color_t color;
+		};
+
+		// Trace the samples with the settings of the context and fill out their colors, the ones the recursive functions give them
+		// The rays of a depth are traced and shaded before the rays they spawn: the primary rays in the order of the samples,
+		// then the reflected, refracted and spectral rays of all the samples in the order of their coherence keys,
+		// see rayCoherenceKey, each one adding its light to its own sample
+		// Each sample draws from its own stream, but breadth first, so the roulette and the stochastic interfaces
+		// make other choices than the recursive functions, and the variance of a guide is written by the shallowest spectral split
+		// The shading records of every sample are added to the recorder of the context once all its rays are traced
+		void traceSampleBatch(const Camera& camera, const Scene& scene, std::vector<BatchSample>& samples, TraceContext& context);
+	}
+}
+
+#endif
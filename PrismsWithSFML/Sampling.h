@@ -0,0 +1,90 @@
+#ifndef SAMPLING_H
+#define SAMPLING_H
+
+// Random and low-discrepancy numbers used by the Monte Carlo parts of the raytracing
+
+#include "stdafx.h"
+#include <cstdint>
+#include <cstring>
+
+namespace Graphics
+{
+	namespace Sampling
+	{
+		// Small and fast pseudo-random generator (PCG32 by M. O'Neill)
+		// Each seed gives an independent stream, so that the numbers used by a sample do not depend on the thread tracing it
+		class RandomStream
+		{
+		public:
+			RandomStream(uint64_t seed = 0, uint64_t sequence = 0)
+			{
+				reseed(seed, sequence);
+			}
+
+			// restart the generator on the stream defined by the seed and the sequence
+			void reseed(uint64_t seed, uint64_t sequence = 0)
+			{
+				state = 0;
+				increment = (sequence << 1u) | 1u;
+				next();
+				state += seed;
+				next();
+			}
+
+			// Return a random integer uniformly distributed on 32 bits
+			uint32_t next()
+			{
+				const uint64_t oldState = state;
+				state = oldState * 6364136223846793005ULL + increment;
+				const uint32_t xorShifted = static_cast<uint32_t>(((oldState >> 18u) ^ oldState) >> 27u);
+				const uint32_t rotation = static_cast<uint32_t>(oldState >> 59u);
+				return (xorShifted >> rotation) | (xorShifted << ((32 - rotation) & 31));
+			}
+
+			// Return a random number uniformly distributed in [0,1)
+			float uniform()
+			{
+				return (next() >> 8) * (1.f / 16777216.f);
+			}
+
+		private:
+			uint64_t state;
+			uint64_t increment;
+		};
+
+		// Return a well mixed hash of a 32 bits value
+		inline uint32_t hash(uint32_t value)
+		{
+			value ^= value >> 16;
+			value *= 0x7feb352dU;
+			value ^= value >> 15;
+			value *= 0x846ca68bU;
+			value ^= value >> 16;
+			return value;
+		}
+
+		// Return a seed identifying the sample traced at floating point pixel coordinates (x,y)
+		inline uint32_t sampleSeed(float x, float y)
+		{
+			uint32_t xBits{};
+			uint32_t yBits{};
+			std::memcpy(&xBits, &x, sizeof(float));
+			std::memcpy(&yBits, &y, sizeof(float));
+			return hash(xBits ^ hash(yBits));
+		}
+
+		// Return the i-th element of the base 2 van der Corput sequence, in [0,1)
+		// Successive elements evenly fill the interval
+		inline float radicalInverse(uint32_t index)
+		{
+			index = (index << 16u) | (index >> 16u);
+			index = ((index & 0x55555555u) << 1u) | ((index & 0xAAAAAAAAu) >> 1u);
+			index = ((index & 0x33333333u) << 2u) | ((index & 0xCCCCCCCCu) >> 2u);
+			index = ((index & 0x0F0F0F0Fu) << 4u) | ((index & 0xF0F0F0F0u) >> 4u);
+			index = ((index & 0x00FF00FFu) << 8u) | ((index & 0xFF00FF00u) >> 8u);
+			return (index >> 8) * (1.f / 16777216.f);
+		}
+	}
+}
+
+#endif
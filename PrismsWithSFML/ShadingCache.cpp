@@ -0,0 +1,107 @@
+#include "stdafx.h"
+#include "ShadingCache.h"
+#include "GraphicsFunctions.h"
+#include "Profiler.h"
+
+// Defines the functions declared in its ShadingCache.h
+// All the functions descriptions could be found there
+
+namespace Graphics
+{
+	namespace Rendering
+	{
+		void ShadingCache::begin(const Scene& scene, const Camera& camera, int width, int height, unsigned threadCount)
+		{
+			isValid = false;
+			this->camera = camera;
+			this->width = width;
+			this->height = height;
+			lightPosition = scene.lightSource.pos;
+			lightColor = scene.lightSource.color;
+
+			// the recorders keep their memory from a frame to the next one
+			recorders.resize(threadCount);
+			for (Raytracing::ShadingRecorder& recorder : recorders)
+			{
+				recorder.clear();
+			}
+		}
+
+		bool ShadingCache::canReshade(const Scene& scene, const Camera& camera, const FrameBuffer& frame) const
+		{
+			if (!isValid || !camera.hasSameView(this->camera) || frame.width != width || frame.height != height
+				|| scene.lightSource.pos != lightPosition)
+			{
+				return false;
+			}
+			for (int channel = 0; channel < 3; ++channel)
+			{
+				if (lightColor[channel] == 0 && scene.lightSource.color[channel] != 0)
+				{
+					return false;
+				}
+			}
+			return true;
+		}
+
+		void ShadingCache::reshade(const Scene& scene, FrameBuffer& frame, utilities::ThreadPool& pool)
+		{
+			PROFILE_ZONE("Reshade");
+
+			// the caustic photons carry the light color they were emitted with
+			glm_color_t causticScale{};
+			for (int channel = 0; channel < 3; ++channel)
+			{
+				causticScale[channel] = lightColor[channel] == 0 ? 0 : scene.lightSource.color[channel] / lightColor[channel];
+			}
+
+			// SAMPLES
+			sampleColors.resize(recorders.size());
+			for (size_t recorderIndex = 0; recorderIndex < recorders.size(); ++recorderIndex)
+			{
+				const Raytracing::ShadingRecorder& recorder = recorders[recorderIndex];
+				std::vector<glm_color_t>& colors = sampleColors[recorderIndex];
+				colors.resize(recorder.samples.size());
+				pool.parallelFor(0, static_cast<int>(recorder.samples.size()), 256, [&](int sampleBegin, int sampleEnd) {
+					for (int i = sampleBegin; i < sampleEnd; ++i)
+					{
+						const size_t recordEnd = (i + 1 < static_cast<int>(recorder.samples.size())) ? recorder.samples[i + 1].firstRecord : recorder.records.size();
+						glm_color_t color = COLOR_BLACK;
+						for (size_t r = recorder.samples[i].firstRecord; r < recordEnd; ++r)
+						{
+							const Raytracing::ShadingRecord& record = recorder.records[r];
+							const Raytracing::Ray viewRay(vec3(0, 0, 0), record.viewDirection);
+							Raytracing::Intersection intersection{};
+							intersection.normal = record.normal;
+							intersection.materialPtr = record.materialPtr;
+							intersection.rayPtr = &viewRay;
+
+							const glm_color_t directLight = scene.lightSource.color * record.lightAttenuation;
+							color += record.weight * (Raytracing::phongIllumination(intersection, scene.ambiantLight, directLight, record.lightDirection)
+								+ causticScale * record.causticColor);
+						}
+						colors[i] = color;
+					}
+				});
+			}
+
+			// AVERAGE
+			// the samples of a pixel may have been traced by several threads
+			std::vector<int> sampleCounts(width * height, 0);
+			frame.pixels.assign(width * height, COLOR_BLACK);
+			for (size_t recorderIndex = 0; recorderIndex < recorders.size(); ++recorderIndex)
+			{
+				const std::vector<Raytracing::ShadingRecorder::Sample>& samples = recorders[recorderIndex].samples;
+				for (size_t i = 0; i < samples.size(); ++i)
+				{
+					frame.pixels[samples[i].pixel] += sampleColors[recorderIndex][i];
+					++sampleCounts[samples[i].pixel];
+				}
+			}
+			for (size_t i = 0; i < frame.pixels.size(); ++i)
+			{
+				frame.pixels[i] /= static_cast<float>(std::max(sampleCounts[i], 1));
+			}
+		}
+	}
+}
@@ -0,0 +1,139 @@
+#ifndef SHADING_CACHE_H
+#define SHADING_CACHE_H
+
+// Re-evaluation of the shading of the last traced frame without tracing it again
+
+#include "stdafx.h"
+#include "GraphicsModel.h"
+#include "FrameBuffer.h"
+#include "ThreadPool.h"
+#include <vector>
+
+namespace Graphics
+{
+	namespace Raytracing
+	{
+		// Shading point met by a traced sample, with what its Phong illumination needs
+		struct ShadingRecord
+		{
+			// factor of the illumination of the point in the color of its sample:
+			// the weights of the branches leading to it and the filters of the wavelengths they carry
+			glm_color_t weight;
+			vec3 normal;
+			vec3 viewDirection;
+			// direction given to the illumination model
+			vec3 lightDirection;
+			const Material* materialPtr;
+			// fraction of the light color reaching the point, 0 in the shadow
+			float lightAttenuation;
+			// light of the caustic photons on the point, for the light color of the trace
+			glm_color_t causticColor;
+		};
+
+		// Records of the shading points met by the samples traced with a context
+		// The records of a branch are added after the ones of its parent's earlier branches,
+		// so that the parent weights them once it knows the factor of the branch in its color
+		class ShadingRecorder
+		{
+		public:
+			// pixel of a traced sample and its first record, the following ones up to the next sample being its own
+			struct Sample
+			{
+				int pixel;
+				size_t firstRecord;
+			};
+
+			std::vector<ShadingRecord> records;
+			std::vector<Sample> samples;
+
+			void clear()
+			{
+				records.clear();
+				samples.clear();
+			}
+
+			// Start the records of a sample of the pixel
+			void beginSample(int pixel)
+			{
+				samples.push_back(Sample{ pixel, records.size() });
+			}
+
+			// Position of the next record, the ones added after it belong to the branch being traced
+			size_t mark() const
+			{
+				return records.size();
+			}
+
+			// Multiply the weights of the records added since the mark
+			void weight(size_t mark, const glm_color_t& factor)
+			{
+				for (size_t i = mark; i < records.size(); ++i)
+				{
+					records[i].weight *= factor;
+				}
+			}
+		};
+	}
+
+	namespace Rendering
+	{
+		// Keeps the shading points of every sample of the last fully traced frame,
+		// so that the frame can be shaded again when only the shading parameters changed:
+		// the ambiant, specular coefficients and shininess of the materials, the ambiant light and the color of the light source
+		// Everything else, as the geometry, the camera, the light position or the glass, requires tracing the frame again
+		class ShadingCache
+		{
+		public:
+			ShadingCache() :
+				isValid(false),
+				camera(vec3(0, 0, 0), 0, Screen{ 0, 0 }),
+				width(0),
+				height(0)
+			{}
+
+			// Forget the recorded frame and prepare one recorder per thread for the frame about to be traced
+			void begin(const Scene& scene, const Camera& camera, int width, int height, unsigned threadCount);
+
+			// Recorder of the samples traced by a thread, valid until the next call to begin
+			Raytracing::ShadingRecorder& recorder(unsigned threadIndex)
+			{
+				return recorders[threadIndex];
+			}
+
+			// Keep the records once the frame is traced
+			// A frame whose pixels were not all traced, as the ones reused from the last view, cannot be shaded again
+			void end(bool isComplete)
+			{
+				isValid = isComplete;
+			}
+
+			// Forget the recorded frame
+			void invalidate()
+			{
+				isValid = false;
+			}
+
+			// Return true if the recorded frame is the one the camera would trace in the scene, up to its shading
+			// The channels of the light color that were black when the frame was traced must remain so,
+			// the caustic photons being only rescaled
+			bool canReshade(const Scene& scene, const Camera& camera, const FrameBuffer& frame) const;
+
+			// Write in the frame the recorded samples shaded with the current parameters of the scene
+			// The shading points are evaluated in parallel by the pool
+			void reshade(const Scene& scene, FrameBuffer& frame, utilities::ThreadPool& pool);
+
+		private:
+			bool isValid;
+			Camera camera;
+			int width;
+			int height;
+			vec3 lightPosition;
+			glm_color_t lightColor;
+			std::vector<Raytracing::ShadingRecorder> recorders;
+			// color of every sample of every recorder, before they are averaged in their pixel
+			std::vector<std::vector<glm_color_t>> sampleColors;
+		};
+	}
+}
+
+#endif
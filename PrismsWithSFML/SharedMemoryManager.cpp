@@ -0,0 +1,215 @@
+#include "stdafx.h"
+#include "SharedMemoryManager.h"
+
+// Defines the functions declared in its SharedMemoryManager.h
+// All the functions descriptions could be found there
+
+#include <cstring>
+#include <fstream>
+#include <new>
+#include <stdexcept>
+
+#ifdef _WIN32
+// keeps windows.h from defining the min and max macros
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+	constexpr uint32_t SHARED_FRAME_VERSION = 1;
+
+	// The header, the slots and their pixels start on cache lines, the slots on pages
+	constexpr size_t HEADER_SIZE = 128;
+	constexpr size_t SLOT_HEADER_SIZE = 64;
+	constexpr size_t SLOT_ALIGNMENT = 4096;
+	static_assert(sizeof(SharedFrameHeader) <= HEADER_SIZE && sizeof(SharedFrameSlot) <= SLOT_HEADER_SIZE, "the headers do not fit in their space");
+
+	inline size_t alignUp(size_t size, size_t alignment)
+	{
+		return (size + alignment - 1) / alignment * alignment;
+	}
+
+	inline unsigned char toByte(float value)
+	{
+		return (value >= 1) ? 255u : static_cast<unsigned char>(std::max(value, 0.f) * 255);
+	}
+
+#ifdef _WIN32
+	void* createSharedMemory(const std::string& name, size_t size, intptr_t& handle)
+	{
+		const HANDLE mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+			static_cast<DWORD>(static_cast<uint64_t>(size) >> 32), static_cast<DWORD>(size & 0xffffffffu), ("Local\\" + name).c_str());
+		if (mapping == nullptr)
+		{
+			return nullptr;
+		}
+		void* address = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+		if (address == nullptr)
+		{
+			CloseHandle(mapping);
+			return nullptr;
+		}
+		handle = reinterpret_cast<intptr_t>(mapping);
+		return address;
+	}
+
+	// the memory lives as long as a process keeps it mapped
+	void destroySharedMemory(const std::string&, void* address, size_t, intptr_t handle)
+	{
+		UnmapViewOfFile(address);
+		CloseHandle(reinterpret_cast<HANDLE>(handle));
+	}
+#else
+	void* createSharedMemory(const std::string& name, size_t size, intptr_t& handle)
+	{
+		const int file = shm_open(("/" + name).c_str(), O_CREAT | O_RDWR, 0644);
+		if (file < 0)
+		{
+			return nullptr;
+		}
+		void* address = ::ftruncate(file, static_cast<off_t>(size)) == 0
+			? ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0) : MAP_FAILED;
+		if (address == MAP_FAILED)
+		{
+			::close(file);
+			shm_unlink(("/" + name).c_str());
+			return nullptr;
+		}
+		handle = file;
+		return address;
+	}
+
+	// the name is removed, the consumers that mapped the memory keep reading it
+	void destroySharedMemory(const std::string& name, void* address, size_t size, intptr_t handle)
+	{
+		::munmap(address, size);
+		::close(static_cast<int>(handle));
+		shm_unlink(("/" + name).c_str());
+	}
+#endif
+}
+
+SharedMemoryManager::SharedMemoryManager(const std::string& name, int width, int height, SharedFrameFormat format, int slotCount) :
+	name(name),
+	handle(0),
+	size(0),
+	headerPtr(nullptr),
+	slotPtr(nullptr),
+	pixels(nullptr),
+	frameNumber(0),
+	bytesPerPixel(format == SharedFrameFormat::RGB32F ? 3 * sizeof(float) : 4)
+{
+	slotCount = std::max(slotCount, 2);
+	const size_t slotSize = alignUp(SLOT_HEADER_SIZE + static_cast<size_t>(width) * height * bytesPerPixel, SLOT_ALIGNMENT);
+	size = alignUp(HEADER_SIZE, SLOT_ALIGNMENT) + slotCount * slotSize;
+	void* address = createSharedMemory(name, size, handle);
+	if (address == nullptr)
+	{
+		throw std::runtime_error("The shared memory " + name + " could not be created");
+	}
+
+	// the sequences are written last, a consumer attaching meanwhile sees no frame
+	headerPtr = new (address) SharedFrameHeader{};
+	std::memcpy(headerPtr->magic, "PRISMFB", 8);
+	headerPtr->version = SHARED_FRAME_VERSION;
+	headerPtr->headerSize = static_cast<uint32_t>(alignUp(HEADER_SIZE, SLOT_ALIGNMENT));
+	headerPtr->slotHeaderSize = static_cast<uint32_t>(SLOT_HEADER_SIZE);
+	headerPtr->slotCount = static_cast<uint32_t>(slotCount);
+	headerPtr->slotSize = slotSize;
+	headerPtr->width = static_cast<uint32_t>(width);
+	headerPtr->height = static_cast<uint32_t>(height);
+	headerPtr->format = format;
+	for (int i = 0; i < slotCount; ++i)
+	{
+		new (slot(i)) SharedFrameSlot{};
+	}
+	headerPtr->isCloseRequested.store(0);
+	headerPtr->sequence.store(0, std::memory_order_release);
+
+	cleanWindow();
+}
+
+SharedMemoryManager::~SharedMemoryManager()
+{
+	destroySharedMemory(name, headerPtr, size, handle);
+}
+
+bool SharedMemoryManager::closedWindowEventHandler()
+{
+	return headerPtr->isCloseRequested.load(std::memory_order_relaxed) != 0;
+}
+
+void SharedMemoryManager::cleanWindow()
+{
+	// the slot is marked as written before its pixels change
+	frameNumber = headerPtr->sequence.load(std::memory_order_relaxed) + 1;
+	slotPtr = slot(frameNumber);
+	pixels = reinterpret_cast<char*>(slotPtr) + SLOT_HEADER_SIZE;
+	slotPtr->sequence.store(0, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	std::memset(pixels, 0, static_cast<size_t>(headerPtr->width) * headerPtr->height * bytesPerPixel);
+}
+
+void SharedMemoryManager::display()
+{
+	slotPtr->sequence.store(frameNumber, std::memory_order_release);
+	headerPtr->sequence.store(frameNumber, std::memory_order_release);
+}
+
+void SharedMemoryManager::drawPixel(int x, int y, const glm::vec3& color)
+{
+	char* pixel = pixels + (static_cast<size_t>(y) * headerPtr->width + x) * bytesPerPixel;
+	if (headerPtr->format == SharedFrameFormat::RGB32F)
+	{
+		std::memcpy(pixel, &color[0], 3 * sizeof(float));
+		return;
+	}
+	pixel[0] = static_cast<char>(toByte(color.r));
+	pixel[1] = static_cast<char>(toByte(color.g));
+	pixel[2] = static_cast<char>(toByte(color.b));
+	pixel[3] = static_cast<char>(255u);
+}
+
+void SharedMemoryManager::saveToFile(std::string filename)
+{
+	std::ofstream file(filename, std::ios::binary);
+	const uint64_t sequence = headerPtr->sequence.load(std::memory_order_acquire);
+	if (!file || sequence == 0)
+	{
+		return;
+	}
+	file << "P6\n" << headerPtr->width << " " << headerPtr->height << "\n255\n";
+
+	const char* framePixels = reinterpret_cast<const char*>(slot(sequence)) + SLOT_HEADER_SIZE;
+	const size_t pixelCount = static_cast<size_t>(headerPtr->width) * headerPtr->height;
+	std::vector<unsigned char> bytes(pixelCount * 3);
+	for (size_t i = 0; i < pixelCount; ++i)
+	{
+		const char* pixel = framePixels + i * bytesPerPixel;
+		for (int channel = 0; channel < 3; ++channel)
+		{
+			if (headerPtr->format == SharedFrameFormat::RGB32F)
+			{
+				float value{};
+				std::memcpy(&value, pixel + channel * sizeof(float), sizeof(float));
+				bytes[3 * i + channel] = toByte(value);
+			}
+			else
+			{
+				bytes[3 * i + channel] = static_cast<unsigned char>(pixel[channel]);
+			}
+		}
+	}
+	file.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+}
+
+SharedFrameSlot* SharedMemoryManager::slot(uint64_t sequence) const
+{
+	char* slots = reinterpret_cast<char*>(headerPtr) + headerPtr->headerSize;
+	return reinterpret_cast<SharedFrameSlot*>(slots + (sequence % headerPtr->slotCount) * headerPtr->slotSize);
+}
@@ -0,0 +1,104 @@
+#ifndef SHARED_MEMORY_MANAGER_H
+#define SHARED_MEMORY_MANAGER_H
+
+// Publishes the frames in shared memory, where other processes of the host read them without copies
+
+#include "stdafx.h"
+#include "IDrawingManager.h"
+#include "IInputManager.h"
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// Format of the pixels of the shared frames, stored row by row from the top left corner
+enum class SharedFrameFormat : uint32_t
+{
+	// 8 bits per channel, the colors clamped to [0, 1] as in the window
+	RGBA8 = 1,
+	// 32 bits float per channel, the colors as the renderer computed them
+	RGB32F = 2
+};
+
+// Start of the shared memory, followed by slotCount slots of slotSize bytes from headerSize
+// Every slot starts with a SharedFrameSlot, and its pixels follow it at slotHeaderSize
+struct SharedFrameHeader
+{
+	// "PRISMFB" and its terminating zero
+	char magic[8];
+	uint32_t version;
+	uint32_t headerSize;
+	uint32_t slotHeaderSize;
+	uint32_t slotCount;
+	uint64_t slotSize;
+	uint32_t width;
+	uint32_t height;
+	SharedFrameFormat format;
+	// number of the last published frame, which lies in the slot sequence % slotCount, 0 before the first one
+	std::atomic<uint64_t> sequence;
+	// set by a consumer to stop the renderer as closing its window would
+	std::atomic<uint32_t> isCloseRequested;
+};
+
+// Header of a slot of the ring
+struct SharedFrameSlot
+{
+	// number of the frame held by the slot, 0 while it is written
+	std::atomic<uint64_t> sequence;
+};
+
+// Class that publishes the frames in a ring of slots in named shared memory, by implementing the provided interfaces
+// A frame is written in the slot after the last published one, so the readers have slotCount - 1 frames to read one:
+// a reader loads the sequence n of the header, then the sequence of the slot n % slotCount, reads the pixels in place,
+// and keeps them if the slot sequence, loaded again after them, is still n
+// No key is ever pressed, and the window is closed once a consumer requests it
+// The setup throws std::runtime_error
+class SharedMemoryManager : public IDrawingManager, public IInputManager
+{
+public:
+	// Create the shared memory under the name, "/name" for shm_open on POSIX and "Local\name" on Windows
+	SharedMemoryManager(const std::string& name, int width, int height, SharedFrameFormat format = SharedFrameFormat::RGBA8, int slotCount = 3);
+	~SharedMemoryManager();
+
+	SharedMemoryManager(const SharedMemoryManager&) = delete;
+	SharedMemoryManager& operator=(const SharedMemoryManager&) = delete;
+
+	bool closedWindowEventHandler() override;
+
+	// start the next frame in its slot, black
+	void cleanWindow() override;
+
+	// publish the frame drawn since the last cleaning
+	void display() override;
+
+	void drawPixel(int x, int y, const glm::vec3& color) override;
+
+	// write the last published frame in the binary PPM format, whatever the extension
+	void saveToFile(std::string filename) override;
+
+	bool isKeyPressed(Key) override
+	{
+		return false;
+	}
+
+	// number of the last published frame
+	uint64_t publishedFrames() const
+	{
+		return headerPtr->sequence.load();
+	}
+
+private:
+	std::string name;
+	// native handle of the shared memory, an int on POSIX and a HANDLE on Windows
+	intptr_t handle;
+	size_t size;
+	SharedFrameHeader* headerPtr;
+	// slot of the frame being drawn, its pixels and its number once published
+	SharedFrameSlot* slotPtr;
+	char* pixels;
+	uint64_t frameNumber;
+	size_t bytesPerPixel;
+
+	SharedFrameSlot* slot(uint64_t sequence) const;
+};
+
+#endif
@@ -0,0 +1,249 @@
+#include "stdafx.h"
+#include "Socket.h"
+
+// Defines the functions declared in its Socket.h
+// All the functions descriptions could be found there
+
+#include <stdexcept>
+
+#ifdef _WIN32
+// keeps windows.h from defining the min and max macros
+#define NOMINMAX
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "Ws2_32.lib")
+#else
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#endif
+
+namespace utilities
+{
+	namespace
+	{
+#ifdef _WIN32
+		typedef SOCKET NativeSocket;
+		const intptr_t INVALID_HANDLE = static_cast<intptr_t>(INVALID_SOCKET);
+
+		// Winsock is started once for the whole process
+		void startNetwork()
+		{
+			static const bool isStarted = []() {
+				WSADATA data;
+				if (WSAStartup(MAKEWORD(2, 2), &data) != 0)
+				{
+					throw std::runtime_error("Winsock could not be started");
+				}
+				return true;
+			}();
+			(void)isStarted;
+		}
+
+		void closeNative(intptr_t handle)
+		{
+			closesocket(static_cast<NativeSocket>(handle));
+		}
+#else
+		typedef int NativeSocket;
+		const intptr_t INVALID_HANDLE = -1;
+
+		void startNetwork()
+		{}
+
+		void closeNative(intptr_t handle)
+		{
+			::close(static_cast<NativeSocket>(handle));
+		}
+#endif
+
+		NativeSocket native(intptr_t handle)
+		{
+			return static_cast<NativeSocket>(handle);
+		}
+
+		// the messages are small and answered at once, they are sent without waiting to be grouped
+		void disableDelay(intptr_t handle)
+		{
+			int isEnabled = 1;
+			setsockopt(native(handle), IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&isEnabled), sizeof(isEnabled));
+		}
+	}
+
+	Socket::Socket() :
+		handle(INVALID_HANDLE)
+	{}
+
+	Socket::Socket(intptr_t handle) :
+		handle(handle)
+	{}
+
+	Socket::~Socket()
+	{
+		close();
+	}
+
+	Socket::Socket(Socket&& other) :
+		handle(other.handle)
+	{
+		other.handle = INVALID_HANDLE;
+	}
+
+	Socket& Socket::operator=(Socket&& other)
+	{
+		if (this != &other)
+		{
+			close();
+			handle = other.handle;
+			other.handle = INVALID_HANDLE;
+		}
+		return *this;
+	}
+
+	Socket Socket::listen(uint16_t port)
+	{
+		startNetwork();
+		Socket socket(static_cast<intptr_t>(::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP)));
+		if (!socket.isValid())
+		{
+			throw std::runtime_error("The listening socket could not be created");
+		}
+
+		int isReused = 1;
+		setsockopt(native(socket.handle), SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&isReused), sizeof(isReused));
+
+		sockaddr_in address{};
+		address.sin_family = AF_INET;
+		address.sin_addr.s_addr = htonl(INADDR_ANY);
+		address.sin_port = htons(port);
+		if (bind(native(socket.handle), reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0
+			|| ::listen(native(socket.handle), SOMAXCONN) != 0)
+		{
+			throw std::runtime_error("Could not listen on port " + std::to_string(port));
+		}
+		return socket;
+	}
+
+	Socket Socket::connect(const std::string& host, uint16_t port)
+	{
+		startNetwork();
+		addrinfo hints{};
+		hints.ai_family = AF_INET;
+		hints.ai_socktype = SOCK_STREAM;
+		addrinfo* addresses = nullptr;
+		if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &addresses) != 0)
+		{
+			throw std::runtime_error("Unknown host " + host);
+		}
+
+		Socket socket;
+		for (const addrinfo* address = addresses; address != nullptr && !socket.isValid(); address = address->ai_next)
+		{
+			Socket candidate(static_cast<intptr_t>(::socket(address->ai_family, address->ai_socktype, address->ai_protocol)));
+			if (candidate.isValid() && ::connect(native(candidate.handle), address->ai_addr, static_cast<int>(address->ai_addrlen)) == 0)
+			{
+				socket = std::move(candidate);
+			}
+		}
+		freeaddrinfo(addresses);
+
+		if (!socket.isValid())
+		{
+			throw std::runtime_error("Could not connect to " + host + ":" + std::to_string(port));
+		}
+		disableDelay(socket.handle);
+		return socket;
+	}
+
+	Socket Socket::accept(int timeoutMs)
+	{
+		fd_set readable;
+		FD_ZERO(&readable);
+		FD_SET(native(handle), &readable);
+		timeval timeout{};
+		timeout.tv_sec = timeoutMs / 1000;
+		timeout.tv_usec = (timeoutMs % 1000) * 1000;
+		if (select(static_cast<int>(native(handle)) + 1, &readable, nullptr, nullptr, &timeout) <= 0)
+		{
+			return Socket();
+		}
+
+		Socket connection(static_cast<intptr_t>(::accept(native(handle), nullptr, nullptr)));
+		if (connection.isValid())
+		{
+			disableDelay(connection.handle);
+		}
+		return connection;
+	}
+
+	bool Socket::sendAll(const void* data, size_t size)
+	{
+		const char* bytes = static_cast<const char*>(data);
+		while (size > 0)
+		{
+#ifdef _WIN32
+			const int sent = send(native(handle), bytes, static_cast<int>(std::min(size, static_cast<size_t>(1 << 30))), 0);
+#else
+			// a lost peer must not raise SIGPIPE
+			const ssize_t sent = send(native(handle), bytes, size, MSG_NOSIGNAL);
+#endif
+			if (sent <= 0)
+			{
+				return false;
+			}
+			bytes += sent;
+			size -= static_cast<size_t>(sent);
+		}
+		return true;
+	}
+
+	bool Socket::receiveAll(void* data, size_t size)
+	{
+		char* bytes = static_cast<char*>(data);
+		while (size > 0)
+		{
+#ifdef _WIN32
+			const int received = recv(native(handle), bytes, static_cast<int>(std::min(size, static_cast<size_t>(1 << 30))), 0);
+#else
+			const ssize_t received = recv(native(handle), bytes, size, 0);
+#endif
+			if (received <= 0)
+			{
+				return false;
+			}
+			bytes += received;
+			size -= static_cast<size_t>(received);
+		}
+		return true;
+	}
+
+	void Socket::setReceiveTimeout(int timeoutMs)
+	{
+#ifdef _WIN32
+		const DWORD timeout = static_cast<DWORD>(timeoutMs);
+#else
+		timeval timeout{};
+		timeout.tv_sec = timeoutMs / 1000;
+		timeout.tv_usec = (timeoutMs % 1000) * 1000;
+#endif
+		setsockopt(native(handle), SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast<const char*>(&timeout), sizeof(timeout));
+	}
+
+	bool Socket::isValid() const
+	{
+		return handle != INVALID_HANDLE;
+	}
+
+	void Socket::close()
+	{
+		if (isValid())
+		{
+			closeNative(handle);
+			handle = INVALID_HANDLE;
+		}
+	}
+}
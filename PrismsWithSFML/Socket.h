@@ -0,0 +1,55 @@
+#ifndef SOCKET_H
+#define SOCKET_H
+
+// Minimal TCP sockets over Winsock or POSIX, used to spread the rendering over several processes
+
+#include "stdafx.h"
+#include <cstdint>
+#include <string>
+
+namespace utilities
+{
+	// TCP socket, connected or listening, closed on destruction
+	// The errors of the setup throw std::runtime_error, the ones of the transfers are returned
+	class Socket
+	{
+	public:
+		Socket();
+		~Socket();
+
+		Socket(Socket&& other);
+		Socket& operator=(Socket&& other);
+		Socket(const Socket&) = delete;
+		Socket& operator=(const Socket&) = delete;
+
+		// Return a socket listening on the port of every interface
+		static Socket listen(uint16_t port);
+
+		// Return a socket connected to the host, given by its name or its address
+		static Socket connect(const std::string& host, uint16_t port);
+
+		// Return the next incoming connection, or an invalid socket if none came within the timeout
+		Socket accept(int timeoutMs);
+
+		// Return false if the connection was lost
+		bool sendAll(const void* data, size_t size);
+
+		// Return false if the connection was lost or if nothing came within the receive timeout
+		bool receiveAll(void* data, size_t size);
+
+		// Receptions fail after waiting that long, 0 to wait forever
+		void setReceiveTimeout(int timeoutMs);
+
+		bool isValid() const;
+
+		void close();
+
+	private:
+		// native handle, an int on POSIX and a SOCKET on Windows
+		intptr_t handle;
+
+		explicit Socket(intptr_t handle);
+	};
+}
+
+#endif
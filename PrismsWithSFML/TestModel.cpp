@@ -1,5 +1,6 @@
 #include "stdafx.h"
 #include "TestModel.h"
+#include "GraphicsFunctions.h"
 
 using Graphics::Triangle;
 using Graphics::Material;
@@ -31,6 +32,18 @@ namespace TestModel
 	// B =420 000nm
 
 
+	Material materialFlintPrism(
+		grey,
+		1, //specular
+		0, //diffuse
+		0.1, //ambiant
+		2, //shininess
+		0.f, //reflection
+		1, //refraction
+		1.7280f,
+		1'342'000.f);
+	//dense flint glass, more dispersive than the BK7 one
+
 	void LoadTestModelCornellBox(std::vector<Triangle>& triangles)
 	{
 		triangles.clear();
@@ -163,15 +176,29 @@ namespace TestModel
 		}
 	}
 
-	void LoadTestModelTriangularPrism(std::vector<Graphics::Triangle>& triangles, float prismSize)
+	// Side of the room of the prism models
+	constexpr float PRISM_ROOM_SIDE = 20;
+
+	// Return the linear part of the transform scaling the prism models to the volume [-1,1]^3
+	glm::mat3 prismRoomScale()
 	{
-		triangles.clear();
-		triangles.reserve(2 + 2 + 3 * 2);
+		const float scale = 2 / PRISM_ROOM_SIDE;
+		return glm::mat3(
+			vec3(-scale, 0, 0),
+			vec3(0, -scale, 0),
+			vec3(0, 0, scale));
+	}
 
-		// ---------------------------------------------------------------------------
-		// Room
+	// Return where a point of the room of the prism models is placed in the volume [-1,1]^3
+	vec3 prismRoomPoint(const vec3& point)
+	{
+		return prismRoomScale() * point + vec3(1, 1, -1);
+	}
 
-		float L = 20;			// Length of the scene side.
+	// Loads the floor of the room of the prism models into the polygons of the scene
+	void LoadPrismRoomFloor(std::vector<Triangle>& triangles)
+	{
+		float L = PRISM_ROOM_SIDE;
 
 		//floor
 		vec3 A(0, 0, 0);
@@ -180,27 +207,30 @@ namespace TestModel
 		vec3 D(L, 0, 0);
 
 		// Floor:
-		triangles.push_back(Triangle(C, B, A, &materialFloor));
-		triangles.push_back(Triangle(C, A, D, &materialFloor));
+		triangles.push_back(Triangle(prismRoomPoint(C), prismRoomPoint(B), prismRoomPoint(A), &materialFloor));
+		triangles.push_back(Triangle(prismRoomPoint(C), prismRoomPoint(A), prismRoomPoint(D), &materialFloor));
+	}
 
-		// ---------------------------------------------------------------------------
-		// Prism
+	void LoadTriangularPrismMesh(Graphics::Mesh& mesh, float prismSize)
+	{
+		std::vector<Triangle>& triangles = mesh.triangles;
+		triangles.clear();
+		triangles.reserve(2 + 3 * 2);
 
-		float half_L = L/2;
-		//prism base
-		vec3 E(half_L - prismSize, 0, half_L + prismSize);
-		vec3 F(half_L + prismSize, 0, half_L + prismSize);
-		vec3 G(half_L, 0, half_L - prismSize);
+		//prism base, centered on the origin
+		vec3 E(-prismSize, 0, prismSize);
+		vec3 F(prismSize, 0, prismSize);
+		vec3 G(0, 0, -prismSize);
 
 		float height = 8;
 		//prism top
 		vec3 H = E + vec3(0, height, 0);
 		vec3 I = F + vec3(0, height, 0);
 		vec3 J = G + vec3(0, height, 0);
-		
+
 
 		// Base
-		triangles.push_back(Triangle(E, G, F, &materialPrism));
+		triangles.push_back(Triangle(E, F, G, &materialPrism));
 
 		// Top
 		triangles.push_back(Triangle(H, J, I, &materialPrism));
@@ -216,31 +246,90 @@ namespace TestModel
 		// RIGHT
 		triangles.push_back(Triangle(J, E, G, &materialPrism));
 		triangles.push_back(Triangle(E, J, H, &materialPrism));
+	}
 
+	void LoadTestModelTriangularPrism(Graphics::Scene& scene, float prismSize)
+	{
+		scene.polygons.clear();
+		scene.meshes.clear();
+		scene.instances.clear();
+		scene.shapes.clear();
+		LoadPrismRoomFloor(scene.polygons);
 
-		// ----------------------------------------------
-		// Scale to the volume [-1,1]^3
+		// ---------------------------------------------------------------------------
+		// Prism, in the middle of the room
 
-		for (size_t i = 0; i < triangles.size(); ++i)
-		{
-			triangles[i].v0 *= 2 / L;
-			triangles[i].v1 *= 2 / L;
-			triangles[i].v2 *= 2 / L;
+		scene.meshes.push_back(Graphics::Mesh{});
+		LoadTriangularPrismMesh(scene.meshes.back(), prismSize);
 
-			triangles[i].v0 -= vec3(1, 1, 1);
-			triangles[i].v1 -= vec3(1, 1, 1);
-			triangles[i].v2 -= vec3(1, 1, 1);
+		float half_L = PRISM_ROOM_SIDE / 2;
+		scene.instances.push_back(Graphics::Instance(0, prismRoomScale(), prismRoomPoint(vec3(half_L, 0, half_L))));
+	}
 
-			triangles[i].v0.x *= -1;
-			triangles[i].v1.x *= -1;
-			triangles[i].v2.x *= -1;
+	void LoadTestModelPrismBench(Graphics::Scene& scene, int prismCount, float prismSize)
+	{
+		scene.polygons.clear();
+		scene.meshes.clear();
+		scene.instances.clear();
+		scene.shapes.clear();
+		LoadPrismRoomFloor(scene.polygons);
 
-			triangles[i].v0.y *= -1;
-			triangles[i].v1.y *= -1;
-			triangles[i].v2.y *= -1;
+		// ---------------------------------------------------------------------------
+		// Prisms, in a row across the room
+		// they share one mesh, each one is turned a bit more than the previous one and the glasses alternate
 
-			triangles[i].ComputeNormal();
+		scene.meshes.push_back(Graphics::Mesh{});
+		LoadTriangularPrismMesh(scene.meshes.back(), prismSize);
+
+		float half_L = PRISM_ROOM_SIDE / 2;
+		const float spacing = PRISM_ROOM_SIDE / prismCount;
+		scene.instances.reserve(prismCount);
+		for (int i = 0; i < prismCount; ++i)
+		{
+			const vec3 position((i + 0.5f) * spacing, 0, half_L);
+			const float yaw = 360.f * i / prismCount;
+			Material* glass = (i % 2 == 0) ? &materialPrism : &materialFlintPrism;
+			scene.instances.push_back(Graphics::Instance(0, prismRoomScale() * Graphics::rotationYMatrix(yaw), prismRoomPoint(position), glass));
 		}
 	}
+
+	void LoadTestModelOptics(Graphics::Scene& scene, float prismSize)
+	{
+		scene.polygons.clear();
+		scene.meshes.clear();
+		scene.instances.clear();
+		scene.shapes.clear();
+		LoadPrismRoomFloor(scene.polygons);
+
+		float half_L = PRISM_ROOM_SIDE / 2;
+		const float scale = 2 / PRISM_ROOM_SIDE;
+
+		// ---------------------------------------------------------------------------
+		// Prism, in the middle of the room, with the base and the height of the mesh one
+
+		vec3 E(half_L - prismSize, 0, half_L + prismSize);
+		vec3 F(half_L + prismSize, 0, half_L + prismSize);
+		vec3 G(half_L, 0, half_L - prismSize);
+		float height = 8;
+		scene.shapes.push_back(Graphics::Shape::triangularPrism(prismRoomPoint(E), prismRoomPoint(F), prismRoomPoint(G),
+			prismRoomScale() * vec3(0, height, 0), &materialPrism));
+
+		// ---------------------------------------------------------------------------
+		// Ball of flint glass resting on the floor, in front of the prism
+
+		float radius = 1.5f;
+		scene.shapes.push_back(Graphics::Shape::sphere(prismRoomPoint(vec3(half_L - 5, radius, half_L - 4)), scale * radius, &materialFlintPrism));
+
+		// ---------------------------------------------------------------------------
+		// Lenses standing on the floor, their axes along the room
+
+		float curvatureRadius = 6;
+		float lensRadius = 2.5f;
+		float thickness = 2 * (curvatureRadius - std::sqrt(curvatureRadius * curvatureRadius - lensRadius * lensRadius));
+		scene.shapes.push_back(Graphics::Shape::biconvexLens(prismRoomPoint(vec3(half_L + 5, lensRadius, half_L - 5)), vec3(1, 0, 0),
+			scale * curvatureRadius, scale * thickness, &materialPrism));
+		scene.shapes.push_back(Graphics::Shape::planoConvexLens(prismRoomPoint(vec3(half_L - 6, lensRadius, half_L + 5)), vec3(0, 0, 1),
+			scale * curvatureRadius, scale * thickness / 2, &materialPrism));
+	}
 }
 
@@ -28,12 +28,26 @@ namespace TestModel
 	// -1 <= z <= +1
 	void LoadTestModelCornellBox(std::vector<Graphics::Triangle>& triangles);
 
+	// Loads a triangular prism into a mesh, centered on its base
+	// Changing the prism size will make it wider
+	void LoadTriangularPrismMesh(Graphics::Mesh& mesh, float prismSize = 2);
+
 	// Loads a model with a prism on a plane surface. It is scaled to fill the volume:
 	// -1 <= x <= +1
 	// -1 <= y <= +1
 	// -1 <= z <= +1
+	// The prism is an instance of a mesh, the hierarchies of the scene are left to build
+	// Changing the prism size will make it wider
+	void LoadTestModelTriangularPrism(Graphics::Scene& scene, float prismSize = 2);
+
+	// Loads a row of identical prisms on the plane surface of the prism model
+	// They are instances of the same mesh, with alternate glasses, the hierarchies of the scene are left to build
+	void LoadTestModelPrismBench(Graphics::Scene& scene, int prismCount, float prismSize = 1);
+
+	// Loads analytic optics on the plane surface of the prism model: the prism, a glass ball and two lenses
+	// They are shapes hit in closed form instead of triangles, the hierarchies of the scene are left to build
 	// Changing the prism size will make it wider
-	void LoadTestModelTriangularPrism(std::vector<Graphics::Triangle>& triangles, float prismSize = 2);
+	void LoadTestModelOptics(Graphics::Scene& scene, float prismSize = 2);
 }
 
 #endif
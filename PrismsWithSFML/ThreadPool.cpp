@@ -0,0 +1,127 @@
+#include "stdafx.h"
+#include "ThreadPool.h"
+
+// Defines the functions declared in its ThreadPool.h
+// All the functions descriptions could be found there
+
+namespace utilities
+{
+	namespace
+	{
+		// pool and index of the worker running on the current thread, if any
+		thread_local const ThreadPool* currentPool = nullptr;
+		thread_local unsigned currentIndex = 0;
+	}
+
+	void ThreadPool::TaskGroup::run(std::function<void()> task)
+	{
+		++pendingTasks;
+		pool.enqueue([this, task]() {
+			task();
+			--pendingTasks;
+		});
+	}
+
+	void ThreadPool::TaskGroup::wait()
+	{
+		while (pendingTasks > 0)
+		{
+			if (!pool.runPendingTask())
+			{
+				std::this_thread::yield();
+			}
+		}
+	}
+
+	ThreadPool::ThreadPool(unsigned workerCount) :
+		isStopping(false)
+	{
+		workers.reserve(workerCount);
+		for (unsigned i = 0; i < workerCount; ++i)
+		{
+			workers.emplace_back([this, i]() { workerLoop(i); });
+		}
+	}
+
+	ThreadPool::~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			isStopping = true;
+		}
+		taskAvailable.notify_all();
+		for (std::thread& worker : workers)
+		{
+			worker.join();
+		}
+	}
+
+	unsigned ThreadPool::threadIndex() const
+	{
+		return (currentPool == this) ? currentIndex : static_cast<unsigned>(workers.size());
+	}
+
+	void ThreadPool::parallelFor(int begin, int end, int grain, const std::function<void(int, int)>& body)
+	{
+		grain = std::max(grain, 1);
+		TaskGroup group(*this);
+		for (int chunkBegin = begin; chunkBegin < end; chunkBegin += grain)
+		{
+			const int chunkEnd = std::min(chunkBegin + grain, end);
+			group.run([&body, chunkBegin, chunkEnd]() { body(chunkBegin, chunkEnd); });
+		}
+		group.wait();
+	}
+
+	unsigned ThreadPool::defaultWorkerCount()
+	{
+		const unsigned hardwareThreads = std::thread::hardware_concurrency();
+		return (hardwareThreads > 1) ? hardwareThreads - 1 : 0;
+	}
+
+	void ThreadPool::enqueue(std::function<void()> task)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			tasks.push_back(std::move(task));
+		}
+		taskAvailable.notify_one();
+	}
+
+	bool ThreadPool::runPendingTask()
+	{
+		std::function<void()> task;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (tasks.empty())
+			{
+				return false;
+			}
+			task = std::move(tasks.front());
+			tasks.pop_front();
+		}
+		task();
+		return true;
+	}
+
+	void ThreadPool::workerLoop(unsigned index)
+	{
+		currentPool = this;
+		currentIndex = index;
+		while (true)
+		{
+			std::function<void()> task;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				taskAvailable.wait(lock, [this]() { return isStopping || !tasks.empty(); });
+				if (tasks.empty())
+				{
+					return;
+				}
+				task = std::move(tasks.front());
+				tasks.pop_front();
+			}
+			task();
+		}
+	}
+}
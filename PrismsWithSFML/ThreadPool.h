@@ -0,0 +1,85 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+// Pool of threads shared by the parallel parts of the renderer
+
+#include "stdafx.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace utilities
+{
+	// Runs tasks on a fixed set of worker threads
+	// A thread waiting for tasks executes the queued ones in the meantime, so tasks can wait for other tasks
+	class ThreadPool
+	{
+	public:
+		// Group of tasks that can be waited for
+		class TaskGroup
+		{
+		public:
+			TaskGroup(ThreadPool& pool) :
+				pool(pool),
+				pendingTasks(0)
+			{}
+
+			~TaskGroup()
+			{
+				wait();
+			}
+
+			// queue a task in the pool
+			void run(std::function<void()> task);
+
+			// return once all the tasks of the group are done
+			void wait();
+
+		private:
+			ThreadPool& pool;
+			std::atomic<int> pendingTasks;
+		};
+
+		// By default, one worker per hardware thread besides the calling one
+		explicit ThreadPool(unsigned workerCount = defaultWorkerCount());
+		~ThreadPool();
+
+		ThreadPool(const ThreadPool&) = delete;
+		ThreadPool& operator=(const ThreadPool&) = delete;
+
+		// Number of threads that may execute tasks: the workers and the threads outside of the pool
+		unsigned threadCount() const
+		{
+			return static_cast<unsigned>(workers.size()) + 1;
+		}
+
+		// Index of the current thread in [0, threadCount())
+		// The last index is shared by all the threads outside of the pool, usually only the main thread
+		unsigned threadIndex() const;
+
+		// Call body(chunkBegin, chunkEnd) on chunks of at most grain elements covering [begin, end)
+		// Return once all the chunks are done, the calling thread takes part in the work
+		void parallelFor(int begin, int end, int grain, const std::function<void(int, int)>& body);
+
+		static unsigned defaultWorkerCount();
+
+	private:
+		std::vector<std::thread> workers;
+		std::deque<std::function<void()>> tasks;
+		std::mutex mutex;
+		std::condition_variable taskAvailable;
+		bool isStopping;
+
+		void enqueue(std::function<void()> task);
+
+		// execute one queued task, return false if none was waiting
+		bool runPendingTask();
+
+		void workerLoop(unsigned index);
+	};
+}
+
+#endif
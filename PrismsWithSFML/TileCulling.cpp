@@ -0,0 +1,55 @@
+#include "stdafx.h"
+#include "TileCulling.h"
+#include "GraphicsFunctions.h"
+#include "Profiler.h"
+
+// Defines the functions declared in its TileCulling.h
+// All the functions descriptions could be found there
+
+namespace Graphics
+{
+	namespace Rendering
+	{
+		bool TileCulling::update(const Scene& scene, const Camera& camera, utilities::ThreadPool& pool)
+		{
+			if (isValid && camera.hasSameView(lastCamera))
+			{
+				return false;
+			}
+			PROFILE_ZONE("Tile culling");
+
+			tilesX = (camera.screen.width + tileSize - 1) / tileSize;
+			tilesY = (camera.screen.height + tileSize - 1) / tileSize;
+			tileCandidates.resize(tilesX * tilesY);
+			isTileCulled.assign(tilesX * tilesY, false);
+
+			pool.parallelFor(0, tilesY, 1, [&](int tileRowBegin, int tileRowEnd) {
+				for (int tileY = tileRowBegin; tileY < tileRowEnd; ++tileY)
+				{
+					for (int tileX = 0; tileX < tilesX; ++tileX)
+					{
+						// the samples of a tile all lie inside its pixels
+						const Frustum frustum = Raytracing::tileFrustum(camera,
+							static_cast<float>(tileX * tileSize), static_cast<float>(tileY * tileSize),
+							static_cast<float>(std::min((tileX + 1) * tileSize, camera.screen.width)),
+							static_cast<float>(std::min((tileY + 1) * tileSize, camera.screen.height)));
+						const int tileIndex = tileY * tilesX + tileX;
+						isTileCulled[tileIndex] = Raytracing::FindPrimitivesInFrustum(scene, frustum, tileCandidates[tileIndex], maxCandidates);
+					}
+				}
+			});
+
+			lastCamera = camera;
+			isValid = true;
+			return true;
+		}
+
+		const Raytracing::CandidatePrimitives* TileCulling::candidates(float x, float y) const
+		{
+			const int tileX = std::min(std::max(static_cast<int>(x) / tileSize, 0), tilesX - 1);
+			const int tileY = std::min(std::max(static_cast<int>(y) / tileSize, 0), tilesY - 1);
+			const int tileIndex = tileY * tilesX + tileX;
+			return isTileCulled[tileIndex] ? &tileCandidates[tileIndex] : nullptr;
+		}
+	}
+}
@@ -0,0 +1,60 @@
+#ifndef TILE_CULLING_H
+#define TILE_CULLING_H
+
+// Screen-space culling of the primitives the primary rays may hit
+
+#include "stdafx.h"
+#include "GraphicsModel.h"
+#include "ThreadPool.h"
+
+namespace Graphics
+{
+	namespace Rendering
+	{
+		// Keeps, for each screen tile, the primitives lying in the frustum of its primary rays
+		// The primary rays of a tile are only intersected with them, and the rays of a tile without any hit nothing
+		// The candidates are kept as long as the camera does not move
+		class TileCulling
+		{
+		public:
+			// side of the square tiles, in pixels
+			const int tileSize;
+			// tiles with more candidates than that search the whole scene, its hierarchies being faster then
+			const size_t maxCandidates;
+
+			TileCulling(int tileSize, size_t maxCandidates = 32) :
+				tileSize(tileSize),
+				maxCandidates(maxCandidates),
+				tilesX(0),
+				tilesY(0),
+				isValid(false),
+				lastCamera(vec3(0, 0, 0), 0, Screen{ 0, 0 })
+			{}
+
+			// Cull the scene against the frustum of every tile again if the camera moved since the last update or if the culling was invalidated
+			// The rows of tiles are culled in parallel by the pool
+			// Return true if the candidates were computed again
+			bool update(const Scene& scene, const Camera& camera, utilities::ThreadPool& pool);
+
+			// Force the culling at the next update, to be called when the scene geometry changes
+			void invalidate()
+			{
+				isValid = false;
+			}
+
+			// Return the candidates of the tile holding the floating point pixel coordinates (x,y)
+			// or nullptr if the tile has too many of them to be worth a list
+			const Raytracing::CandidatePrimitives* candidates(float x, float y) const;
+
+		private:
+			int tilesX;
+			int tilesY;
+			std::vector<Raytracing::CandidatePrimitives> tileCandidates;
+			std::vector<char> isTileCulled;
+			bool isValid;
+			Camera lastCamera;
+		};
+	}
+}
+
+#endif
@@ -8,38 +8,25 @@
 
 namespace utilities
 {
-	//custom chrono class to measure durations in code
-	class Chrono
+	// Measures durations on the steady clock, which never goes backwards, from its creation
+	// The zones of the frames are timed by the profiler, see Profiler.h
+	class Stopwatch
 	{
 	private:
-		std::chrono::system_clock::time_point t;
-		bool isChronoStarted = false;
+		std::chrono::steady_clock::time_point t;
 	public:
 
-		Chrono() = default;
+		Stopwatch() :
+			t(std::chrono::steady_clock::now())
+		{}
 
-		// initialize the chronometer
-		void startChrono()
+		// get the elapsed time in milliseconds since the creation or the last lap
+		double lap()
 		{
-			t = std::chrono::system_clock::now();	// Set start value for timer.
-			isChronoStarted = true;
-		}
-
-		// get the elpased time since last call
-		double getChronoElapsedTime()
-		{
-			if (isChronoStarted)
-			{
-				// Compute frame time:
-				std::chrono::system_clock::time_point t2 = std::chrono::system_clock::now();
-				std::chrono::duration<double> dt{ t2 - t };
-				t = t2;
-				return dt.count() * 1000;
-			}
-			else
-			{
-				throw std::logic_error("Chrono not started");
-			}
+			const std::chrono::steady_clock::time_point t2 = std::chrono::steady_clock::now();
+			const std::chrono::duration<double, std::milli> dt{ t2 - t };
+			t = t2;
+			return dt.count();
 		}
 	};
 }